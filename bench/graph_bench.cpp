@@ -0,0 +1,401 @@
+/**
+ * Scheduler benchmark.
+ *
+ * Builds synthetic graphs whose nodes do (almost) no work and measures how
+ * long each executor takes to run a frame. With empty node bodies the frame
+ * time is the scheduling overhead.
+ *
+ *   graph_bench [--frames N] [--work-us N] [--threads 1,2,4] [--max-nodes N]
+ */
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "graph-e/node_graph.h"
+#include "graph-e/serial_executor.h"
+#include "graph-e/threaded_executor.h"
+#include "graph-e/work_stealing_executor.h"
+#include "graph-e/pipelined_executor.h"
+
+#include "gnl/gnl_threadpool.h"
+
+using clock_type = std::chrono::steady_clock;
+
+static void spin_for(double us)
+{
+    if( us <= 0.0 )
+        return;
+    auto end = clock_type::now() + std::chrono::duration_cast<clock_type::duration>( std::chrono::duration<double, std::micro>(us) );
+    while( clock_type::now() < end )
+    {
+    }
+}
+
+/**
+ * A node with any number of resetable int inputs and one resetable output.
+ */
+class bench_node
+{
+public:
+    std::vector< graphe::in_resource<int> > in;
+    graphe::out_resource<int>               out;
+    double                                  work_us;
+
+    bench_node( graphe::ResourceRegistry & G, std::vector<std::string> const & inputs, std::string const & output, double work) : work_us(work)
+    {
+        for(auto & i : inputs)
+            in.push_back( G.register_input_resource<int>(i) );
+        out = G.register_output_resource<int>(output);
+    }
+    void operator()()
+    {
+        int s = 0;
+        for(auto & i : in)
+            s += *i;
+        spin_for(work_us);
+        out.set(s+1);
+    }
+};
+
+/**
+ * One-shot node producing a permanent resource, as in example_3_oneshot.
+ */
+class permanent_source
+{
+public:
+    graphe::out_resource<int> out;
+
+    permanent_source( graphe::ResourceRegistry & G, std::string const & output)
+    {
+        out = G.register_output_resource<int, graphe::resource_flags::permanent>(output);
+    }
+    void operator()()
+    {
+        out.set(1);
+    }
+};
+
+class permanent_consumer
+{
+public:
+    graphe::in_resource<int>  in;
+    graphe::out_resource<int> out;
+    double                    work_us;
+
+    permanent_consumer( graphe::ResourceRegistry & G, std::string const & input, std::string const & output, double work) : work_us(work)
+    {
+        in  = G.register_input_resource<int, graphe::resource_flags::permanent>(input);
+        out = G.register_output_resource<int>(output);
+    }
+    void operator()()
+    {
+        spin_for(work_us);
+        out.set( *in + 1 );
+    }
+};
+
+//=============================================================================
+// Topologies
+//=============================================================================
+static std::string res(size_t i)
+{
+    return "r" + std::to_string(i);
+}
+
+// one root feeding n-1 nodes
+static void build_fan_out(graphe::node_graph & G, size_t n, double work)
+{
+    G.add_node<bench_node>( std::vector<std::string>{}, res(0), work);
+    for(size_t i=1; i < n; ++i)
+        G.add_node<bench_node>( std::vector<std::string>{ res(0) }, res(i), work);
+}
+
+// n nodes, each depending on the previous one
+static void build_chain(graphe::node_graph & G, size_t n, double work)
+{
+    G.add_node<bench_node>( std::vector<std::string>{}, res(0), work);
+    for(size_t i=1; i < n; ++i)
+        G.add_node<bench_node>( std::vector<std::string>{ res(i-1) }, res(i), work);
+}
+
+// a source, then repeated layers of `width` nodes joined back into one node
+static void build_diamonds(graphe::node_graph & G, size_t n, double work)
+{
+    size_t width = 32;
+    size_t count = 0;
+    G.add_node<bench_node>( std::vector<std::string>{}, res(count++), work);
+    while( count + width + 1 <= n )
+    {
+        auto top = count-1;
+        std::vector<std::string> join;
+        for(size_t w=0; w < width; ++w)
+        {
+            join.push_back( res(count) );
+            G.add_node<bench_node>( std::vector<std::string>{ res(top) }, res(count++), work);
+        }
+        G.add_node<bench_node>( join, res(count++), work);
+    }
+}
+
+// node i depends on 1-3 random earlier nodes
+static void build_random(graphe::node_graph & G, size_t n, double work)
+{
+    std::mt19937 rng(1234);
+    G.add_node<bench_node>( std::vector<std::string>{}, res(0), work);
+    for(size_t i=1; i < n; ++i)
+    {
+        std::uniform_int_distribution<size_t> pick(0, i-1);
+        std::uniform_int_distribution<size_t> num(1, 3);
+        std::vector<std::string> inputs;
+        auto k = num(rng);
+        for(size_t j=0; j < k; ++j)
+        {
+            auto name = res( pick(rng) );
+            if( std::find(inputs.begin(), inputs.end(), name) == inputs.end() )
+                inputs.push_back(name);
+        }
+        G.add_node<bench_node>( inputs, res(i), work);
+    }
+}
+
+// a one-shot node producing a permanent resource which n-1 nodes consume every frame
+static void build_oneshot(graphe::node_graph & G, size_t n, double work)
+{
+    G.add_oneshot_node<permanent_source>( std::string("p") );
+    for(size_t i=1; i < n; ++i)
+        G.add_node<permanent_consumer>( std::string("p"), res(i), work);
+}
+
+struct topology
+{
+    std::string name;
+    size_t      nodes;
+    void     (* build)(graphe::node_graph &, size_t, double);
+};
+
+//=============================================================================
+// Executors
+//=============================================================================
+struct ThreadPoolWrapper
+{
+    ThreadPoolWrapper( gnl::thread_pool & T) : m_threadpool(&T)
+    {
+    }
+    void operator()( std::function<void(void)> & exec)
+    {
+        m_threadpool->post( [&exec]() { exec(); } );
+    }
+    void operator()( std::function<void(void)> ** exec, size_t count)
+    {
+        m_threadpool->post_batch( count, [exec](size_t i) { auto e = exec[i]; return [e]() { (*e)(); }; } );
+    }
+    // optional, lets parallel_for() run its chunks on the pool
+    void operator()( std::function<void(void)> && task)
+    {
+        m_threadpool->post( std::move(task) );
+    }
+    // optional, lets wait() run queued nodes on the calling thread
+    bool try_run_one()
+    {
+        return m_threadpool->try_run_one();
+    }
+    gnl::thread_pool *m_threadpool;
+};
+
+struct result
+{
+    std::vector<double> frame_us;
+    double              reset_us = 0.0;
+};
+
+template<typename Run_t>
+static result run_frames(graphe::node_graph & G, size_t frames, Run_t && run_frame)
+{
+    result r;
+
+    // the first frame runs the one-shot nodes and warms up the caches
+    run_frame();
+    G.reset();
+
+    for(size_t f=0; f < frames; ++f)
+    {
+        auto t0 = clock_type::now();
+        run_frame();
+        auto t1 = clock_type::now();
+        G.reset();
+        auto t2 = clock_type::now();
+
+        r.frame_us.push_back( std::chrono::duration<double, std::micro>(t1-t0).count() );
+        r.reset_us += std::chrono::duration<double, std::micro>(t2-t1).count();
+    }
+    r.reset_us /= static_cast<double>( std::max<size_t>(frames,1) );
+    return r;
+}
+
+static double percentile(std::vector<double> v, double p)
+{
+    if( v.empty() )
+        return 0.0;
+    std::sort(v.begin(), v.end());
+    auto i = static_cast<size_t>( p * static_cast<double>(v.size()-1) + 0.5 );
+    return v[i];
+}
+
+static void report(topology const & T, size_t nodes, std::string const & exec, size_t threads, result const & r)
+{
+    double total = 0.0;
+    for(auto f : r.frame_us)
+        total += f;
+    auto frames = r.frame_us.size();
+    auto mean   = total / static_cast<double>(frames);
+
+    std::cout << std::left  << std::setw(10) << T.name
+              << std::right << std::setw(8)  << nodes
+              << std::left  << "  " << std::setw(15) << exec
+              << std::right << std::setw(4)  << threads
+              << std::setw(7)  << frames
+              << std::fixed << std::setprecision(1)
+              << std::setw(11) << mean
+              << std::setw(11) << percentile(r.frame_us, 0.50)
+              << std::setw(11) << percentile(r.frame_us, 0.90)
+              << std::setw(11) << percentile(r.frame_us, 0.99)
+              << std::setw(11) << r.reset_us
+              << std::setw(14) << std::setprecision(0) << static_cast<double>(nodes) * 1e6 / mean
+              << std::setw(10) << std::setprecision(1) << mean * 1000.0 / static_cast<double>(nodes)
+              << std::endl;
+}
+
+static void bench_topology(topology const & T, std::vector<size_t> const & thread_counts, size_t frames, double work)
+{
+    auto make_graph = [&](graphe::node_graph & G)
+    {
+        T.build(G, T.nodes, work);
+        G.compile();
+        return G.get_exec_nodes().size();
+    };
+
+    if( frames == 0 )
+        frames = std::min<size_t>( 200, std::max<size_t>( 5, 2000000 / T.nodes ) );
+
+    {
+        graphe::node_graph G;
+        auto n = make_graph(G);
+        graphe::serial_executor E(G);
+        report(T, n, "serial", 1, run_frames(G, frames, [&]{ E.execute(); }));
+    }
+
+    for(auto t : thread_counts)
+    {
+        graphe::node_graph G;
+        auto n = make_graph(G);
+        gnl::thread_pool P(t);
+        ThreadPoolWrapper W(P);
+        graphe::threaded_executor<ThreadPoolWrapper> E(G);
+        E.set_thread_pool(&W);
+        report(T, n, "threaded", t, run_frames(G, frames, [&]{ E.execute(); E.wait(); }));
+    }
+
+    for(auto t : thread_counts)
+    {
+        graphe::node_graph G;
+        auto n = make_graph(G);
+        graphe::work_stealing_executor E(G, t);
+        report(T, n, "work_stealing", t, run_frames(G, frames, [&]{ E.execute(); E.wait(); }));
+    }
+
+    // two frames in flight, the frame time is the time between frame completions
+    for(auto t : thread_counts)
+    {
+        gnl::thread_pool P(t);
+        ThreadPoolWrapper W(P);
+        graphe::pipelined_executor<ThreadPoolWrapper> E(2, [&](graphe::node_graph & G) { T.build(G, T.nodes, work); });
+        E.set_thread_pool(&W);
+
+        size_t n = E.get_graph(0).get_exec_nodes().size();
+        result r;
+        E.wait( E.submit() );
+        E.submit();
+        auto last = clock_type::now();
+        for(size_t f=0; f < frames; ++f)
+        {
+            auto id = E.submit();
+            E.wait(id-1);
+            auto now = clock_type::now();
+            r.frame_us.push_back( std::chrono::duration<double, std::micro>(now-last).count() );
+            last = now;
+        }
+        E.wait();
+        report(T, n, "pipelined(2)", t, r);
+    }
+}
+
+static std::vector<size_t> parse_list(std::string const & s)
+{
+    std::vector<size_t> out;
+    std::stringstream ss(s);
+    std::string item;
+    while( std::getline(ss, item, ',') )
+        out.push_back( std::stoul(item) );
+    return out;
+}
+
+int main(int argc, char ** argv)
+{
+    size_t frames    = 0; // 0 picks a frame count based on the graph size
+    double work_us   = 0.0;
+    size_t max_nodes = 100000;
+
+    std::vector<size_t> thread_counts;
+    for(size_t t=1; t <= std::max(1u, std::thread::hardware_concurrency()); t *= 2)
+        thread_counts.push_back(t);
+
+    for(int i=1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        bool has_value = i+1 < argc;
+        if( a == "--frames" && has_value )         frames        = std::stoul(argv[++i]);
+        else if( a == "--work-us" && has_value )   work_us       = std::stod(argv[++i]);
+        else if( a == "--threads" && has_value )   thread_counts = parse_list(argv[++i]);
+        else if( a == "--max-nodes" && has_value ) max_nodes     = std::stoul(argv[++i]);
+        else
+        {
+            std::cout << "usage: " << argv[0] << " [--frames N] [--work-us N] [--threads 1,2,4] [--max-nodes N]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<topology> topologies =
+    {
+        { "fan_out",  10000,  build_fan_out  },
+        { "chain",    10000,  build_chain    },
+        { "diamonds", 10000,  build_diamonds },
+        { "random",   1000,   build_random   },
+        { "random",   10000,  build_random   },
+        { "random",   100000, build_random   },
+        { "oneshot",  10000,  build_oneshot  },
+    };
+
+    std::cout << std::left  << std::setw(10) << "topology"
+              << std::right << std::setw(8)  << "nodes"
+              << std::left  << "  " << std::setw(15) << "executor"
+              << std::right << std::setw(4)  << "thr"
+              << std::setw(7)  << "frames"
+              << std::setw(11) << "mean_us"
+              << std::setw(11) << "p50_us"
+              << std::setw(11) << "p90_us"
+              << std::setw(11) << "p99_us"
+              << std::setw(11) << "reset_us"
+              << std::setw(14) << "nodes/s"
+              << std::setw(10) << "ns/node"
+              << std::endl;
+
+    for(auto & T : topologies)
+    {
+        if( T.nodes <= max_nodes )
+            bench_topology(T, thread_counts, frames, work_us);
+    }
+    return 0;
+}
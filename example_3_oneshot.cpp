@@ -79,7 +79,23 @@ struct ThreadPoolWrapper
     }
     void operator()( std::function<void(void)> & exec)
     {
-        m_threadpool->push(exec);
+        // post() stores the pointer inline, so scheduling does not allocate
+        m_threadpool->post( [&exec]() { exec(); } );
+    }
+    // optional, lets the executor submit all the root nodes at once
+    void operator()( std::function<void(void)> ** exec, size_t count)
+    {
+        m_threadpool->post_batch( count, [exec](size_t i) { auto e = exec[i]; return [e]() { (*e)(); }; } );
+    }
+    // optional, lets parallel_for() run its chunks on the pool
+    void operator()( std::function<void(void)> && task)
+    {
+        m_threadpool->post( std::move(task) );
+    }
+    // optional, lets wait() run queued nodes on the calling thread
+    bool try_run_one()
+    {
+        return m_threadpool->try_run_one();
     }
     gnl::thread_pool *m_threadpool;
 };
@@ -94,6 +110,8 @@ int main()
 
 
 
+  G.compile(); // freeze the topology so that scheduling uses the flat plan
+
   gnl::thread_pool T(4);   // create the threadpool with 4 workers
   ThreadPoolWrapper TW(T); // create the wrapper.
 
@@ -11,6 +11,14 @@
 #include <functional>
 #include <stdexcept>
 #include <iostream>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #ifndef GNL_NAMESPACE
     #define GNL_NAMESPACE gnl
@@ -18,6 +26,192 @@
 namespace GNL_NAMESPACE
 {
 
+/**
+ * @brief The small_task class
+ *
+ * A move-only, type-erased void() callable. Callables of up to inline_size
+ * bytes are stored inside the task itself, so constructing one does not
+ * allocate. Larger callables are boxed on the heap.
+ */
+class small_task
+{
+public:
+    static constexpr std::size_t inline_size = 48;
+
+    small_task() = default;
+
+    template<class F,
+             typename = typename std::enable_if< !std::is_same<typename std::decay<F>::type, small_task>::value >::type>
+    small_task(F && f)
+    {
+        using Fn_t = typename std::decay<F>::type;
+        constexpr bool fits_inline = sizeof(Fn_t) <= inline_size &&
+                                     alignof(Fn_t) <= alignof(std::max_align_t) &&
+                                     std::is_nothrow_move_constructible<Fn_t>::value;
+
+        emplace< typename std::conditional<fits_inline, Fn_t, heap_box<Fn_t> >::type >( std::forward<F>(f) );
+    }
+
+    small_task(small_task && other) noexcept
+    {
+        move_from(other);
+    }
+
+    small_task & operator=(small_task && other) noexcept
+    {
+        if( this != &other )
+        {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+
+    small_task( small_task const & other) = delete;
+    small_task & operator=( small_task const & other) = delete;
+
+    ~small_task()
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        m_vtable->invoke( &m_storage );
+    }
+
+    explicit operator bool() const
+    {
+        return m_vtable != nullptr;
+    }
+
+    /**
+     * @brief reset
+     *
+     * Destroys the stored callable.
+     */
+    void reset()
+    {
+        if( m_vtable )
+        {
+            m_vtable->destroy( &m_storage );
+            m_vtable = nullptr;
+        }
+    }
+
+protected:
+    struct vtable
+    {
+        void (*invoke)(void*);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void*);
+    };
+
+    template<typename Fn_t>
+    struct heap_box
+    {
+        template<typename G>
+        heap_box(G && g) : m_fn( new Fn_t(std::forward<G>(g)) ) {}
+        void operator()() { (*m_fn)(); }
+        std::unique_ptr<Fn_t> m_fn;
+    };
+
+    template<typename T>
+    static vtable const * vtable_for()
+    {
+        static const vtable v =
+        {
+            [](void* p) { (*static_cast<T*>(p))(); },
+            [](void* dst, void* src) { new (dst) T( std::move(*static_cast<T*>(src)) ); static_cast<T*>(src)->~T(); },
+            [](void* p) { static_cast<T*>(p)->~T(); }
+        };
+        return &v;
+    }
+
+    template<typename T, typename G>
+    void emplace(G && g)
+    {
+        static_assert( sizeof(T) <= inline_size, "callable does not fit in small_task");
+        new (&m_storage) T( std::forward<G>(g) );
+        m_vtable = vtable_for<T>();
+    }
+
+    void move_from(small_task & other)
+    {
+        if( other.m_vtable )
+        {
+            other.m_vtable->move( &m_storage, &other.m_storage );
+            m_vtable = other.m_vtable;
+            other.m_vtable = nullptr;
+        }
+    }
+
+    typename std::aligned_storage<inline_size, alignof(std::max_align_t)>::type m_storage;
+    vtable const * m_vtable = nullptr;
+};
+
+/**
+ * @brief The task_ring class
+ *
+ * A FIFO ring buffer of small_tasks. The slots are allocated up front and
+ * reused, the buffer only allocates when it has to grow.
+ */
+class task_ring
+{
+public:
+    explicit task_ring(std::size_t capacity = 256) : m_buffer( capacity ? capacity : 1 )
+    {
+    }
+
+    void push(small_task && t)
+    {
+        if( m_size == m_buffer.size() )
+            reserve( m_buffer.size() * 2 );
+        m_buffer[ (m_head + m_size) % m_buffer.size() ] = std::move(t);
+        ++m_size;
+    }
+
+    small_task pop()
+    {
+        small_task t( std::move(m_buffer[m_head]) );
+        m_head = (m_head + 1) % m_buffer.size();
+        --m_size;
+        return t;
+    }
+
+    /**
+     * @brief reserve
+     * @param capacity
+     *
+     * Makes sure the ring can hold at least capacity tasks without allocating.
+     */
+    void reserve(std::size_t capacity)
+    {
+        if( capacity <= m_buffer.size() )
+            return;
+        std::vector<small_task> b(capacity);
+        for(std::size_t i=0; i < m_size; ++i)
+            b[i] = std::move( m_buffer[ (m_head+i) % m_buffer.size() ] );
+        m_buffer.swap(b);
+        m_head = 0;
+    }
+
+    void clear()
+    {
+        while( m_size )
+            pop();
+    }
+
+    std::size_t size()     const { return m_size; }
+    bool        empty()    const { return m_size == 0; }
+    std::size_t capacity() const { return m_buffer.size(); }
+
+protected:
+    std::vector<small_task> m_buffer;
+    std::size_t             m_head = 0;
+    std::size_t             m_size = 0;
+};
+
 class thread_pool
 {
 
@@ -29,6 +223,36 @@ class thread_pool
         template<class F, class... Args>
         std::future<typename std::result_of<F(Args...)>::type> push( F && f, Args &&... args);
 
+        /**
+         * @brief post
+         * @param f
+         *
+         * Fire-and-forget version of push(). The callable is stored inline in a
+         * small_task inside the preallocated task ring, so posting a small
+         * callable does not allocate. No future is returned.
+         */
+        template<class F>
+        void post( F && f);
+
+        /**
+         * @brief post_batch
+         * @param count
+         * @param task_for_index
+         *
+         * Posts count tasks under a single lock, task i is task_for_index(i).
+         * Enough workers are woken for the whole batch with one notification.
+         */
+        template<class F>
+        void post_batch( std::size_t count, F && task_for_index);
+
+        /**
+         * @brief reserve_tasks
+         * @param capacity
+         *
+         * Preallocates room for capacity queued tasks.
+         */
+        void reserve_tasks(std::size_t capacity);
+
         /**
          * @brief create_workers
          * @param num
@@ -63,6 +287,25 @@ class thread_pool
          */
         std::size_t num_workers() { return m_worker_count; }
 
+        /**
+         * @brief pin_workers
+         * @param cpus
+         * @return
+         *
+         * Pins worker i to cpus[i % cpus.size()]. Only supported on Linux,
+         * returns false elsewhere or if any worker could not be pinned.
+         */
+        bool pin_workers(std::vector<int> const & cpus);
+
+        /**
+         * @brief try_run_one
+         * @return
+         *
+         * Runs the oldest queued task on the calling thread. Returns false
+         * if there was no task.
+         */
+        bool try_run_one();
+
 
 
 
@@ -80,7 +323,7 @@ class thread_pool
         std::vector< std::thread > workers;
 
         // the task queue
-        std::queue< std::function<void()> > m_tasks;
+        task_ring               m_tasks;
 
         // synchronization
         std::mutex              m_mutex;
@@ -94,7 +337,11 @@ class thread_pool
 
 inline void thread_pool::remove_worker()
 {
-    --m_thread_count;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        --m_thread_count;
+    }
+    m_cv.notify_all();
 }
 
 inline void thread_pool::create_workers(std::size_t num)
@@ -109,15 +356,18 @@ inline void thread_pool::create_workers(std::size_t num)
 
 inline void thread_pool::add_thread()
 {
-    ++m_thread_count;
-    ++m_worker_count;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        ++m_thread_count;
+        ++m_worker_count;
+    }
 
     workers.emplace_back(
         [this]
         {
             for(;;)
             {
-                std::function<void()> task;
+                small_task task;
 
                 {
                     std::unique_lock<std::mutex> lock(this->m_mutex);
@@ -137,8 +387,7 @@ inline void thread_pool::add_thread()
                         return;
                     }
 
-                    task = std::move(this->m_tasks.front());
-                    this->m_tasks.pop();
+                    task = this->m_tasks.pop();
                     //std::cout << std::this_thread::get_id() << " Starting Task! " << m_tasks.size() << " tasks left" << std::endl;
                     //  ========== End Safe Zone =========================
                 }
@@ -164,10 +413,60 @@ inline thread_pool::thread_pool()  : m_worker_count(0), m_thread_count(0)
 
 }
 
+inline bool thread_pool::pin_workers(std::vector<int> const & cpus)
+{
+    if( cpus.empty() )
+        return false;
+#if defined(__linux__)
+    bool ok = true;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(std::size_t i=0; i < workers.size(); ++i)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[i % cpus.size()], &set);
+        ok = pthread_setaffinity_np(workers[i].native_handle(), sizeof(set), &set) == 0 && ok;
+    }
+    return ok;
+#else
+    return false;
+#endif
+}
+
+inline bool thread_pool::try_run_one()
+{
+    small_task task;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if( m_tasks.empty() )
+            return false;
+        task = m_tasks.pop();
+    }
+    task();
+    return true;
+}
+
 inline void thread_pool::clear_tasks()
 {
     std::unique_lock<std::mutex> lock(m_mutex);
-    while(m_tasks.size()) m_tasks.pop();
+    m_tasks.clear();
+}
+
+inline void thread_pool::reserve_tasks(std::size_t capacity)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_tasks.reserve(capacity);
+}
+
+template<class F>
+void thread_pool::post(F && f)
+{
+    small_task task( std::forward<F>(f) );
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_tasks.push( std::move(task) );
+    }
+    m_cv.notify_one();
 }
 
 // add new work item to the pool
@@ -191,12 +490,29 @@ std::future< RETURN_TYPE > thread_pool::push(F&& f, Args&&... args)
         //if(stop)
         //    throw std::runtime_error("enqueue on stopped ThreadPool");
 
-        m_tasks.emplace([task](){ (*task)(); });
+        m_tasks.push( small_task([task](){ (*task)(); }) );
     }
     m_cv.notify_one();
     return res;
 }
 
+template<class F>
+void thread_pool::post_batch(std::size_t count, F && task_for_index)
+{
+    if( count == 0 )
+        return;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_tasks.reserve( m_tasks.size() + count );
+        for(std::size_t i=0; i < count; ++i)
+            m_tasks.push( small_task( task_for_index(i) ) );
+    }
+    if( count == 1 )
+        m_cv.notify_one();
+    else
+        m_cv.notify_all();
+}
+
 // the destructor joins all threads
 inline thread_pool::~thread_pool()
 {
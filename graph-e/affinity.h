@@ -0,0 +1,144 @@
+#pragma once
+
+#ifndef AFFINITY_GRAPH_3_H
+#define AFFINITY_GRAPH_3_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace graphe
+{
+
+/**
+ * @brief The cpu_topology struct
+ *
+ * The cpus of each NUMA node. On Linux it is read from
+ * /sys/devices/system/node, elsewhere, or if that fails, every cpu is
+ * placed in a single node.
+ */
+struct cpu_topology
+{
+    std::vector< std::vector<int> > nodes; // cpus of each NUMA node
+
+    static cpu_topology detect()
+    {
+        cpu_topology T;
+#if defined(__linux__)
+        for(int n=0; ; ++n)
+        {
+            std::ifstream in( "/sys/devices/system/node/node" + std::to_string(n) + "/cpulist" );
+            if( !in )
+                break;
+            std::string list;
+            std::getline(in, list);
+            auto cpus = parse_cpu_list(list);
+            if( !cpus.empty() )
+                T.nodes.push_back( std::move(cpus) );
+        }
+#endif
+        if( T.nodes.empty() )
+        {
+            auto n = std::max(1u, std::thread::hardware_concurrency());
+            T.nodes.emplace_back();
+            for(unsigned i=0; i < n; ++i)
+                T.nodes.back().push_back( static_cast<int>(i) );
+        }
+        return T;
+    }
+
+    /**
+     * @brief cpus
+     * @return
+     *
+     * All the cpus, node by node, so consecutive workers pinned to this
+     * list share a node.
+     */
+    std::vector<int> cpus() const
+    {
+        std::vector<int> out;
+        for(auto & n : nodes)
+            out.insert(out.end(), n.begin(), n.end());
+        return out;
+    }
+
+    /**
+     * @brief node_of
+     * @param cpu
+     * @return
+     *
+     * Returns the NUMA node of the cpu, or 0 if it is not known.
+     */
+    size_t node_of(int cpu) const
+    {
+        for(size_t i=0; i < nodes.size(); ++i)
+        {
+            if( std::find(nodes[i].begin(), nodes[i].end(), cpu) != nodes[i].end() )
+                return i;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief parse_cpu_list
+     * @param list - eg: "0-3,8,10-11"
+     * @return
+     */
+    static std::vector<int> parse_cpu_list(std::string const & list)
+    {
+        std::vector<int> out;
+        std::stringstream ss(list);
+        std::string range;
+        while( std::getline(ss, range, ',') )
+        {
+            if( range.empty() )
+                continue;
+            auto dash = range.find('-');
+            try
+            {
+                int first = std::stoi( range.substr(0, dash) );
+                int last  = dash == std::string::npos ? first : std::stoi( range.substr(dash+1) );
+                for(int c=first; c <= last; ++c)
+                    out.push_back(c);
+            }
+            catch(...)
+            {
+                return {};
+            }
+        }
+        return out;
+    }
+};
+
+/**
+ * @brief pin_current_thread
+ * @param cpu
+ * @return
+ *
+ * Restricts the calling thread to the given cpu. Returns false if pinning
+ * is not supported on this platform or failed.
+ */
+inline bool pin_current_thread(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+}
+
+#endif
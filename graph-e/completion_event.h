@@ -0,0 +1,99 @@
+#pragma once
+
+#ifndef COMPLETION_EVENT_GRAPH_3_H
+#define COMPLETION_EVENT_GRAPH_3_H
+
+#include <atomic>
+#include <cstdint>
+#include <climits>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+namespace graphe
+{
+
+/**
+ * @brief The completion_event class
+ *
+ * An epoch counter which threads can block on. notify_all() bumps the
+ * epoch and wakes the waiters, wait(seen) blocks while the epoch is still
+ * seen. A waiter reads epoch() before it checks its condition, so a
+ * notification which happens in between is never missed.
+ *
+ * On Linux the waiters block on a futex and notify_all() only makes a
+ * system call if someone is waiting. Elsewhere it falls back to a mutex
+ * and a condition variable.
+ */
+class completion_event
+{
+#if defined(__linux__)
+    static_assert( sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free,
+                   "the futex is placed on the atomic itself" );
+#endif
+public:
+    uint32_t epoch() const
+    {
+        return m_epoch.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief wait
+     * @param seen - a value previously returned by epoch()
+     *
+     * Blocks until the epoch is different from seen.
+     */
+    void wait(uint32_t seen)
+    {
+#if defined(__linux__)
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        while( m_epoch.load(std::memory_order_seq_cst) == seen )
+        {
+            ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0);
+        }
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+#else
+        std::unique_lock<std::mutex> lk(m_lock);
+        m_cv.wait(lk, [&] { return m_epoch.load(std::memory_order_acquire) != seen; });
+#endif
+    }
+
+    /**
+     * @brief notify_all
+     *
+     * Starts a new epoch and wakes every waiting thread.
+     */
+    void notify_all()
+    {
+#if defined(__linux__)
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        if( m_waiters.load(std::memory_order_seq_cst) != 0 )
+            ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            m_epoch.fetch_add(1, std::memory_order_release);
+        }
+        m_cv.notify_all();
+#endif
+    }
+
+protected:
+    std::atomic<uint32_t>   m_epoch{0};
+#if defined(__linux__)
+    std::atomic<uint32_t>   m_waiters{0};
+#else
+    std::mutex              m_lock;
+    std::condition_variable m_cv;
+#endif
+};
+
+}
+
+#endif
@@ -0,0 +1,443 @@
+#pragma once
+
+#ifndef DISTRIBUTED_EXECUTOR_GRAPH_3_H
+#define DISTRIBUTED_EXECUTOR_GRAPH_3_H
+
+#include "node_graph.h"
+#include "work_stealing_executor.h"
+#include "graph_partitioner.h"
+#include "value_serializer.h"
+#include "transport.h"
+#include <deque>
+
+namespace graphe
+{
+
+/**
+ * @brief The distributed_executor class
+ *
+ * Executes one partition of a graph which is split across processes. Every
+ * process builds the same graph, computes or receives the same partition
+ * (see graph_partitioner) and creates a distributed_executor with its own
+ * transport. The executor removes the nodes of the other partitions from
+ * the local graph and runs the rest with a work_stealing_executor.
+ *
+ * A resource produced in this partition and consumed in others is sent by
+ * an export node, which runs once the resource is available. A resource
+ * produced in another partition is made available by an import node, an
+ * async node which completes when the value arrives. Its consumers are then
+ * notified as if a local node had made it available. The import and export
+ * nodes run with the producer's flags, so one-shot producers are only sent
+ * once.
+ *
+ * Every process must execute the same number of frames. Each value is
+ * sent with the index of the frame which produced it, counted from the
+ * creation of the executor, and values which arrive early are queued until
+ * the frame which needs them. Resources which no node produces are not
+ * sent, each process must make them available itself. Stream nodes can not
+ * be distributed.
+ *
+ * Errors in received values, eg: a value which can not be decoded or which
+ * belongs to another frame, do not stop the frame. The import makes T()
+ * available instead, and wait() throws the first error once the frame has
+ * finished.
+ */
+class distributed_executor
+{
+public:
+    /**
+     * @brief distributed_executor
+     * @param graph
+     * @param T - the transport of this process, T.rank() is the partition which is executed
+     * @param partition - the partition of every node, indexed by exec_node::get_id()
+     * @param num_workers - threads of the local work_stealing_executor
+     * @param values - converts the values which cross partitions
+     *
+     * Must be called between frames.
+     */
+    distributed_executor(node_graph & graph,
+                         transport & T,
+                         std::vector<uint32_t> const & partition,
+                         size_t num_workers = std::thread::hardware_concurrency(),
+                         value_serializer_registry const & values = value_serializer_registry::global()) :
+        m_graph(graph), m_transport(T)
+    {
+        if( !graph.get_streams().empty() )
+            throw std::runtime_error("distributed_executor: graphs with streams can not be distributed");
+        if( partition.size() < graph.get_num_node_ids() )
+            throw std::runtime_error("distributed_executor: the partition does not cover every node");
+
+        auto me = T.rank();
+        auto part_of = [&partition](exec_node const * N) { return partition[ N->get_id() ]; };
+
+        std::vector<exec_node*> remote;
+        std::vector< std::pair<resource_node*, node_flags> > imports;
+        std::vector< std::pair<resource_node*, node_flags> > exports;
+        std::vector< std::vector<uint32_t> > peers; // peers of each export
+        for(auto N : graph.get_exec_nodes())
+        {
+            auto p = part_of(N);
+            if( p != me )
+                remote.push_back(N);
+
+            for(auto R : N->get_produced_resources())
+            {
+                if( R->get_producer() != N )
+                    continue;
+
+                std::vector<uint32_t> to;
+                bool local = false;
+                for(auto C : R->get_consumers())
+                {
+                    auto q = part_of(C);
+                    if( q == p )
+                        continue;
+                    local = local || q == me;
+                    if( std::find(to.begin(), to.end(), q) == to.end() )
+                        to.push_back(q);
+                }
+                if( p == me && !to.empty() )
+                {
+                    exports.push_back( { R, N->get_flags() } );
+                    peers.push_back( std::move(to) );
+                }
+                else if( p != me && local )
+                {
+                    imports.push_back( { R, N->get_flags() } );
+                }
+            }
+        }
+
+        auto codec = [&values](resource_node * R)
+        {
+            auto e = values.find( R->get_type() );
+            if( !e )
+                throw std::runtime_error( std::string("distributed_executor: no serializer for the value of resource ") + R->get_name() );
+            return e;
+        };
+        for(auto & i : imports)
+            codec(i.first);
+        for(auto & e : exports)
+            codec(e.first);
+
+        for(auto N : remote)
+            graph.remove_node(*N);
+
+        for(auto & i : imports)
+            m_imports.resize( std::max<size_t>(m_imports.size(), i.first->get_id() + 1) );
+        for(auto & i : imports)
+        {
+            auto S = std::make_unique<import_slot>();
+            S->resource = i.first;
+            S->codec    = codec(i.first);
+            auto & N = i.second == node_flags::execute_once ?
+                       graph.add_node_flags<node_flags::execute_once, import_node>(this, S.get()) :
+                       graph.add_node_flags<node_flags::execute_multiple, import_node>(this, S.get());
+            N.set_name("import " + i.first->get_name());
+            m_added.push_back( N.get_id() );
+            m_imports[ i.first->get_id() ] = std::move(S);
+        }
+        for(size_t k=0; k < exports.size(); ++k)
+        {
+            auto R = exports[k].first;
+            auto & N = exports[k].second == node_flags::execute_once ?
+                       graph.add_node_flags<node_flags::execute_once, export_node>(this, R, codec(R), std::move(peers[k])) :
+                       graph.add_node_flags<node_flags::execute_multiple, export_node>(this, R, codec(R), std::move(peers[k]));
+            N.set_name("export " + R->get_name());
+            m_added.push_back( N.get_id() );
+        }
+
+        m_local = std::make_unique<work_stealing_executor>(graph, num_workers);
+        T.set_receiver( [this](resource_message && m) { receive( std::move(m) ); } );
+    }
+
+    ~distributed_executor()
+    {
+        m_local->wait();
+        m_transport.set_receiver( transport::receiver() );
+        m_local.reset();
+        // the nodes of other partitions are gone, only the nodes which refer to this executor are removed.
+        // one-shot imports and exports may already have been removed by reset()
+        std::vector<exec_node*> added;
+        for(auto N : m_graph.get_exec_nodes())
+            if( std::binary_search(m_added.begin(), m_added.end(), N->get_id()) )
+                added.push_back(N);
+        for(auto N : added)
+            m_graph.remove_node(*N);
+    }
+
+    distributed_executor( distributed_executor const & other) = delete;
+    distributed_executor & operator = ( distributed_executor const & other) = delete;
+
+    /**
+     * @brief execute
+     *
+     * Starts a frame of the local partition. The call returns immediately,
+     * use wait() to wait for it to finish.
+     */
+    void execute()
+    {
+        m_frame = m_next_frame++;
+        m_local->execute();
+    }
+
+    /**
+     * @brief wait
+     *
+     * Waits until the local partition has finished the frame, including
+     * receiving its inputs from the other partitions. Throws the first error
+     * reported since the last wait(), see set_error().
+     */
+    void wait()
+    {
+        // the local executor throws the errors of the graph itself, eg: a missing output
+        std::exception_ptr local;
+        try
+        {
+            m_local->wait();
+        }
+        catch(...)
+        {
+            local = std::current_exception();
+        }
+
+        std::exception_ptr e;
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            std::swap(e, m_error);
+        }
+        if( !e )
+            e = local;
+        if( e )
+            std::rethrow_exception(e);
+    }
+
+    work_stealing_executor & get_local_executor()
+    {
+        return *m_local;
+    }
+
+    /**
+     * @brief get_bytes_sent
+     * @return
+     *
+     * Returns the number of value bytes sent to other partitions so far.
+     */
+    uint64_t get_bytes_sent() const
+    {
+        return m_bytes_sent.load(std::memory_order_relaxed);
+    }
+
+    uint64_t get_bytes_received() const
+    {
+        return m_bytes_received.load(std::memory_order_relaxed);
+    }
+
+protected:
+    using codec_t = value_serializer_registry::entry;
+
+    /**
+     * @brief The import_slot struct
+     *
+     * The values received for one resource and, while the import node waits
+     * for the next one, its handle.
+     */
+    struct import_slot
+    {
+        resource_node                       * resource = nullptr;
+        codec_t const                       * codec    = nullptr;
+        std::deque<resource_message>          queue;   // values for the next frames, in the order they were sent
+        async_handle                          waiting; // valid while the import node waits
+        uint64_t                              waiting_frame = 0;
+    };
+
+    class import_node
+    {
+    public:
+        import_node(ResourceRegistry & reg, distributed_executor * X, import_slot * S) : m_exec(X), m_slot(S)
+        {
+            S->codec->add_output(reg, *S->resource);
+        }
+
+        void operator()(async_handle h)
+        {
+            m_exec->wait_for_value(*m_slot, std::move(h));
+        }
+
+    protected:
+        distributed_executor * m_exec;
+        import_slot          * m_slot;
+    };
+
+    class export_node
+    {
+    public:
+        export_node(ResourceRegistry & reg, distributed_executor * X, resource_node * R, codec_t const * codec, std::vector<uint32_t> peers) :
+            m_exec(X), m_resource(R), m_codec(codec), m_peers( std::move(peers) )
+        {
+            codec->add_input(reg, *R);
+        }
+
+        void operator()()
+        {
+            resource_message m;
+            m.resource = m_resource->get_id();
+            m.frame    = m_exec->m_frame;
+            m_codec->save(*m_resource, m.data);
+            for(auto p : m_peers)
+                m_exec->m_transport.send(p, m);
+            m_exec->m_bytes_sent.fetch_add( m.data.size() * m_peers.size(), std::memory_order_relaxed);
+        }
+
+    protected:
+        distributed_executor  * m_exec;
+        resource_node         * m_resource;
+        codec_t const         * m_codec;
+        std::vector<uint32_t>   m_peers;
+    };
+
+    /**
+     * @brief wait_for_value
+     * @param S
+     * @param h
+     *
+     * Called by an import node. Completes straight away if the value has
+     * already arrived, otherwise receive() completes it.
+     */
+    void wait_for_value(import_slot & S, async_handle h)
+    {
+        auto frame = m_frame;
+        resource_message m;
+        bool found = false;
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            while( !S.queue.empty() && S.queue.front().frame < frame )
+            {
+                set_error_locked( wrong_frame(S, S.queue.front().frame, frame) );
+                S.queue.pop_front();
+            }
+            if( S.queue.empty() )
+            {
+                S.waiting       = std::move(h);
+                S.waiting_frame = frame;
+                return;
+            }
+            // values from the same peer arrive in order, so the value of this frame was lost
+            if( S.queue.front().frame != frame )
+                set_error_locked( wrong_frame(S, S.queue.front().frame, frame) );
+            else
+            {
+                m = std::move( S.queue.front() );
+                S.queue.pop_front();
+                found = true;
+            }
+        }
+        publish(S, found ? &m.data : nullptr);
+        h.complete();
+    }
+
+    /**
+     * @brief receive
+     * @param m
+     *
+     * Called by the transport for every value sent to this partition. It
+     * never throws, errors are passed to set_error().
+     */
+    void receive(resource_message && m)
+    {
+        try
+        {
+            if( m.resource >= m_imports.size() || !m_imports[m.resource] )
+                throw std::runtime_error( "distributed_executor: received resource " + std::to_string(m.resource) + ", which this partition does not import" );
+
+            auto & S = *m_imports[m.resource];
+            m_bytes_received.fetch_add( m.data.size(), std::memory_order_relaxed);
+            async_handle h;
+            {
+                std::lock_guard<std::mutex> lk(m_lock);
+                if( !S.waiting.valid() || m.frame > S.waiting_frame )
+                {
+                    S.queue.push_back( std::move(m) );
+                    return;
+                }
+                if( m.frame < S.waiting_frame )
+                    throw std::runtime_error( wrong_frame(S, m.frame, S.waiting_frame) );
+                h = std::move(S.waiting); // leaves S.waiting invalid
+            }
+            publish(S, &m.data);
+            h.complete();
+        }
+        catch(...)
+        {
+            set_error( std::current_exception() );
+        }
+    }
+
+    /**
+     * @brief publish
+     * @param S
+     * @param data - the received value, or nullptr if it was lost
+     *
+     * Makes the resource of an import available. A value which can not be
+     * decoded is replaced by T() and reported to set_error().
+     */
+    void publish(import_slot & S, std::vector<uint8_t> const * data)
+    {
+        auto R = S.resource;
+        try
+        {
+            if( !data )
+                throw std::runtime_error( "distributed_executor: the value of " + R->get_name() + " for frame " + std::to_string(m_frame) + " was not received" );
+            S.codec->load(*R, data->data(), data->size());
+        }
+        catch(...)
+        {
+            set_error( std::current_exception() );
+            S.codec->clear(*R);
+        }
+        R->set_changed(true);
+        if( R->make_available() )
+            R->notify_dependents();
+    }
+
+    /**
+     * @brief set_error
+     * @param e
+     *
+     * Keeps the first error of the frame, wait() throws it.
+     */
+    void set_error(std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        if( !m_error )
+            m_error = std::move(e);
+    }
+
+    void set_error_locked(std::string const & what)
+    {
+        if( !m_error )
+            m_error = std::make_exception_ptr( std::runtime_error(what) );
+    }
+
+    static std::string wrong_frame(import_slot const & S, uint64_t received, uint64_t expected)
+    {
+        return "distributed_executor: received the value of " + S.resource->get_name() + " for frame " + std::to_string(received) +
+               " while executing frame " + std::to_string(expected);
+    }
+
+    node_graph                                  & m_graph;
+    transport                                   & m_transport;
+    std::mutex                                    m_lock;    // protects the import slots and m_error
+    std::vector< std::unique_ptr<import_slot> >   m_imports; // resource id -> slot, if the resource is imported
+    std::vector<uint32_t>                         m_added;   // ids of the import and export nodes, in increasing order
+    uint64_t                                      m_frame      = 0; // the frame being executed
+    uint64_t                                      m_next_frame = 0;
+    std::exception_ptr                            m_error;   // the first error since the last wait()
+    std::atomic<uint64_t>                         m_bytes_sent{0};
+    std::atomic<uint64_t>                         m_bytes_received{0};
+    std::unique_ptr<work_stealing_executor>       m_local;
+};
+
+}
+
+#endif
@@ -0,0 +1,168 @@
+#pragma once
+
+#ifndef DOMAIN_QUEUES_GRAPH_3_H
+#define DOMAIN_QUEUES_GRAPH_3_H
+
+#include "node_graph.h"
+#include "completion_event.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace graphe
+{
+
+/**
+ * @brief The domain_queues class
+ *
+ * Routes the nodes which have to run on a particular thread (see
+ * exec_node::set_domain()) for the executors which run everything else on
+ * a pool. Main nodes are queued for the thread which calls the executor's
+ * wait(), which runs them with run_main(). Each named domain gets a
+ * dedicated thread, started by start().
+ */
+class domain_queues
+{
+public:
+    explicit domain_queues(node_graph & graph) : m_graph(graph)
+    {
+    }
+
+    ~domain_queues()
+    {
+        stop();
+    }
+
+    domain_queues( domain_queues const & other) = delete;
+    domain_queues & operator = ( domain_queues const & other) = delete;
+
+    /**
+     * @brief start
+     *
+     * Starts a thread for every named domain which does not have one yet.
+     */
+    void start()
+    {
+        auto num = m_graph.get_num_domains() - exec_domain::first_named;
+        while( m_domains.size() < num )
+        {
+            m_domains.push_back( std::make_unique<domain_thread>() );
+            auto d = m_domains.back().get();
+            d->m_thread = std::thread( [d]()
+            {
+                std::vector< std::function<void(void)>* > run;
+                for(;;)
+                {
+                    {
+                        std::unique_lock<std::mutex> lk(d->m_lock);
+                        d->m_cv.wait(lk, [d] { return d->m_stop || !d->m_queue.empty(); });
+                        if( d->m_queue.empty() )
+                            return;
+                        run.swap(d->m_queue);
+                    }
+                    for(auto e : run)
+                        (*e)();
+                    run.clear();
+                }
+            });
+        }
+    }
+
+    /**
+     * @brief stop
+     *
+     * Lets the domain threads finish their queues and joins them.
+     */
+    void stop()
+    {
+        for(auto & d : m_domains)
+        {
+            {
+                std::lock_guard<std::mutex> lk(d->m_lock);
+                d->m_stop = true;
+            }
+            d->m_cv.notify_one();
+            d->m_thread.join();
+        }
+        m_domains.clear();
+    }
+
+    /**
+     * @brief post
+     * @param N - a node whose domain is not exec_domain::any
+     * @return
+     *
+     * Queues a node for the thread of its domain, main nodes wake up the
+     * thread in wait(). Returns false if the domain was named after the
+     * last start() and has no thread yet, the caller runs the node anywhere.
+     */
+    bool post(exec_node * N)
+    {
+        auto d = N->get_domain();
+        if( d == exec_domain::main )
+        {
+            {
+                std::lock_guard<std::mutex> lk(m_main_lock);
+                m_main.push_back(&N->execute);
+                m_main_size.store(m_main.size(), std::memory_order_relaxed);
+            }
+            m_graph.get_completion_event().notify_all();
+            return true;
+        }
+
+        auto i = d - exec_domain::first_named;
+        if( i >= m_domains.size() )
+            return false;
+        auto & D = *m_domains[i];
+        {
+            std::lock_guard<std::mutex> lk(D.m_lock);
+            D.m_queue.push_back(&N->execute);
+        }
+        D.m_cv.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief run_main
+     * @return
+     *
+     * Runs the queued main nodes on the calling thread. Returns false if
+     * there were none.
+     */
+    bool run_main()
+    {
+        if( m_main_size.load(std::memory_order_relaxed) == 0 )
+            return false;
+        {
+            std::lock_guard<std::mutex> lk(m_main_lock);
+            m_main_run.swap(m_main);
+            m_main_size.store(0, std::memory_order_relaxed);
+        }
+        for(auto e : m_main_run)
+            (*e)();
+        bool ran = !m_main_run.empty();
+        m_main_run.clear();
+        return ran;
+    }
+
+protected:
+    struct domain_thread
+    {
+        std::thread                               m_thread;
+        std::mutex                                m_lock;
+        std::condition_variable                   m_cv;
+        std::vector< std::function<void(void)>* > m_queue;
+        bool                                      m_stop = false;
+    };
+
+    node_graph                                  & m_graph;
+    std::mutex                                    m_main_lock;   // protects m_main
+    std::vector< std::function<void(void)>* >     m_main;        // main nodes waiting for wait()
+    std::vector< std::function<void(void)>* >     m_main_run;    // main nodes being run by wait()
+    std::atomic<size_t>                           m_main_size{0};
+    std::vector< std::unique_ptr<domain_thread> > m_domains;     // one per named domain
+};
+
+}
+
+#endif
@@ -0,0 +1,144 @@
+#pragma once
+
+#ifndef FRAME_ARENA_GRAPH_3_H
+#define FRAME_ARENA_GRAPH_3_H
+
+#include <memory_resource>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace graphe
+{
+
+/**
+ * @brief The frame_arena class
+ *
+ * A bump-pointer memory resource for data which only lives for one frame.
+ * Allocation is a compare-exchange on the offset of the current block and
+ * deallocation does nothing. rewind() releases everything at once.
+ *
+ * Blocks are kept across rewind(). If a frame needed more than one block,
+ * they are merged into a single block large enough for the whole frame,
+ * so a steady-state frame does not allocate.
+ */
+class frame_arena : public std::pmr::memory_resource
+{
+public:
+    explicit frame_arena(std::size_t initial_bytes = 1u << 20)
+    {
+        add_block( std::max<std::size_t>(initial_bytes, 64) );
+    }
+
+    frame_arena( frame_arena const & other) = delete;
+    frame_arena & operator = ( frame_arena const & other) = delete;
+
+    /**
+     * @brief rewind
+     *
+     * Makes all the memory in the arena available again. Must not be called
+     * while another thread is allocating from the arena.
+     */
+    void rewind()
+    {
+        if( m_blocks.size() > 1 )
+        {
+            std::size_t total = 0;
+            for(auto & b : m_blocks)
+                total += b->m_size;
+            m_blocks.clear();
+            add_block(total);
+        }
+        m_blocks.back()->m_offset.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief used
+     * @return
+     *
+     * Number of bytes handed out since the last rewind(). Only the current block is counted.
+     */
+    std::size_t used() const
+    {
+        return m_current.load(std::memory_order_acquire)->m_offset.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief capacity
+     * @return
+     *
+     * Total number of bytes owned by the arena.
+     */
+    std::size_t capacity() const
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        std::size_t total = 0;
+        for(auto & b : m_blocks)
+            total += b->m_size;
+        return total;
+    }
+
+protected:
+    struct block
+    {
+        explicit block(std::size_t size) : m_data( new std::byte[size] ), m_size(size)
+        {
+        }
+        std::unique_ptr<std::byte[]> m_data;
+        std::size_t                  m_size;
+        std::atomic<std::size_t>     m_offset{0};
+    };
+
+    void add_block(std::size_t size)
+    {
+        m_blocks.emplace_back( new block(size) );
+        m_current.store( m_blocks.back().get(), std::memory_order_release);
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        for(;;)
+        {
+            auto b    = m_current.load(std::memory_order_acquire);
+            auto base = reinterpret_cast<std::uintptr_t>( b->m_data.get() );
+            auto off  = b->m_offset.load(std::memory_order_relaxed);
+
+            for(;;)
+            {
+                auto start = ( (base + off + alignment - 1) & ~(std::uintptr_t(alignment) - 1) ) - base;
+                auto end   = start + bytes;
+                if( end > b->m_size )
+                    break;
+                if( b->m_offset.compare_exchange_weak(off, end, std::memory_order_relaxed) )
+                    return b->m_data.get() + start;
+            }
+
+            // the current block is full
+            std::lock_guard<std::mutex> lk(m_mutex);
+            if( m_current.load(std::memory_order_relaxed) == b )
+                add_block( std::max(b->m_size * 2, bytes + alignment) );
+        }
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override
+    {
+        // memory is only released by rewind()
+    }
+
+    bool do_is_equal(std::pmr::memory_resource const & other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    mutable std::mutex                   m_mutex;   // protects m_blocks when a new block is added
+    std::vector< std::unique_ptr<block> > m_blocks;
+    std::atomic<block*>                  m_current{nullptr};
+};
+
+}
+
+#endif
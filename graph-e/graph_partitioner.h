@@ -0,0 +1,247 @@
+#pragma once
+
+#ifndef GRAPH_PARTITIONER_GRAPH_3_H
+#define GRAPH_PARTITIONER_GRAPH_3_H
+
+#include "node_graph.h"
+
+namespace graphe
+{
+
+/**
+ * @brief The graph_partitioner class
+ *
+ * Splits the nodes of a graph into partitions which are executed by
+ * different processes, see distributed_executor. A resource whose producer
+ * and consumers are in different partitions has to be sent over the
+ * network once for every partition which consumes it. The partitioner
+ * balances the cost of the nodes of each partition and minimises the
+ * number of bytes sent.
+ *
+ * The result only depends on the topology, the cost hints and the weights,
+ * so every process can compute it from the same graph. Measured durations
+ * and the sizes of values may differ between processes; either don't use
+ * them or compute the partition in one process and send it to the others.
+ */
+class graph_partitioner
+{
+public:
+    using weight_fn = std::function<double(resource_node &)>;
+
+    /**
+     * @brief partition
+     * @param G
+     * @param parts - the number of partitions
+     * @param bytes - the number of bytes sent when a resource crosses partitions, 1 for every resource if empty
+     * @param imbalance - how much more than the average cost a partition may hold, 0.1 is 10%
+     * @return
+     *
+     * Returns the partition of every node, indexed by exec_node::get_id().
+     * The cost of a node is its cost hint, or 1 if it has none. Stream nodes
+     * are all placed in partition 0.
+     *
+     * The nodes are first cut into runs of equal cost along a depth first
+     * topological order, which keeps chains together, then single nodes
+     * are moved to the partition of a neighbour while that lowers the
+     * number of bytes crossing partitions.
+     */
+    static std::vector<uint32_t> partition(node_graph & G, uint32_t parts, weight_fn bytes = {}, double imbalance = 0.1)
+    {
+        auto & nodes = G.get_exec_nodes();
+        auto n = nodes.size();
+        std::vector<uint32_t> result( G.get_num_node_ids(), 0 );
+        if( parts <= 1 || n == 0 )
+            return result;
+
+        std::vector<uint32_t> pos( G.get_num_node_ids(), 0 );
+        for(size_t i=0; i < n; ++i)
+            pos[ nodes[i]->get_id() ] = static_cast<uint32_t>(i);
+
+        // every resource with a producer becomes a hyperedge over its producer and consumers
+        std::vector<uint32_t> edge_offsets(1, 0);
+        std::vector<uint32_t> pins;
+        std::vector<double>   weight;
+        std::vector< std::vector<uint32_t> > edges_of(n);
+        for(size_t i=0; i < n; ++i)
+        {
+            for(auto R : nodes[i]->get_produced_resources())
+            {
+                if( R->get_producer() != nodes[i] || R->get_consumers().empty() )
+                    continue;
+                auto e = static_cast<uint32_t>(weight.size());
+                auto first = pins.size();
+                pins.push_back( static_cast<uint32_t>(i) );
+                for(auto C : R->get_consumers())
+                {
+                    auto c = pos[ C->get_id() ];
+                    if( std::find(pins.begin() + first, pins.end(), c) == pins.end() )
+                        pins.push_back(c);
+                }
+                for(auto j = first; j < pins.size(); ++j)
+                    edges_of[ pins[j] ].push_back(e);
+                edge_offsets.push_back( static_cast<uint32_t>(pins.size()) );
+                weight.push_back( bytes ? bytes(*R) : 1.0 );
+            }
+        }
+
+        std::vector<double> cost(n);
+        double total = 0.0;
+        double largest = 0.0;
+        for(size_t i=0; i < n; ++i)
+        {
+            auto c = nodes[i]->get_cost_hint();
+            cost[i] = c > 0.0 ? c : 1.0;
+            total  += cost[i];
+            largest = std::max(largest, cost[i]);
+        }
+        double target   = total / parts;
+        double max_load = std::max( target * (1.0 + imbalance), largest );
+
+        // depth first topological order, nodes in a cycle are appended at the end
+        std::vector<uint32_t> indeg(n, 0);
+        for(size_t e=0; e < weight.size(); ++e)
+            for(auto j = edge_offsets[e] + 1; j < edge_offsets[e+1]; ++j)
+                ++indeg[ pins[j] ];
+
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> stack;
+        std::vector<uint8_t>  placed(n, 0);
+        order.reserve(n);
+        for(size_t i=n; i-- > 0; )
+            if( indeg[i] == 0 )
+                stack.push_back( static_cast<uint32_t>(i) );
+        while( order.size() < n )
+        {
+            if( stack.empty() )
+            {
+                for(size_t i=0; i < n; ++i)
+                    if( !placed[i] ) { stack.push_back( static_cast<uint32_t>(i) ); break; }
+            }
+            auto v = stack.back();
+            stack.pop_back();
+            if( placed[v] )
+                continue;
+            placed[v] = 1;
+            order.push_back(v);
+            for(auto e : edges_of[v])
+            {
+                if( pins[ edge_offsets[e] ] != v )
+                    continue; // v consumes e
+                for(auto j = edge_offsets[e+1]; j-- > edge_offsets[e] + 1; )
+                    if( --indeg[ pins[j] ] == 0 )
+                        stack.push_back( pins[j] );
+            }
+        }
+
+        std::vector<uint32_t> part(n, 0);
+        std::vector<double>   load(parts, 0.0);
+        double done = 0.0;
+        for(auto v : order)
+        {
+            auto p = std::min<uint32_t>( parts - 1, static_cast<uint32_t>( (done + cost[v] * 0.5) / target ) );
+            part[v]  = p;
+            load[p] += cost[v];
+            done    += cost[v];
+        }
+
+        // count[e * parts + p] - number of pins of hyperedge e in partition p
+        std::vector<uint32_t> count(weight.size() * parts, 0);
+        for(size_t e=0; e < weight.size(); ++e)
+            for(auto j = edge_offsets[e]; j < edge_offsets[e+1]; ++j)
+                ++count[ e * parts + part[ pins[j] ] ];
+
+        std::vector<double> gain(parts);
+        for(int pass=0; pass < 8; ++pass)
+        {
+            bool moved = false;
+            for(auto v : order)
+            {
+                auto from = part[v];
+
+                // moving v out of 'from' saves the edges it is alone in,
+                // moving it into 'to' costs the edges which have no pin there yet
+                double saved = 0.0;
+                for(auto e : edges_of[v])
+                    if( count[ e * parts + from ] == 1 )
+                        saved += weight[e];
+                if( saved == 0.0 )
+                    continue;
+
+                std::fill(gain.begin(), gain.end(), saved);
+                for(auto e : edges_of[v])
+                    for(uint32_t p=0; p < parts; ++p)
+                        if( count[ e * parts + p ] == 0 )
+                            gain[p] -= weight[e];
+
+                uint32_t best = from;
+                double   best_gain = 0.0;
+                for(uint32_t p=0; p < parts; ++p)
+                {
+                    if( p == from || load[p] + cost[v] > max_load )
+                        continue;
+                    if( gain[p] > best_gain )
+                    {
+                        best      = p;
+                        best_gain = gain[p];
+                    }
+                }
+                if( best == from )
+                    continue;
+
+                for(auto e : edges_of[v])
+                {
+                    --count[ e * parts + from ];
+                    ++count[ e * parts + best ];
+                }
+                load[from] -= cost[v];
+                load[best] += cost[v];
+                part[v]     = best;
+                moved       = true;
+            }
+            if( !moved )
+                break;
+        }
+
+        for(size_t i=0; i < n; ++i)
+            result[ nodes[i]->get_id() ] = nodes[i]->is_stream_node() ? 0 : part[i];
+        return result;
+    }
+
+    /**
+     * @brief cut_bytes
+     * @param G
+     * @param part - the partition of every node, indexed by exec_node::get_id()
+     * @param bytes - as for partition()
+     * @return
+     *
+     * Returns the number of bytes sent every frame: the size of each resource
+     * times the number of other partitions which consume it.
+     */
+    static double cut_bytes(node_graph & G, std::vector<uint32_t> const & part, weight_fn bytes = {})
+    {
+        double cut = 0.0;
+        std::vector<uint32_t> seen;
+        for(auto N : G.get_exec_nodes())
+        {
+            for(auto R : N->get_produced_resources())
+            {
+                if( R->get_producer() != N )
+                    continue;
+                seen.assign(1, part[ N->get_id() ]);
+                for(auto C : R->get_consumers())
+                {
+                    auto p = part[ C->get_id() ];
+                    if( std::find(seen.begin(), seen.end(), p) == seen.end() )
+                        seen.push_back(p);
+                }
+                if( seen.size() > 1 )
+                    cut += (bytes ? bytes(*R) : 1.0) * static_cast<double>(seen.size() - 1);
+            }
+        }
+        return cut;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,571 @@
+#pragma once
+
+#ifndef GRAPH_SERIALIZER_GRAPH_3_H
+#define GRAPH_SERIALIZER_GRAPH_3_H
+
+#include "node_graph.h"
+#include <typeindex>
+#include <fstream>
+#include <cstring>
+#include <tuple>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace graphe
+{
+
+/**
+ * @brief The node_type_registry class
+ *
+ * Maps node classes to stable keys, and keys back to factories which add
+ * a node of that class to a graph. graph_serializer stores the keys instead
+ * of typeid(...).name(), so a saved graph can be rebuilt by a different
+ * build of the program.
+ */
+class node_type_registry
+{
+public:
+    using factory = std::function<exec_node&(node_graph&, node_flags)>;
+
+    static node_type_registry & global()
+    {
+        static node_type_registry R;
+        return R;
+    }
+
+    /**
+     * @brief add
+     * @param key
+     * @param __args - copied, and passed to the node's constructor every time one is created
+     *
+     * Registers Node_t under key. Registering the same key twice replaces
+     * the first registration.
+     */
+    template<typename Node_t, typename... _Args>
+    void add(std::string const & key, _Args&&... __args)
+    {
+        factory f =
+        [args = std::tuple< std::decay_t<_Args>... >( std::forward<_Args>(__args)... )](node_graph & G, node_flags F) -> exec_node &
+        {
+            return std::apply( [&G, F](auto const &... a) -> exec_node &
+            {
+                if( F == node_flags::execute_once )
+                    return G.template add_node_flags<node_flags::execute_once, Node_t>(a...);
+                return G.template add_node_flags<node_flags::execute_multiple, Node_t>(a...);
+            }, args);
+        };
+
+        m_keys[ std::type_index(typeid(Node_t)) ] = key;
+        m_factories[key] = std::move(f);
+    }
+
+    /**
+     * @brief key_of
+     * @param type
+     * @return
+     *
+     * Returns the key of a node class, or nullptr if it is not registered.
+     */
+    std::string const * key_of(std::type_info const & type) const
+    {
+        auto it = m_keys.find( std::type_index(type) );
+        return it == m_keys.end() ? nullptr : &it->second;
+    }
+
+    /**
+     * @brief find
+     * @param key
+     * @return
+     *
+     * Returns the factory registered under key, or nullptr.
+     */
+    factory const * find(std::string const & key) const
+    {
+        auto it = m_factories.find(key);
+        return it == m_factories.end() ? nullptr : &it->second;
+    }
+
+protected:
+    std::unordered_map<std::type_index, std::string> m_keys;
+    std::unordered_map<std::string, factory>         m_factories;
+};
+
+/**
+ * Registers a node class with the global node_type_registry when the
+ * program starts: GRAPHE_REGISTER_NODE(Blur, "image.blur");
+ * The class may be qualified, eg: GRAPHE_REGISTER_NODE(video::Decode, "video.decode");
+ */
+#define GRAPHE_REGISTER_NODE(Node_t, key) \
+    static const bool GRAPHE_CONCAT(graphe_registered_node_, __COUNTER__) = ( ::graphe::node_type_registry::global().add<Node_t>(key), true )
+
+/**
+ * @brief The mapped_file class
+ *
+ * A read-only view of a file. The file is memory mapped where mmap is
+ * available, otherwise it is read into memory.
+ */
+class mapped_file
+{
+public:
+    explicit mapped_file(std::string const & path)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if( fd < 0 )
+            throw std::runtime_error( std::string("Could not open ") + path );
+        struct stat st;
+        if( ::fstat(fd, &st) != 0 )
+        {
+            ::close(fd);
+            throw std::runtime_error( std::string("Could not stat ") + path );
+        }
+        m_size = static_cast<size_t>(st.st_size);
+        if( m_size )
+        {
+            auto p = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if( p == MAP_FAILED )
+            {
+                ::close(fd);
+                throw std::runtime_error( std::string("Could not map ") + path );
+            }
+            m_data = static_cast<char const*>(p);
+        }
+        ::close(fd);
+#else
+        std::ifstream in(path, std::ios::binary);
+        if( !in )
+            throw std::runtime_error( std::string("Could not open ") + path );
+        m_copy.assign( std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() );
+        m_data = m_copy.data();
+        m_size = m_copy.size();
+#endif
+    }
+
+    ~mapped_file()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if( m_data )
+            ::munmap( const_cast<char*>(m_data), m_size );
+#endif
+    }
+
+    mapped_file( mapped_file const & other) = delete;
+    mapped_file & operator = ( mapped_file const & other) = delete;
+
+    char const * data() const
+    {
+        return m_data;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+protected:
+    char const      * m_data = nullptr;
+    size_t            m_size = 0;
+#if !(defined(__unix__) || defined(__APPLE__))
+    std::vector<char> m_copy;
+#endif
+};
+
+/**
+ * @brief The graph_serializer class
+ *
+ * Saves the topology of a graph, and rebuilds the graph from it without
+ * looking up any resource by name.
+ *
+ * The file stores, for every node, the key of its class (see
+ * node_type_registry), its flags, name, affinity, execution domain, cost
+ * hint and rank, and the ids of the resources its constructor registered,
+ * in order. For every resource it stores the name, flags and value type,
+ * and the names of the named execution domains are stored as well. The
+ * edges follow from the registrations.
+ *
+ * load() creates the nodes with the registered factories. Their
+ * constructors still call the registry, but each registration is bound to
+ * the next id in the file instead of being hashed and interned: only the
+ * name is compared, to catch a node whose registrations changed since the
+ * file was written. The saved ranks are then restored and the graph is
+ * compiled with them, so a loaded graph is scheduled the same way as the
+ * one saved.
+ * Streams are still registered by name.
+ *
+ * The file is tied to the layout of the node classes, not to the program: a
+ * node which registers different resources needs the file to be written
+ * again. It is stored in the byte order of the machine which wrote it.
+ */
+class graph_serializer
+{
+public:
+    static constexpr uint32_t version = 2;
+    static constexpr uint32_t no_resource = ~uint32_t(0); // resource_record::flags of an id without a resource
+
+    /**
+     * @brief save
+     * @param G
+     * @param out
+     * @param types
+     *
+     * Writes the topology of G. Every node class must be registered in types.
+     */
+    static void save(node_graph const & G, std::ostream & out, node_type_registry const & types = node_type_registry::global())
+    {
+        std::string strings;
+        auto add_string = [&strings](std::string const & s)
+        {
+            str_ref r{ static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(s.size()) };
+            strings.append(s);
+            return r;
+        };
+
+        std::vector<str_ref>                            type_records;
+        std::unordered_map<std::string const*, uint32_t> type_index;
+        std::vector<node_record>                        nodes;
+        std::vector<uint32_t>                           regs;
+
+        for(auto N : G.m_exec_nodes)
+        {
+            auto key = types.key_of( N->get_node_type() );
+            if( !key )
+                throw std::runtime_error( std::string("Node ") + N->get_name() + std::string(" has a type which is not in the node_type_registry") );
+            if( N->is_stream_node() )
+                throw std::runtime_error( std::string("Node ") + N->get_name() + std::string(" uses streams, which can not be saved") );
+
+            auto t = type_index.try_emplace( key, static_cast<uint32_t>(type_records.size()) );
+            if( t.second )
+                type_records.push_back( add_string(*key) );
+
+            node_record r{};
+            r.type      = t.first->second;
+            r.flags     = static_cast<uint32_t>( N->get_flags() );
+            r.name      = add_string( N->get_name() );
+            r.first_reg = static_cast<uint32_t>( regs.size() );
+            r.num_regs  = static_cast<uint32_t>( N->get_registrations().size() );
+            r.affinity  = N->get_affinity();
+            r.domain    = N->get_domain();
+            r.cost_hint = N->get_cost_hint();
+            r.rank      = N->get_rank();
+            regs.insert( regs.end(), N->get_registrations().begin(), N->get_registrations().end() );
+            nodes.push_back(r);
+        }
+
+        std::vector<resource_record> resources;
+        std::unordered_map<std::string, str_ref> type_names; // value types are shared by many resources
+        for(auto R : G.m_resources)
+        {
+            resource_record r{};
+            if( !R )
+            {
+                // the resource of this id was dropped, no node registers it
+                r.flags = no_resource;
+                resources.push_back(r);
+                continue;
+            }
+            r.name  = add_string( R->get_name() );
+            auto t  = type_names.try_emplace( R->get_type().name(), str_ref{} );
+            if( t.second )
+                t.first->second = add_string( t.first->first );
+            r.type  = t.first->second;
+            r.flags = static_cast<uint32_t>( R->get_flags() );
+            resources.push_back(r);
+        }
+
+        std::vector<str_ref> domains;
+        for(uint32_t d = exec_domain::first_named; d < G.get_num_domains(); ++d)
+            domains.push_back( add_string( G.get_domain_name(d) ) );
+
+        file_header h{};
+        std::memcpy(h.magic, magic(), sizeof(h.magic));
+        h.version       = version;
+        h.num_types     = static_cast<uint32_t>( type_records.size() );
+        h.num_resources = static_cast<uint32_t>( resources.size() );
+        h.num_nodes     = static_cast<uint32_t>( nodes.size() );
+        h.num_regs      = static_cast<uint32_t>( regs.size() );
+        h.num_domains   = static_cast<uint32_t>( domains.size() );
+        h.strings_size  = static_cast<uint32_t>( strings.size() );
+
+        write(out, &h, 1);
+        write(out, type_records.data(), type_records.size());
+        write(out, resources.data(), resources.size());
+        write(out, nodes.data(), nodes.size());
+        write(out, regs.data(), regs.size());
+        write(out, domains.data(), domains.size());
+        out.write( strings.data(), static_cast<std::streamsize>(strings.size()) );
+        if( !out )
+            throw std::runtime_error("Could not write the graph");
+    }
+
+    static void save(node_graph const & G, std::string const & path, node_type_registry const & types = node_type_registry::global())
+    {
+        std::ofstream out(path, std::ios::binary);
+        if( !out )
+            throw std::runtime_error( std::string("Could not open ") + path );
+        save(G, out, types);
+    }
+
+    /**
+     * @brief load
+     * @param G - must be empty
+     * @param data
+     * @param size
+     * @param types
+     *
+     * Rebuilds a graph written by save() and compiles it. data only needs to
+     * stay valid during the call, and must be 8-byte aligned. If load()
+     * throws, G can only be destroyed.
+     */
+    static void load(node_graph & G, char const * data, size_t size, node_type_registry const & types = node_type_registry::global())
+    {
+        if( !G.m_exec_nodes.empty() || G.m_resources.size() )
+            throw std::runtime_error("graph_serializer::load needs an empty graph");
+
+        view v = parse(data, size);
+
+        // resolve the keys once, not once per node
+        std::vector<node_type_registry::factory const*> factories(v.header->num_types);
+        for(uint32_t i=0; i < v.header->num_types; ++i)
+        {
+            auto key = v.str(v.types[i]);
+            factories[i] = types.find(key);
+            if( !factories[i] )
+                throw std::runtime_error( std::string("Node type ") + key + std::string(" is not in the node_type_registry") );
+        }
+
+        // the saved domain ids are mapped to the domains of the same name in G
+        std::vector<uint32_t> domains;
+        for(uint32_t i=0; i < v.header->num_domains; ++i)
+            domains.push_back( G.get_domain( v.str(v.domains[i]) ) );
+
+        G.m_resources.add_unindexed(v.header->num_resources);
+
+        binding_scope S(v);
+        struct scope_guard
+        {
+            node_graph & G;
+            ~scope_guard() { G.m_scope = nullptr; }
+        } guard{G};
+        G.m_scope = &S;
+
+        for(uint32_t i=0; i < v.header->num_nodes; ++i)
+        {
+            auto & r = v.nodes[i];
+            if( r.type >= v.header->num_types || r.flags > static_cast<uint32_t>(node_flags::execute_multiple) ||
+                r.domain >= exec_domain::first_named + v.header->num_domains )
+                throw std::runtime_error("Corrupt graph file");
+
+            S.begin(r);
+            auto & N = (*factories[r.type])( G, static_cast<node_flags>(r.flags) );
+            if( S.pos != S.end )
+                throw std::runtime_error( std::string("Node ") + v.str(r.name) + std::string(" registered fewer resources than when the graph was saved") );
+
+            N.set_name( v.str(r.name) );
+            N.set_affinity( r.affinity );
+            N.set_domain( r.domain < exec_domain::first_named ? r.domain : domains[ r.domain - exec_domain::first_named ] );
+            N.set_cost_hint( r.cost_hint );
+        }
+
+        for(uint32_t i=0; i < v.header->num_resources; ++i)
+        {
+            auto R  = G.m_resources[i];
+            auto & r = v.resources[i];
+            if( r.flags == no_resource )
+                continue;
+            if( !R )
+                throw std::runtime_error( std::string("Resource ") + v.str(r.name) + std::string(" was not registered by any node") );
+            if( static_cast<uint32_t>(R->get_flags()) != r.flags || v.str(r.type) != R->get_type().name() )
+                throw std::runtime_error( std::string("Resource ") + R->get_name() + std::string(" has a different type or flags than when the graph was saved") );
+        }
+
+        // the saved ranks order the successors and pick the fused chains, as they did when saved
+        for(uint32_t i=0; i < v.header->num_nodes; ++i)
+            G.m_exec_nodes[i]->m_rank = v.nodes[i].rank;
+        G.compile_plan(false);
+    }
+
+    static void load(node_graph & G, std::string const & path, node_type_registry const & types = node_type_registry::global())
+    {
+        mapped_file f(path);
+        load(G, f.data(), f.size(), types);
+    }
+
+protected:
+    struct str_ref
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    struct file_header
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t num_types;
+        uint32_t num_resources;
+        uint32_t num_nodes;
+        uint32_t num_regs;
+        uint32_t num_domains;
+        uint32_t strings_size;
+        uint32_t reserved;     // keeps the node records 8-byte aligned
+    };
+
+    struct resource_record
+    {
+        str_ref  name;
+        str_ref  type;  // typeid(T).name() of the value
+        uint32_t flags;
+        uint32_t reserved;
+    };
+
+    struct node_record
+    {
+        uint32_t type;  // index of the node's key
+        uint32_t flags;
+        str_ref  name;
+        uint32_t first_reg;
+        uint32_t num_regs;
+        int32_t  affinity;
+        uint32_t domain; // exec_domain, named domains index file_header's domains from exec_domain::first_named
+        double   cost_hint;
+        double   rank;
+    };
+
+    static char const * magic()
+    {
+        return "GRAPHE\0\1";
+    }
+
+    struct view
+    {
+        file_header     const * header    = nullptr;
+        str_ref         const * types     = nullptr;
+        resource_record const * resources = nullptr;
+        node_record     const * nodes     = nullptr;
+        uint32_t        const * regs      = nullptr;
+        str_ref         const * domains   = nullptr;
+        char            const * strings   = nullptr;
+
+        std::string str(str_ref r) const
+        {
+            return std::string(strings + r.offset, r.size);
+        }
+    };
+
+    /**
+     * Binds the registrations of the node being loaded to the resource ids
+     * stored in the file.
+     */
+    struct binding_scope : registration_scope
+    {
+        explicit binding_scope(view const & v) : m_view(v)
+        {
+        }
+
+        void begin(node_record const & r)
+        {
+            m_node = &r;
+            pos    = r.first_reg;
+            end    = r.first_reg + r.num_regs;
+        }
+
+        std::pair<resource_id, bool> resolve(resource_table & T, std::string const & name) override
+        {
+            if( pos == end )
+                throw std::runtime_error( std::string("Node ") + m_view.str(m_node->name) + std::string(" registered more resources than when the graph was saved") );
+
+            auto id = m_view.regs[pos++];
+            auto & R = m_view.resources[id];
+
+            // the saved name may have a graph_template prefix, or have had its '/' stripped
+            auto skip = !name.empty() && name[0] == '/' ? size_t(1) : size_t(0);
+            auto size = name.size() - skip;
+            if( size > R.name.size ||
+                std::memcmp(name.data() + skip, m_view.strings + R.name.offset + (R.name.size - size), size) != 0 )
+            {
+                throw std::runtime_error( std::string("Node ") + m_view.str(m_node->name) + std::string(" registered ") + name +
+                                          std::string(" where the saved graph has ") + m_view.str(R.name) );
+            }
+            return { id, T[id] == nullptr };
+        }
+
+        std::string full_name(std::string const & name, resource_id id) const override
+        {
+            return id == invalid_resource_id ? name : m_view.str( m_view.resources[id].name );
+        }
+
+        view const        & m_view;
+        node_record const * m_node = nullptr;
+        uint32_t            pos = 0;
+        uint32_t            end = 0;
+    };
+
+    template<typename T>
+    static void write(std::ostream & out, T const * p, size_t count)
+    {
+        out.write( reinterpret_cast<char const*>(p), static_cast<std::streamsize>(sizeof(T) * count) );
+    }
+
+    template<typename T>
+    static T const * section(char const * data, size_t size, size_t & offset, size_t count)
+    {
+        auto bytes = sizeof(T) * count;
+        if( offset + bytes > size )
+            throw std::runtime_error("Corrupt graph file");
+        auto p = reinterpret_cast<T const*>(data + offset);
+        offset += bytes;
+        return p;
+    }
+
+    static view parse(char const * data, size_t size)
+    {
+        view v;
+        size_t offset = 0;
+        v.header = section<file_header>(data, size, offset, 1);
+        if( std::memcmp(v.header->magic, magic(), sizeof(v.header->magic)) != 0 || v.header->version != version )
+            throw std::runtime_error("Not a graph file, or written by another version");
+
+        v.types     = section<str_ref>(data, size, offset, v.header->num_types);
+        v.resources = section<resource_record>(data, size, offset, v.header->num_resources);
+        v.nodes     = section<node_record>(data, size, offset, v.header->num_nodes);
+        v.regs      = section<uint32_t>(data, size, offset, v.header->num_regs);
+        v.domains   = section<str_ref>(data, size, offset, v.header->num_domains);
+        v.strings   = section<char>(data, size, offset, v.header->strings_size);
+
+        auto check = [&v](str_ref r)
+        {
+            if( uint64_t(r.offset) + r.size > v.header->strings_size )
+                throw std::runtime_error("Corrupt graph file");
+        };
+        for(uint32_t i=0; i < v.header->num_types; ++i)
+            check(v.types[i]);
+        for(uint32_t i=0; i < v.header->num_domains; ++i)
+            check(v.domains[i]);
+        for(uint32_t i=0; i < v.header->num_resources; ++i)
+        {
+            check(v.resources[i].name);
+            check(v.resources[i].type);
+        }
+        for(uint32_t i=0; i < v.header->num_nodes; ++i)
+        {
+            check(v.nodes[i].name);
+            if( uint64_t(v.nodes[i].first_reg) + v.nodes[i].num_regs > v.header->num_regs )
+                throw std::runtime_error("Corrupt graph file");
+        }
+        for(uint32_t i=0; i < v.header->num_regs; ++i)
+        {
+            if( v.regs[i] >= v.header->num_resources )
+                throw std::runtime_error("Corrupt graph file");
+        }
+        return v;
+    }
+};
+
+}
+
+#endif
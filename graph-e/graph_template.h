@@ -0,0 +1,197 @@
+#pragma once
+
+#ifndef GRAPH_TEMPLATE_GRAPH_3_H
+#define GRAPH_TEMPLATE_GRAPH_3_H
+
+#include "node_graph.h"
+#include <tuple>
+#include <functional>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace graphe
+{
+
+/**
+ * @brief The graph_template class
+ *
+ * Describes a subgraph once and adds it to a node_graph as many times as
+ * needed. The nodes are declared with the same calls as on node_graph, the
+ * constructor arguments are copied into the template and given to every
+ * instance.
+ *
+ * Each instance gets its own copy of the resources its nodes register,
+ * named prefix + name. A resource whose name starts with '/' is shared by
+ * all the instances and by the rest of the graph, "/camera" refers to the
+ * graph's "camera" resource.
+ *
+ * The first instantiate() records how the registrations of the template
+ * resolve, and which nodes of the instance read each of its resources.
+ * Later instances replay that record: their resources take a block of
+ * consecutive ids and are not looked up by name, and if the graph is
+ * already compiled the instance is added to the plan by copying the
+ * recorded lists of dependents, offset to the new node and resource ids.
+ * Nodes must therefore register the same resources, in the same order,
+ * every time they are constructed, and every instance needs its own prefix.
+ * An instance which registers different names throws std::runtime_error.
+ *
+ * If a node of an instance throws while it is constructed, the nodes of the
+ * instance which were already added are removed again.
+ */
+class graph_template
+{
+public:
+    /**
+     * @brief add_node
+     * @param __args - copied, and passed to the node's constructor for every instance
+     * @return
+     */
+    template<typename _Tp, typename... _Args>
+    graph_template & add_node(_Args&&... __args)
+    {
+        return add_node_flags<node_flags::execute_multiple,_Tp>( std::forward<_Args>(__args)... );
+    }
+
+    /**
+     * @brief add_oneshot_node
+     * @param __args - copied, and passed to the node's constructor for every instance
+     * @return
+     */
+    template<typename _Tp, typename... _Args>
+    graph_template & add_oneshot_node(_Args&&... __args)
+    {
+        return add_node_flags<node_flags::execute_once,_Tp>( std::forward<_Args>(__args)... );
+    }
+
+    template<node_flags F, typename _Tp, typename... _Args>
+    graph_template & add_node_flags(_Args&&... __args)
+    {
+        m_factories.push_back(
+        [args = std::tuple< std::decay_t<_Args>... >( std::forward<_Args>(__args)... )](node_graph & G) -> exec_node &
+        {
+            return std::apply( [&G](auto const &... a) -> exec_node & { return G.template add_node_flags<F,_Tp>(a...); }, args);
+        });
+
+        // the template changed, the next instance records again
+        m_script.clear();
+        m_plan       = template_plan{};
+        m_num_shared = 0;
+        m_recorded   = false;
+        return *this;
+    }
+
+    /**
+     * @brief instantiate
+     * @param G
+     * @param prefix - prepended to the names of the instance's nodes and resources
+     * @return
+     *
+     * Adds one instance of the template to G and returns its nodes, in the
+     * order they were declared.
+     */
+    std::vector<exec_node*> instantiate(node_graph & G, std::string const & prefix)
+    {
+        template_scope S;
+        S.prefix = prefix;
+        S.script = &m_script;
+        S.replay = m_recorded;
+        if( S.replay )
+        {
+            S.intern_shared(G.m_resources, m_num_shared);
+            S.first_local = G.m_resources.add_unindexed( m_plan.num_local() );
+        }
+
+        struct scope_guard
+        {
+            node_graph & G;
+            ~scope_guard() { G.m_scope = nullptr; G.m_defer_plan = false; }
+        } guard{G};
+        G.m_scope      = &S;
+        G.m_defer_plan = S.replay;
+
+        std::vector<exec_node*> nodes;
+        nodes.reserve(m_factories.size());
+        try
+        {
+            for(auto & f : m_factories)
+            {
+                auto & N = f(G);
+                nodes.push_back(&N);
+                N.set_name( prefix + N.get_name() );
+            }
+            if( S.replay && S.pos != m_script.size() )
+                throw std::runtime_error( std::string("Template instance ") + prefix + std::string(" registered fewer resources than when the template was recorded") );
+        }
+        catch(...)
+        {
+            G.m_scope      = nullptr;
+            G.m_defer_plan = false;
+            if( S.replay )
+            {
+                G.discard_instance(nodes);
+            }
+            else
+            {
+                for(auto it = nodes.rbegin(); it != nodes.rend(); ++it)
+                    G.remove_node(**it);
+                m_script.clear();
+            }
+            throw;
+        }
+
+        if( S.replay )
+        {
+            G.m_defer_plan = false;
+            G.add_instance(nodes, m_plan, S.first_local);
+        }
+        else
+        {
+            record_plan(G, S, nodes);
+        }
+        return nodes;
+    }
+
+    size_t size() const
+    {
+        return m_factories.size();
+    }
+
+protected:
+    /**
+     * Records which nodes of the first instance read each of its resources,
+     * by their index in the instance.
+     */
+    void record_plan(node_graph & G, template_scope const & S, std::vector<exec_node*> const & nodes)
+    {
+        std::unordered_map<exec_node const*, uint32_t> local_node;
+        for(uint32_t j=0; j < nodes.size(); ++j)
+            local_node.emplace(nodes[j], j);
+
+        m_plan.succ_offsets.assign(1, 0);
+        m_plan.succ.clear();
+        for(auto id : S.local_ids)
+        {
+            // nodes outside the instance which already read the resource are not part of the template
+            for(auto N : G.m_resources[id]->get_consumers())
+            {
+                auto it = local_node.find(N);
+                if( it != local_node.end() )
+                    m_plan.succ.push_back(it->second);
+            }
+            m_plan.succ_offsets.push_back( static_cast<uint32_t>(m_plan.succ.size()) );
+        }
+        m_num_shared = S.shared_slots.size();
+        m_recorded   = true;
+    }
+
+    std::vector< std::function<exec_node&(node_graph&)> > m_factories;
+    std::vector<template_scope::entry>                    m_script;         // recorded by the first instance
+    template_plan                                         m_plan;           // dependents of the resources owned by each instance
+    size_t                                                m_num_shared = 0; // resources shared by the instances
+    bool                                                  m_recorded   = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,368 @@
+#pragma once
+
+#ifndef METRICS_GRAPH_3_H
+#define METRICS_GRAPH_3_H
+
+#include "thread_slots.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <array>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+
+// Set GRAPHE_METRICS to 0 to compile the instrumentation out of node_graph
+// and the executors. graph_metrics can still be created, it just never
+// records anything.
+#ifndef GRAPHE_METRICS
+#define GRAPHE_METRICS 1
+#endif
+
+namespace graphe
+{
+
+/**
+ * @brief The metrics_snapshot struct
+ *
+ * Counters collected by graph_metrics::snapshot(). Durations are in
+ * microseconds. Latency percentiles are read from power of two
+ * histograms, so they are upper bounds within a factor of two.
+ */
+struct metrics_snapshot
+{
+    static constexpr size_t num_buckets = 40; // bucket b counts durations in [2^b, 2^(b+1)) ns
+
+    struct node
+    {
+        std::string name;
+        uint64_t    count = 0;          // number of executions
+        double      total_us = 0.0;
+        double      mean_us = 0.0;
+        double      max_us = 0.0;
+        double      p50_us = 0.0;
+        double      p99_us = 0.0;
+        double      mean_queue_us = 0.0; // time from being scheduled to starting
+        std::array<uint64_t, num_buckets> histogram{};
+    };
+
+    struct worker
+    {
+        uint32_t id = 0;                // order in which the thread was first seen
+        uint64_t nodes = 0;             // number of nodes executed
+        uint64_t steals = 0;            // nodes stolen from other workers, work_stealing_executor only
+        double   busy_us = 0.0;         // time spent inside node bodies
+        double   idle_us = 0.0;         // time spent asleep waiting for work, work_stealing_executor only
+        double   elapsed_us = 0.0;      // time since the thread first recorded something
+    };
+
+    std::vector<node>   nodes;          // indexed by the node's metrics id, in the order they first executed
+    std::vector<worker> workers;
+    uint64_t            frames = 0;     // number of frames completed
+    double              makespan_p50_us = 0.0; // over the last frames kept by graph_metrics
+    double              makespan_p90_us = 0.0;
+    double              makespan_p99_us = 0.0;
+    double              makespan_max_us = 0.0;
+};
+
+/**
+ * @brief The graph_metrics class
+ *
+ * Live counters for a running graph: executions, latency histograms and
+ * queue time of every node, busy and idle time of every thread, steals,
+ * and the makespan of the last frames.
+ *
+ * Each thread only writes its own counters, which are plain relaxed
+ * stores, so recording takes no locks once the thread and the node have
+ * been seen. snapshot() reads them while the graph keeps running.
+ *
+ * Attach it with node_graph::set_metrics().
+ */
+class graph_metrics
+{
+public:
+    using clock      = std::chrono::steady_clock;
+    using time_point = clock::time_point;
+
+    static constexpr uint32_t invalid_id  = ~uint32_t(0);
+    static constexpr size_t   num_buckets = metrics_snapshot::num_buckets;
+
+    explicit graph_metrics(size_t frames_kept = 1024) :
+        m_frames( frames_kept ? frames_kept : 1 )
+    {
+        for(auto & f : m_frames)
+            f.store(0, std::memory_order_relaxed);
+    }
+
+    graph_metrics( graph_metrics const & other) = delete;
+    graph_metrics & operator = ( graph_metrics const & other) = delete;
+
+    /**
+     * @brief record
+     * @param node_id - the node's metrics id, assigned on first use
+     * @param name    - the name of the node, copied the first time the node is seen
+     *
+     * Records one execution of a node on the calling thread.
+     */
+    void record(uint32_t & node_id, std::string const & name, time_point scheduled, time_point start, time_point end)
+    {
+        if( node_id == invalid_id )
+            node_id = register_node(name);
+        if( node_id >= max_nodes )
+            return;
+
+        auto & t = local();
+        auto & c = t.counters(node_id);
+        auto d = to_ns(end - start);
+        auto q = scheduled == time_point() ? 0 : to_ns(start - scheduled);
+
+        add(c.m_count, 1);
+        add(c.m_total_ns, d);
+        add(c.m_queue_ns, q);
+        if( d > c.m_max_ns.load(std::memory_order_relaxed) )
+            c.m_max_ns.store(d, std::memory_order_relaxed);
+        add(c.m_histogram[ bucket(d) ], 1);
+
+        add(t.m_nodes, 1);
+        add(t.m_busy_ns, d);
+    }
+
+    /**
+     * @brief record_frame
+     * @param makespan - time from scheduling the roots to the last node finishing
+     */
+    void record_frame(clock::duration makespan)
+    {
+        auto i = m_num_frames.fetch_add(1, std::memory_order_relaxed);
+        m_frames[ i % m_frames.size() ].store( to_ns(makespan), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief record_steal
+     *
+     * Counts a node stolen by the calling thread.
+     */
+    void record_steal()
+    {
+        add(local().m_steals, 1);
+    }
+
+    /**
+     * @brief record_idle
+     *
+     * Adds the time the calling thread spent waiting for work.
+     */
+    void record_idle(clock::duration idle)
+    {
+        add(local().m_idle_ns, to_ns(idle));
+    }
+
+    /**
+     * @brief snapshot
+     * @return
+     *
+     * Sums the counters of all the threads. Can be called at any time, the
+     * values of a node which is executing at the same time may be from
+     * before or after that execution.
+     */
+    metrics_snapshot snapshot() const
+    {
+        metrics_snapshot S;
+        auto now = clock::now();
+
+        std::lock_guard<std::mutex> lk(m_mutex);
+        S.nodes.resize(m_names.size());
+        for(size_t i=0; i < m_names.size(); ++i)
+            S.nodes[i].name = m_names[i];
+
+        std::vector<uint64_t> total(m_names.size(), 0), queue(m_names.size(), 0);
+        for(auto & t : m_threads.all())
+        {
+            metrics_snapshot::worker w;
+            w.id         = t->m_id;
+            w.nodes      = t->m_nodes.load(std::memory_order_relaxed);
+            w.steals     = t->m_steals.load(std::memory_order_relaxed);
+            w.busy_us    = to_us( t->m_busy_ns.load(std::memory_order_relaxed) );
+            w.idle_us    = to_us( t->m_idle_ns.load(std::memory_order_relaxed) );
+            w.elapsed_us = to_us( to_ns(now - t->m_first) );
+            S.workers.push_back(w);
+
+            for(size_t i=0; i < m_names.size(); ++i)
+            {
+                auto c = t->find(static_cast<uint32_t>(i));
+                if( !c )
+                    continue;
+                auto & n = S.nodes[i];
+                n.count  += c->m_count.load(std::memory_order_relaxed);
+                total[i] += c->m_total_ns.load(std::memory_order_relaxed);
+                queue[i] += c->m_queue_ns.load(std::memory_order_relaxed);
+                n.max_us  = std::max(n.max_us, to_us( c->m_max_ns.load(std::memory_order_relaxed) ));
+                for(size_t b=0; b < num_buckets; ++b)
+                    n.histogram[b] += c->m_histogram[b].load(std::memory_order_relaxed);
+            }
+        }
+
+        for(size_t i=0; i < S.nodes.size(); ++i)
+        {
+            auto & n = S.nodes[i];
+            n.total_us = to_us(total[i]);
+            if( n.count )
+            {
+                n.mean_us       = n.total_us / static_cast<double>(n.count);
+                n.mean_queue_us = to_us(queue[i]) / static_cast<double>(n.count);
+            }
+            n.p50_us = percentile(n.histogram, n.count, 0.50);
+            n.p99_us = percentile(n.histogram, n.count, 0.99);
+        }
+
+        S.frames = m_num_frames.load(std::memory_order_relaxed);
+        auto kept = std::min<uint64_t>(S.frames, m_frames.size());
+        std::vector<uint64_t> spans(kept);
+        for(size_t i=0; i < kept; ++i)
+            spans[i] = m_frames[i].load(std::memory_order_relaxed);
+        std::sort(spans.begin(), spans.end());
+        if( !spans.empty() )
+        {
+            auto at = [&](double p) { return to_us( spans[ std::min(spans.size()-1, static_cast<size_t>(p * static_cast<double>(spans.size()))) ] ); };
+            S.makespan_p50_us = at(0.50);
+            S.makespan_p90_us = at(0.90);
+            S.makespan_p99_us = at(0.99);
+            S.makespan_max_us = to_us(spans.back());
+        }
+        return S;
+    }
+
+protected:
+    static constexpr uint32_t chunk_size = 256;   // nodes per block of counters
+    static constexpr uint32_t max_chunks = 4096;  // nodes beyond max_nodes are not recorded
+    static constexpr uint32_t max_nodes  = chunk_size * max_chunks;
+
+    struct node_counters
+    {
+        std::atomic<uint64_t> m_count{0};
+        std::atomic<uint64_t> m_total_ns{0};
+        std::atomic<uint64_t> m_queue_ns{0};
+        std::atomic<uint64_t> m_max_ns{0};
+        std::array< std::atomic<uint64_t>, num_buckets > m_histogram{};
+    };
+
+    struct thread_counters
+    {
+        explicit thread_counters(uint32_t id) : m_id(id)
+        {
+            for(auto & c : m_chunks)
+                c.store(nullptr, std::memory_order_relaxed);
+        }
+
+        ~thread_counters()
+        {
+            for(auto & c : m_chunks)
+                delete [] c.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Only called by the owning thread, allocates the block of counters
+         * the first time one of its nodes executes on this thread.
+         */
+        node_counters & counters(uint32_t node)
+        {
+            auto & chunk = m_chunks[node / chunk_size];
+            auto p = chunk.load(std::memory_order_relaxed);
+            if( !p )
+            {
+                p = new node_counters[chunk_size];
+                chunk.store(p, std::memory_order_release);
+            }
+            return p[node % chunk_size];
+        }
+
+        node_counters const * find(uint32_t node) const
+        {
+            auto p = m_chunks[node / chunk_size].load(std::memory_order_acquire);
+            return p ? &p[node % chunk_size] : nullptr;
+        }
+
+        uint32_t              m_id;
+        time_point            m_first = clock::now();
+        std::atomic<uint64_t> m_nodes{0};
+        std::atomic<uint64_t> m_steals{0};
+        std::atomic<uint64_t> m_busy_ns{0};
+        std::atomic<uint64_t> m_idle_ns{0};
+        std::array< std::atomic<node_counters*>, max_chunks > m_chunks;
+    };
+
+    // the owner is the only writer, so it does not need a read-modify-write
+    static void add(std::atomic<uint64_t> & c, uint64_t v)
+    {
+        c.store( c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+
+    static size_t bucket(uint64_t ns)
+    {
+        size_t b = 0;
+        while( ns > 1 && b+1 < num_buckets )
+        {
+            ns >>= 1;
+            ++b;
+        }
+        return b;
+    }
+
+    static double percentile(std::array<uint64_t, num_buckets> const & h, uint64_t count, double p)
+    {
+        if( count == 0 )
+            return 0.0;
+        auto target = static_cast<uint64_t>( p * static_cast<double>(count) );
+        uint64_t seen = 0;
+        for(size_t b=0; b < num_buckets; ++b)
+        {
+            seen += h[b];
+            if( seen > target )
+                return to_us( uint64_t(2) << b );
+        }
+        return to_us( uint64_t(2) << (num_buckets-1) );
+    }
+
+    static uint64_t to_ns(clock::duration d)
+    {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        return ns > 0 ? static_cast<uint64_t>(ns) : 0;
+    }
+
+    static double to_us(uint64_t ns)
+    {
+        return static_cast<double>(ns) / 1000.0;
+    }
+
+    uint32_t register_node(std::string const & name)
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_names.push_back(name);
+        return static_cast<uint32_t>(m_names.size()-1);
+    }
+
+    /**
+     * Returns the counters of the calling thread, creating them the first
+     * time the thread records something into this object.
+     */
+    thread_counters & local()
+    {
+        return m_threads.local(m_mutex, [](size_t worker)
+        {
+            return std::make_unique<thread_counters>( static_cast<uint32_t>(worker) );
+        });
+    }
+
+    std::vector< std::atomic<uint64_t> >            m_frames;      // makespans of the last frames, in ns
+    std::atomic<uint64_t>                           m_num_frames{0};
+
+    mutable std::mutex                              m_mutex;       // protects m_threads and m_names
+    thread_slots<thread_counters>                   m_threads;     // one set of counters per thread
+    std::vector<std::string>                        m_names;
+};
+
+}
+
+#endif
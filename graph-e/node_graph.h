@@ -5,29 +5,72 @@
 #define FRAME_GRAPH_3_H
 
 #include <memory>
-#include <mutex>
 #include <functional>
 #include <thread>
 #include <algorithm>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <queue>
 #include <any>
+#include <optional>
+#include <typeinfo>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
 #include <iostream>
 #include <type_traits>
+#include <utility>
+
+#include "frame_arena.h"
+#include "node_pool.h"
+#include "profiler.h"
+#include "metrics.h"
+#include "stream_queue.h"
+#include "completion_event.h"
 
 namespace graphe
 {
 
-using time_point = std::chrono::system_clock::time_point;
+/**
+ * GRAPHE_RUNTIME_CHECKS enables the checks which are made while the graph
+ * executes, eg: that a node made all its outputs available. It defaults to
+ * on, unless NDEBUG is defined. node_graph::compile() validates the
+ * topology either way.
+ */
+#ifndef GRAPHE_RUNTIME_CHECKS
+#  ifdef NDEBUG
+#    define GRAPHE_RUNTIME_CHECKS 0
+#  else
+#    define GRAPHE_RUNTIME_CHECKS 1
+#  endif
+#endif
+
+/*
+ * Pastes two tokens once both have been expanded, eg: to make a unique name
+ * out of __COUNTER__ in the registration macros.
+ */
+#define GRAPHE_CONCAT_IMPL(a, b) a##b
+#define GRAPHE_CONCAT(a, b)      GRAPHE_CONCAT_IMPL(a, b)
+
+using time_point = std::chrono::steady_clock::time_point;
 
 class node_graph;
 class exec_node;
 class resource_node;
-using exec_node_p     = std::shared_ptr<exec_node>;
-using resource_node_p = std::shared_ptr<resource_node>;
-using exec_node_w      = std::weak_ptr<exec_node>;
-using resource_node_w  = std::weak_ptr<resource_node>;
+template<typename T> class typed_resource_node;
+// Handles to nodes. The nodes are owned by the node_graph, which allocates
+// them from its pools, and they stay valid until the graph is destroyed
+// (or, for one-shot nodes, until reset() removes them).
+using exec_node_p     = exec_node*;
+using resource_node_p = resource_node*;
+
+// Dense integer id of a resource. Names are interned into ids once, when
+// the resource is registered.
+using resource_id = uint32_t;
+static constexpr resource_id invalid_resource_id = ~resource_id(0);
 
 enum class node_flags
 {
@@ -37,6 +80,20 @@ enum class node_flags
 
 };
 
+/**
+ * @brief The exec_domain struct
+ *
+ * Ids of the threads a node may run on (see exec_node::set_domain()). Ids
+ * from first_named on are dedicated threads, named with
+ * node_graph::get_domain().
+ */
+struct exec_domain
+{
+    static constexpr uint32_t any         = 0; // any thread of the executor
+    static constexpr uint32_t main        = 1; // the thread which calls wait()
+    static constexpr uint32_t first_named = 2;
+};
+
 enum class resource_flags
 {
     resetable,   // resource can be reset
@@ -54,22 +111,47 @@ class exec_node
 protected:
     friend class node_graph;
     friend class ResourceRegistry;
+    friend class async_handle;
+    friend class graph_serializer;
 
     std::string  m_name;
-    std::any     m_NodeClass;                      // an instance of the Node class
+    void       * m_NodeClass = nullptr;            // an instance of the Node class, allocated from the graph's arena
+    void      (* m_destroyNodeClass)(void*) = nullptr; // destroys m_NodeClass
+    uint32_t     m_class_size  = 0;                // sizeof and alignof the Node class, to give its storage back to the arena
+    uint32_t     m_class_align = 0;
     std::any     m_NodeData;                       // an instance of the node data
-    std::mutex   m_mutex;                          // mutex to prevent the node from executing twice
-    bool         m_scheduled = false;              // has this node been scheduled to run.
-    bool         m_executed = false;               // flag to indicate whether the node has been executed.
+    std::atomic<bool> m_scheduled{false};          // has this node been scheduled to run.
+    std::atomic<bool> m_executed{false};           // flag to indicate whether the node has been executed.
+                                                   // set with an exchange so the node can only execute once.
+    bool              m_has_run = false;           // the node has executed at least once, so its outputs hold values
+    bool              m_skipped = false;           // incremental mode skipped the node in the last frame
     node_graph * m_Graph; // the parent graph;
 
+    time_point     m_sched_time;                    // the time at which this node was scheduled, only set while profiling
     time_point     m_exec_start_time_us;            // the time at which this node was executed
+    time_point     m_exec_end_time;                 // the time at which this node finished executing
 
     std::thread::id m_thread_id;                  // the id of the thread that executed this.
 
     node_flags   m_flags;
-    std::vector<resource_node_w> m_requiredResources; // a list of required resources
-    std::vector<resource_node_w> m_producedResources; // a list of required resources
+    uint32_t     m_index = 0;                      // index of this node in the compiled plan
+    uint32_t     m_pos = 0;                        // position of this node in node_graph::m_exec_nodes
+    uint32_t     m_id = 0;                         // order in which the node was added to the graph, never reused
+    uint32_t     m_profile_id = node_profiler::invalid_id; // id of this node in the graph's profiler
+    uint32_t     m_metrics_id = graph_metrics::invalid_id; // id of this node in the graph's metrics
+    double       m_cost_hint = 0.0;                // user supplied cost, 0 if the measured duration should be used
+    double       m_rank = 0.0;                     // length of the longest path from this node to a sink
+    int32_t      m_affinity = -1;                  // preferred worker, or -1
+    uint32_t     m_domain = exec_domain::any;      // thread the node has to run on
+    bool         m_fused = false;                  // run by the thread which makes it ready, see node_graph::set_fusion()
+    std::vector<resource_node*>  m_requiredResources; // a list of required resources
+    std::vector<resource_node*>  m_producedResources; // a list of the resources this node produces
+    std::vector<resource_node*>  m_moveableInputs;    // moveable inputs, released once the node has executed
+    std::vector<stream_base*>    m_streamInputs;      // streams the node pops from
+    std::vector< std::pair<stream_base*, uint32_t> > m_streamOutputs; // streams the node pushes into, and its producer slot
+    std::function<void(void)>    m_stream_body;       // calls the node's body, only set for stream nodes
+    std::vector<resource_id>     m_registrations;     // resources in the order the node registered them
+    std::type_info const       * m_type = nullptr;    // type of the node class
 
 
 public:
@@ -79,6 +161,8 @@ public:
     ~exec_node()
     {
     //    std::cout << "Node Destroyed: " << m_name << std::endl;
+        if( m_destroyNodeClass )
+            m_destroyNodeClass(m_NodeClass);
     }
 
     time_point get_time() const
@@ -90,6 +174,18 @@ public:
     {
         return std::chrono::duration_cast<std::chrono::microseconds>(m_exec_start_time_us-start);
     }
+
+    /**
+     * @brief get_end_time
+     * @return
+     *
+     * Returns the time at which the node last finished executing.
+     */
+    time_point get_end_time() const
+    {
+        return m_exec_end_time;
+    }
+
     /**
      * @brief trigger
      *
@@ -98,6 +194,15 @@ public:
      */
     void trigger();
 
+    /**
+     * @brief try_schedule
+     * @return
+     *
+     * Schedules the node for execution unless it has already been scheduled.
+     * Returns true if this call scheduled the node.
+     */
+    bool try_schedule();
+
     /**
      * @brief can_execute
      * @return
@@ -121,6 +226,197 @@ public:
         return m_flags;
     }
 
+    /**
+     * @brief get_id
+     * @return
+     *
+     * Returns the id of the node. Ids are given out in the order the nodes
+     * are added, so two graphs built the same way give the same id to the
+     * same node.
+     */
+    uint32_t get_id() const
+    {
+        return m_id;
+    }
+
+    /**
+     * @brief set_cost_hint
+     * @param cost - estimated duration of the node in microseconds
+     *
+     * Used by node_graph::compute_ranks() instead of the measured duration.
+     * Set it to 0 to use the measured duration again.
+     */
+    void set_cost_hint(double cost)
+    {
+        m_cost_hint = cost;
+    }
+
+    double get_cost_hint() const
+    {
+        return m_cost_hint;
+    }
+
+    /**
+     * @brief set_affinity
+     * @param worker - index of the worker, or -1 to let any worker run it
+     *
+     * Asks the executor to run the node on the given worker, eg: to keep a
+     * node next to the data it works on. Executors without workers of
+     * their own ignore it. work_stealing_executor takes the index modulo
+     * its number of workers.
+     */
+    void set_affinity(int32_t worker)
+    {
+        m_affinity = worker < 0 ? -1 : worker;
+    }
+
+    int32_t get_affinity() const
+    {
+        return m_affinity;
+    }
+
+    /**
+     * @brief set_domain
+     * @param domain - exec_domain::any, exec_domain::main or an id returned by node_graph::get_domain()
+     *
+     * Restricts the node to a thread, eg: for nodes which use a GPU context
+     * or other thread-local APIs. threaded_executor runs main nodes inside
+     * wait() and each named domain on a dedicated thread. serial_executor
+     * runs everything on the calling thread anyway.
+     */
+    void set_domain(uint32_t domain)
+    {
+        m_domain = domain;
+    }
+
+    uint32_t get_domain() const
+    {
+        return m_domain;
+    }
+
+    /**
+     * @brief is_fused
+     * @return
+     *
+     * Returns true if compile() fused the node to its predecessor.
+     */
+    bool is_fused() const
+    {
+        return m_fused;
+    }
+
+    /**
+     * @brief get_node_type
+     * @return
+     *
+     * Returns the type of the node class.
+     */
+    std::type_info const & get_node_type() const
+    {
+        return *m_type;
+    }
+
+    /**
+     * @brief get_registrations
+     * @return
+     *
+     * Returns the ids of the resources the node registered, in the order
+     * its constructor registered them.
+     */
+    std::vector<resource_id> const & get_registrations() const
+    {
+        return m_registrations;
+    }
+
+    /**
+     * @brief get_thread_id
+     * @return
+     *
+     * Returns the id of the thread which last executed the node.
+     */
+    std::thread::id get_thread_id() const
+    {
+        return m_thread_id;
+    }
+
+    /**
+     * @brief was_skipped
+     * @return
+     *
+     * Returns true if, in incremental mode, the node was not executed in the
+     * last frame because none of its inputs had changed.
+     */
+    bool was_skipped() const
+    {
+        return m_skipped;
+    }
+
+    /**
+     * @brief inputs_unchanged
+     * @return
+     *
+     * Returns true if the node can keep its previous outputs: it has
+     * executed before, none of its inputs changed this frame, and all its
+     * outputs still hold their values. Nodes without inputs always execute.
+     */
+    bool inputs_unchanged() const;
+
+    /**
+     * @brief get_rank
+     * @return
+     *
+     * Returns the critical-path rank of the node, ie: the cost of the longest
+     * path from this node to the end of the graph, including its own cost.
+     * Nodes with a higher rank should be executed first.
+     */
+    double get_rank() const
+    {
+        return m_rank;
+    }
+
+    /**
+     * @brief is_stream_node
+     * @return
+     *
+     * Returns true if the node registered an input or output stream. Stream
+     * nodes are not executed by the frame executors, they are run by
+     * stream_executor whenever their streams have items.
+     */
+    bool is_stream_node() const
+    {
+        return !m_streamInputs.empty() || !m_streamOutputs.empty();
+    }
+
+    std::vector<resource_node*> const & get_required_resources() const
+    {
+        return m_requiredResources;
+    }
+
+    std::vector<resource_node*> const & get_produced_resources() const
+    {
+        return m_producedResources;
+    }
+
+    std::vector<stream_base*> const & get_stream_inputs() const
+    {
+        return m_streamInputs;
+    }
+
+    std::vector< std::pair<stream_base*, uint32_t> > const & get_stream_outputs() const
+    {
+        return m_streamOutputs;
+    }
+
+    /**
+     * @brief step
+     *
+     * Calls the body of a stream node once.
+     */
+    void step()
+    {
+        m_stream_body();
+    }
+
 };
 
 /**
@@ -133,19 +429,29 @@ class resource_node
 {
 protected:
     friend class ResourceRegistry;
+    friend class node_graph;
+    template<typename> friend class out_resource;
 
-    std::any                 m_resource;
+    std::type_info const   * m_type = nullptr; // type of the value held by the typed_resource_node
     std::string              m_name;
-    std::vector<exec_node_w> m_Nodes; // list of nodes that must be triggered
+    std::vector<exec_node*>  m_Nodes; // list of nodes that must be triggered
                                      // when resource becomes availabe
-    bool                     m_is_available = false;
+    std::atomic<bool>        m_is_available{false};
+    bool                     m_changed = true;  // the value changed the last time the resource was made available
+    bool                     m_arena_backed = false; // the producer asked for the frame arena since the last reset()
+    uint64_t                 m_version = 0;     // incremented every time the resource is made available with a new value
     resource_flags           m_flags;
+    resource_id              m_index = 0; // interned id of this resource, also its index in the compiled plan
+    node_graph             * m_Graph = nullptr; // the graph this resource belongs to
+    uint32_t                 m_num_producers = 0; // nodes which registered the resource as an output
+    uint32_t                 m_storage_size  = 0; // sizeof and alignof the typed_resource_node, to give its storage back to the arena
+    uint32_t                 m_storage_align = 0;
 
-    exec_node_w              m_parent;
+    exec_node              * m_parent = nullptr;
 public:
     time_point m_time_available;
 
-    ~resource_node()
+    virtual ~resource_node()
     {
 
     }
@@ -156,11 +462,15 @@ public:
      *
      * Makes the resource available to other nodes. If this resource is needed by another node, that node
      * will be scheduled for execution so long as all other required resources are satisfied
+     *
+     * Returns true if this call changed the availability of the resource.
      */
-    void make_available(bool av = true)
+    bool make_available(bool av = true)
     {
-        m_is_available = av;
-        m_time_available = std::chrono::system_clock::now();
+        m_time_available = std::chrono::steady_clock::now();
+        // seq_cst: two producers of the same node each store their resource and then
+        // read the other one in can_execute(), at least one of them must see both.
+        return m_is_available.exchange(av) != av;
     }
 
     resource_flags get_flags() const
@@ -168,6 +478,43 @@ public:
         return m_flags;
     }
 
+    /**
+     * @brief set_changed
+     * @param changed
+     *
+     * Records whether the value changed since the previous frame. Called by
+     * the producer before the resource is made available.
+     */
+    void set_changed(bool changed)
+    {
+        m_changed = changed;
+        if( changed )
+            ++m_version;
+    }
+
+    /**
+     * @brief is_changed
+     * @return
+     *
+     * Returns true if the value changed since the previous frame.
+     */
+    bool is_changed() const
+    {
+        return m_changed;
+    }
+
+    /**
+     * @brief get_version
+     * @return
+     *
+     * Returns the number of times the resource was made available with a
+     * changed value.
+     */
+    uint64_t get_version() const
+    {
+        return m_version;
+    }
+
     /**
      * @brief is_available
      * @return
@@ -176,7 +523,7 @@ public:
      */
     bool is_available() const
     {
-        return m_is_available;
+        return m_is_available.load();
     }
 
     time_point get_time() const
@@ -189,31 +536,75 @@ public:
     }
 
     /**
-     * @brief get_resource
+     * @brief get_type
      * @return
      *
-     * Gets a reference to the resource.
+     * Returns the type of the value held by this resource.
      */
-    std::any & get_resource()
+    std::type_info const & get_type() const
     {
-        return m_resource;
+        return *m_type;
     }
 
     bool has_parent() const
     {
-        return m_parent.lock()!=nullptr;
+        return m_parent!=nullptr;
+    }
+
+    /**
+     * @brief get_producer
+     * @return
+     *
+     * Returns the node which produces this resource, or nullptr.
+     */
+    exec_node * get_producer() const
+    {
+        return m_parent;
+    }
+
+    /**
+     * @brief get_consumers
+     * @return
+     *
+     * Returns the nodes which require this resource.
+     */
+    std::vector<exec_node*> const & get_consumers() const
+    {
+        return m_Nodes;
     }
+
+    /**
+     * @brief has_value
+     * @return
+     *
+     * Returns true if a value has been emplaced() or set()
+     */
+    virtual bool has_value() const = 0;
+
+    /**
+     * @brief destroy_value
+     *
+     * Destroys the value held by the resource. For trivially destructible
+     * types this only marks the slot as empty, the storage is reused by
+     * the next emplace().
+     */
+    virtual void destroy_value() = 0;
     /**
      * @brief Get
      * @return
      *
      * Gets a reference to the resource cast to the particular type. Throws an
-     * exception of the resource has not been created
+     * exception of the resource has not been created or if T is not the type
+     * the resource was registered with.
      */
     template<typename T>
     T & Get()
     {
-        return std::any_cast<T&>(m_resource);
+        if( *m_type != typeid(T) )
+        {
+            throw std::runtime_error( std::string("Resource ") + m_name + std::string(" does not hold the requested type") );
+        }
+        return static_cast< typed_resource_node<T>* >(this)->get();
     }
 
     std::string const & get_name() const
@@ -221,21 +612,89 @@ public:
         return m_name;
     }
 
+    resource_id get_id() const
+    {
+        return m_index;
+    }
+
+    node_graph * get_graph() const
+    {
+        return m_Graph;
+    }
+
     /**
      * @brief notify_dependents
      *
      * Notify all nodes waiting on this resource that this resource is available.
+     * If the graph has been compiled, this simply decrements the pending-input
+     * counter of each dependent node.
+     */
+    void notify_dependents();
+};
+
+/**
+ * @brief The typed_resource_node class
+ *
+ * A resource_node which stores its value directly. The type is checked once,
+ * when the resource is registered, so accessing the value through an
+ * in_resource/out_resource does not need a type check.
+ */
+template<typename T>
+class typed_resource_node : public resource_node
+{
+public:
+    typed_resource_node()
+    {
+        m_type = &typeid(T);
+    }
+
+    /**
+     * @brief get
+     * @return
+     *
+     * Returns a reference to the value. Throws std::bad_optional_access if
+     * the value has not been emplaced() or set()
      */
-    void notify_dependents()
+    T & get()
     {
-        for(auto & N : m_Nodes)
-        {
-            if( auto n = N.lock())
-                n->trigger();
-        }
+        return m_value.value();
+    }
+
+    template<typename... _Args>
+    T & emplace(_Args&&... __args)
+    {
+        return m_value.emplace( std::forward<_Args>(__args)...);
+    }
+
+    /**
+     * @brief set
+     * @param x
+     *
+     * Assigns into the existing value if there is one so that
+     * its storage can be reused.
+     */
+    template<typename U>
+    void set(U && x)
+    {
+        if( m_value )
+            *m_value = std::forward<U>(x);
+        else
+            m_value.emplace( std::forward<U>(x) );
+    }
+
+    bool has_value() const override
+    {
+        return m_value.has_value();
+    }
+
+    void destroy_value() override
+    {
+        m_value.reset();
     }
+
+protected:
+    std::optional<T> m_value;
 };
-std::vector<int> x;
 
 //===============================================================================
 template<typename T> struct is_shared_ptr : std::false_type {};
@@ -246,7 +705,7 @@ template<typename T> struct is_shared_ptr<std::shared_ptr<T>> : std::true_type {
  *
  * Class used to register an input resource.
  */
-template<typename T>
+template<typename T, resource_flags F = resource_flags::resetable>
 class in_resource
 {
     static constexpr bool is_fundamental = std::is_fundamental<T>::value;
@@ -254,7 +713,7 @@ class in_resource
 
 protected:
     friend class ResourceRegistry;
-    resource_node_w m_node;
+    typed_resource_node<T> * m_node = nullptr;
 public:
 
     /**
@@ -265,7 +724,18 @@ public:
      */
     T & get()
     {
-        return m_node.lock()->Get<T>();
+        return m_node->get();
+    }
+
+    /**
+     * @brief changed
+     * @return
+     *
+     * Returns true if the producer changed the value this frame.
+     */
+    bool changed() const
+    {
+        return m_node->is_changed();
     }
 
 
@@ -297,6 +767,33 @@ public:
 
 };
 
+/**
+ * @brief The in_resource class for moveable resources
+ *
+ * A moveable resource has exactly one consumer, which can take ownership of
+ * the value instead of reading it by reference.
+ */
+template<typename T>
+class in_resource<T, resource_flags::moveable> : public in_resource<T>
+{
+protected:
+    friend class ResourceRegistry;
+public:
+    /**
+     * @brief take
+     * @return
+     *
+     * Moves the value out of the resource. The resource no longer holds a
+     * value afterwards.
+     */
+    T take()
+    {
+        T x( std::move( this->m_node->get() ) );
+        this->m_node->destroy_value();
+        return x;
+    }
+};
+
 /**
  * @brief The out_resource class
  *
@@ -307,7 +804,7 @@ class out_resource
 {
 protected:
     friend class ResourceRegistry;
-    resource_node_w m_node;
+    typed_resource_node<T> * m_node = nullptr;
 public:
     static constexpr bool is_fundamental = std::is_fundamental<T>::value;
     static constexpr bool is_pointer_type  = (std::is_pointer<T>::value || is_shared_ptr<T>::value);
@@ -320,26 +817,59 @@ public:
      */
     T & get()
     {
-        return m_node.lock()->Get<T>();//std::any_cast<T&>( m_node.lock()->m_resource );
+        return m_node->get();
     }
 
     /**
-     * @brief make_available
-     * Makes this resource available. Once it is available, any ExecNodes
-     * which require this resource will be allowed to execute.
-     */
-    void make_available()
+     * @brief memory_resource
+     * @return
+     *
+     * Returns the memory resource the value should allocate from. If the
+     * graph has a frame arena and this resource is reset every frame, this
+     * is the arena, otherwise it is the default memory resource. eg:
+     *
+     *   out.emplace( 1024, 0.0f, out.memory_resource() ); // std::pmr::vector<float>
+     */
+    std::pmr::memory_resource * memory_resource() const;
+
+    /**
+     * @brief make_available
+     * Makes this resource available. Once it is available, any ExecNodes
+     * which require this resource will be allowed to execute.
+     */
+    void make_available()
+    {
+        publish(true);
+    }
+
+    /**
+     * @brief make_available_unchanged
+     *
+     * Makes this resource available, keeping the value from the previous
+     * frame. In incremental mode, nodes whose inputs are all unchanged are
+     * skipped.
+     */
+    void make_available_unchanged()
+    {
+        publish(false);
+    }
+
+    /**
+     * @brief set_if_changed
+     * @param x
+     *
+     * Sets the resource and makes it available. If the resource already
+     * holds a value equal to x, the value is kept and the resource is
+     * marked as unchanged. Requires T to be equality comparable.
+     */
+    void set_if_changed(T const & x)
     {
-        auto node = m_node.lock();
-        if( node )
+        if( m_node->has_value() && m_node->get() == x )
         {
-            if( !node->is_available() )
-            {
-                //std::cout << node->get_name() << " is available" << std::endl;
-                node->make_available();
-                node->notify_dependents();
-            }
+            make_available_unchanged();
+            return;
         }
+        set(x);
     }
 
     /**
@@ -351,9 +881,7 @@ public:
     template<typename... _Args>
     void emplace(_Args&&... __args)
     {
-      typedef typename std::remove_const<T>::type Node_t;
-
-      m_node.lock()->get_resource().emplace<T>( std::forward<_Args>(__args)...);
+      m_node->emplace( std::forward<_Args>(__args)...);
     }
 
     /**
@@ -365,13 +893,13 @@ public:
      */
     void set(T const & x, bool make_avail=true)
     {
-        m_node.lock()->get_resource() = x;
+        m_node->set(x);
         if( make_avail) make_available();
     }
 
     void set(T && x, bool make_avail=true)
     {
-        m_node.lock()->get_resource() = std::move(x);
+        m_node->set( std::move(x) );
         if( make_avail) make_available();
     }
 
@@ -403,42 +931,350 @@ public:
     {
         return get();
     }
+
+protected:
+    void publish(bool changed)
+    {
+        auto node = m_node;
+        if( node && !node->is_available() )
+        {
+            node->set_changed(changed);
+            if( node->make_available() ) // only the first call notifies the dependents
+            {
+                //std::cout << node->get_name() << " is available" << std::endl;
+                node->notify_dependents();
+            }
+        }
+    }
+};
+
+
+
+
+/**
+ * @brief The resource_table class
+ *
+ * Interns resource names into dense resource_ids. The name is hashed once
+ * when a resource is registered; after that the resource is found by
+ * indexing a vector with its id.
+ */
+class resource_table
+{
+public:
+    /**
+     * @brief intern
+     * @param name
+     * @return
+     *
+     * Returns the id of the named resource, and true if the id has no
+     * resource_node yet: the name is new, or its resource was dropped (see
+     * node_graph::remove_node()). set() must then be called for the id.
+     */
+    std::pair<resource_id, bool> intern(std::string const & name)
+    {
+        index_names();
+        auto it = m_ids.try_emplace( name, static_cast<resource_id>(m_nodes.size()) );
+        if( it.second )
+        {
+            m_nodes.push_back(nullptr);
+            m_indexed = m_nodes.size();
+        }
+        return { it.first->second, m_nodes[it.first->second] == nullptr };
+    }
+
+    /**
+     * @brief add_unindexed
+     * @param count
+     *
+     * Adds count ids without names and returns the first one. Used when
+     * the ids of the resources are already known (see graph_serializer and
+     * graph_template), set() must be called for each of them. The names are
+     * indexed the first time the table is searched.
+     */
+    resource_id add_unindexed(size_t count)
+    {
+        auto first = static_cast<resource_id>(m_nodes.size());
+        m_nodes.resize(m_nodes.size() + count, nullptr);
+        return first;
+    }
+
+    /**
+     * @brief find
+     * @param name
+     * @return
+     *
+     * Returns the id of the named resource or invalid_resource_id.
+     */
+    resource_id find(std::string const & name) const
+    {
+        index_names();
+        auto it = m_ids.find(name);
+        return it == m_ids.end() ? invalid_resource_id : it->second;
+    }
+
+    resource_id at(std::string const & name) const
+    {
+        index_names();
+        return m_ids.at(name);
+    }
+
+    void set(resource_id id, resource_node_p R)
+    {
+        m_nodes[id] = R;
+        if( R && id < m_indexed )
+            m_ids.try_emplace( R->get_name(), id ); // an unindexed id which was skipped while it was empty
+    }
+
+    resource_node_p operator[](resource_id id) const
+    {
+        return m_nodes[id];
+    }
+
+    size_t size() const
+    {
+        return m_nodes.size();
+    }
+
+    std::vector<resource_node_p>::const_iterator begin() const { return m_nodes.begin(); }
+    std::vector<resource_node_p>::const_iterator end()   const { return m_nodes.end(); }
+
+protected:
+    void index_names() const
+    {
+        for(; m_indexed < m_nodes.size(); ++m_indexed)
+        {
+            if( m_nodes[m_indexed] )
+                m_ids.try_emplace( m_nodes[m_indexed]->get_name(), static_cast<resource_id>(m_indexed) );
+        }
+    }
+
+    mutable std::unordered_map<std::string, resource_id> m_ids;
+    std::vector<resource_node_p>                 m_nodes;
+    mutable size_t                               m_indexed = 0; // ids below this one are in m_ids
+};
+
+/**
+ * @brief The registration_scope struct
+ *
+ * Decides which resource a registration refers to while a node is being
+ * added, instead of looking the name up in the graph's resource_table.
+ * Set by graph_template and graph_serializer.
+ */
+struct registration_scope
+{
+    virtual ~registration_scope() = default;
+
+    /**
+     * Returns the id of the resource the node registers as name, and true
+     * if the resource has not been created yet.
+     */
+    virtual std::pair<resource_id, bool> resolve(resource_table & T, std::string const & name) = 0;
+
+    /**
+     * Returns the name given to a new resource, or stream, which the node
+     * registered as name. id is the resolved id, or invalid_resource_id
+     * for a stream.
+     */
+    virtual std::string full_name(std::string const & name, resource_id id = invalid_resource_id) const = 0;
 };
 
+/**
+ * @brief The template_scope struct
+ *
+ * Used by graph_template while it adds the nodes of one instance. Resource
+ * names are given the instance's prefix, except names which start with '/',
+ * those refer to a resource shared by all the instances (the '/' is not part
+ * of the name). The first instance records which resource each registration
+ * resolved to. Later instances replay the record: their resources take a
+ * block of consecutive ids, starting at first_local, and the shared ones
+ * are looked up once before the nodes are added, so no registration is
+ * resolved by name.
+ */
+struct template_scope : registration_scope
+{
+    struct entry
+    {
+        std::string name;  // name as passed to the registry
+        uint32_t    local; // index of the instance's resource, or invalid_resource_id for a shared resource
+        uint32_t    shared = invalid_resource_id; // index of the shared resource
+    };
+
+    std::string                               prefix;
+    std::vector<entry>                      * script = nullptr;
+    bool                                      replay = false;
+    size_t                                    pos    = 0;    // next entry to replay
+    resource_id                               first_local = 0; // id of the instance's first resource, when replaying
+    std::vector<resource_id>                  local_ids;     // the instance's resources, by local index, while recording
+    std::vector<resource_id>                  shared_ids;    // the shared resources, by shared index
+    std::unordered_map<std::string, uint32_t> local_slots;   // name -> local index, only used while recording
+    std::unordered_map<std::string, uint32_t> shared_slots;  // name -> shared index, only used while recording
+
+    static bool is_shared(std::string const & name)
+    {
+        return !name.empty() && name[0] == '/';
+    }
+
+    std::string full_name(std::string const & name, resource_id = invalid_resource_id) const override
+    {
+        return is_shared(name) ? name.substr(1) : prefix + name;
+    }
+
+    /**
+     * Looks up the shared resources of the record, before an instance is
+     * replayed.
+     */
+    void intern_shared(resource_table & T, size_t num_shared)
+    {
+        shared_ids.assign(num_shared, invalid_resource_id);
+        for(auto & e : *script)
+        {
+            if( e.local == invalid_resource_id && shared_ids[e.shared] == invalid_resource_id )
+                shared_ids[e.shared] = T.intern( full_name(e.name) ).first;
+        }
+    }
+
+    std::pair<resource_id, bool> resolve(resource_table & T, std::string const & name) override
+    {
+        if( replay )
+        {
+            if( pos >= script->size() )
+                throw std::runtime_error( std::string("Resource ") + name + std::string(" was not registered when the template was recorded") );
+
+            // a different resource would be given the id of the recorded one
+            auto & e = (*script)[pos++];
+            if( e.name != name )
+                throw std::runtime_error( std::string("Resource ") + name + std::string(" was not registered in the same order when the template was recorded") );
+            auto id = e.local == invalid_resource_id ? shared_ids[e.shared] : first_local + e.local;
+            return { id, T[id] == nullptr };
+        }
+
+        if( is_shared(name) )
+        {
+            auto slot = shared_slots.try_emplace( name, static_cast<uint32_t>(shared_slots.size()) );
+            script->push_back( entry{name, invalid_resource_id, slot.first->second} );
+            return T.intern( full_name(name) );
+        }
+
+        auto slot = local_slots.try_emplace( name, static_cast<uint32_t>(local_slots.size()) );
+        script->push_back( entry{name, slot.first->second} );
+        auto r = T.intern( full_name(name) );
+        if( slot.second )
+            local_ids.push_back(r.first);
+        return r;
+    }
+};
 
+/**
+ * @brief The template_plan struct
+ *
+ * The part of the compiled plan which is the same for every instance of a
+ * graph_template: the nodes of the instance which read each of its own
+ * resources. Node and resource indices are relative to the instance, see
+ * node_graph::add_instance().
+ */
+struct template_plan
+{
+    std::vector<uint32_t> succ_offsets; // local resource -> first entry in succ
+    std::vector<uint32_t> succ;         // local index of the nodes which read the resource
 
+    size_t num_local() const
+    {
+        return succ_offsets.empty() ? 0 : succ_offsets.size() - 1;
+    }
+};
 
 class ResourceRegistry
 {
-    std::map<std::string, resource_node_p> & m_resources;
-    std::vector<resource_node_w> & m_required_resources;
-    exec_node_p & m_Node;
+    resource_table & m_resources;
+    std::vector<resource_node*> & m_required_resources;
+    exec_node_p m_Node;
+    node_arena & m_arena;
+    registration_scope * m_scope;
+
+    std::pair<resource_id, bool> intern(std::string const & name)
+    {
+        return m_scope ? m_scope->resolve(m_resources, name) : m_resources.intern(name);
+    }
+
+    std::string resource_name(std::string const & name, resource_id id = invalid_resource_id) const
+    {
+        return m_scope ? m_scope->full_name(name, id) : name;
+    }
 
     public:
-        ResourceRegistry( exec_node_p & node,
-                          std::map<std::string, resource_node_p> & m,
-                          std::vector<resource_node_w> & required_resources) :
-            m_Node(node),
+        /**
+         * @brief get_graph
+         * @return
+         *
+         * Returns the graph the node is being added to. Nodes can keep the
+         * pointer to call node_graph::parallel_for() from their body.
+         */
+        node_graph * get_graph() const
+        {
+            return m_Node->m_Graph;
+        }
+
+        ResourceRegistry( exec_node_p node,
+                          resource_table & m,
+                          node_arena & arena,
+                          registration_scope * scope = nullptr) :
             m_resources(m),
-            m_required_resources(required_resources)
+            m_required_resources(node->m_requiredResources),
+            m_Node(node),
+            m_arena(arena),
+            m_scope(scope)
+        {
+
+        }
+
+        /**
+         * @brief check_resource
+         *
+         * Makes sure a previously registered resource has the same flags
+         * and type as the one being registered.
+         */
+        template<typename T, resource_flags F>
+        static typed_resource_node<T> * check_resource(resource_node_p RN)
         {
+            if( RN->m_flags != F)
+            {
+                throw std::runtime_error(std::string("Resource ") + RN->get_name() + std::string(" previously registered as different type") );
+            }
+            if( *RN->m_type != typeid(T) )
+            {
+                throw std::runtime_error(std::string("Resource ") + RN->get_name() + std::string(" previously registered with type ") + RN->m_type->name() );
+            }
+            return static_cast< typed_resource_node<T>* >( RN );
+        }
 
+        template<typename T>
+        typed_resource_node<T> * create_resource()
+        {
+            auto RN = m_arena.create< typed_resource_node<T> >();
+            RN->m_storage_size  = sizeof( typed_resource_node<T> );
+            RN->m_storage_align = alignof( typed_resource_node<T> );
+            return RN;
         }
 
         template<typename T, resource_flags F=resource_flags::resetable>
         out_resource<T> register_output_resource(const std::string & name)
         {
-            if( m_resources.count(name) == 0 )
+            auto id = intern(name);
+            m_Node->m_registrations.push_back(id.first);
+            if( id.second )
             {
-                resource_node_p RN = std::make_shared< resource_node >();
+                auto RN = create_resource<T>();
 
-                RN->m_name     = name;
+                RN->m_index    = id.first;
+                RN->m_name     = resource_name(name, id.first);
                 RN->m_flags    = F;
+                RN->m_Graph    = m_Node->m_Graph;
 
                 RN->m_parent = m_Node;
+                ++RN->m_num_producers;
 
                 m_Node->m_producedResources.push_back(RN);
-                m_resources[name] = RN;
+                m_resources.set(id.first, RN);
 
                 out_resource<T> r;
                 r.m_node = RN;
@@ -449,56 +1285,271 @@ class ResourceRegistry
             {
                 out_resource<T> r;
 
+                auto RN = m_resources[id.first];
+                r.m_node = check_resource<T,F>(RN);
 
-                r.m_node = m_resources.at(name);
-                if(r.m_node.lock()->m_flags != F)
-                {
-                    throw std::runtime_error(std::string("Resource ") + name + std::string(" previously registered as different type") );
-                }
-                m_Node->m_producedResources.push_back( r.m_node);
+                if( !RN->has_parent() )
+                    RN->m_parent = m_Node;
+                ++RN->m_num_producers;
+                m_Node->m_producedResources.push_back(RN);
 
                 return r;
             }
         }
 
+        /**
+         * Moveable resources are returned as in_resource<T, moveable>, which
+         * can take() the value. All other flags return a plain in_resource<T>.
+         */
+        template<typename T, resource_flags F>
+        using in_resource_t = in_resource<T, F == resource_flags::moveable ? resource_flags::moveable : resource_flags::resetable>;
+
         template<typename T, resource_flags F=resource_flags::resetable>
-        in_resource<T> register_input_resource(const std::string & name)
+        in_resource_t<T,F> register_input_resource(const std::string & name)
         {
-            if( m_resources.count(name) == 0 )
+            auto id = intern(name);
+            m_Node->m_registrations.push_back(id.first);
+            if( id.second )
             {
-                resource_node_p RN = std::make_shared<resource_node>();
+                auto RN = create_resource<T>();
 
                 RN->m_Nodes.push_back(m_Node);
-                RN->m_name = name;
+                RN->m_index = id.first;
+                RN->m_name = resource_name(name, id.first);
                 RN->m_flags = F;
-                m_resources[name] = RN;
+                RN->m_Graph = m_Node->m_Graph;
+                m_resources.set(id.first, RN);
 
-                in_resource<T> r;
+                in_resource_t<T,F> r;
                 r.m_node = RN;
 
                 m_required_resources.push_back(RN);
+                if( F == resource_flags::moveable )
+                    m_Node->m_moveableInputs.push_back(RN);
 
                 return r;
             }
             else
             {
-                resource_node_p RN = m_resources[name];
-                RN->m_Nodes.push_back(m_Node);
+                resource_node_p RN = m_resources[id.first];
 
-                in_resource<T> r;
-                r.m_node = RN;
-                if(r.m_node.lock()->m_flags != F)
+                in_resource_t<T,F> r;
+                r.m_node = check_resource<T,F>(RN);
+
+                if( F == resource_flags::moveable && !RN->m_Nodes.empty() )
                 {
-                    throw std::runtime_error(std::string("Resource ") + name + std::string(" previously registered as different type") );
+                    throw std::runtime_error(std::string("Resource ") + RN->get_name() + std::string(" is moveable and already has a consumer") );
                 }
 
+                RN->m_Nodes.push_back(m_Node);
                 m_required_resources.push_back(RN);
+                if( F == resource_flags::moveable )
+                    m_Node->m_moveableInputs.push_back(RN);
 
                 return r;
             }
         }
+
+        /**
+         * @brief register_output_stream
+         * @param name
+         * @param capacity - the maximum number of queued items, rounded up to a power of two
+         * @return
+         *
+         * Registers a stream the node pushes items into. A stream may have
+         * several producers, the first one to register sets its capacity.
+         */
+        template<typename T>
+        out_stream<T> register_output_stream(std::string const & name, size_t capacity = 1024)
+        {
+            auto Q = get_stream<T>(name, capacity);
+            stream_base * S = Q;
+            if( S->num_producers() == 0 && S->empty() && S->capacity() != stream_base::round_capacity(capacity) )
+                S->set_capacity(capacity);
+
+            out_stream<T> s;
+            s.m_queue = Q;
+            s.m_slot  = Q->add_producer(m_Node);
+            m_Node->m_streamOutputs.push_back( { Q, s.m_slot } );
+            return s;
+        }
+
+        /**
+         * @brief register_input_stream
+         * @param name
+         * @return
+         *
+         * Registers a stream the node pops items from. If the stream has
+         * several consumers, each item goes to only one of them.
+         */
+        template<typename T>
+        in_stream<T> register_input_stream(std::string const & name)
+        {
+            auto Q = get_stream<T>(name, 1024);
+            Q->add_consumer(m_Node);
+            m_Node->m_streamInputs.push_back(Q);
+
+            in_stream<T> s;
+            s.m_queue = Q;
+            return s;
+        }
+
+    protected:
+        stream_base * find_stream(std::string const & name) const;
+        stream_base * add_stream(std::unique_ptr<stream_base> S);
+
+        template<typename T>
+        stream_queue<T> * get_stream(std::string const & name, size_t capacity)
+        {
+            auto full = resource_name(name);
+            auto S    = find_stream(full);
+            if( !S )
+                S = add_stream( std::make_unique< stream_queue<T> >(full, capacity) );
+
+            auto Q = dynamic_cast< stream_queue<T>* >(S);
+            if( !Q )
+                throw std::runtime_error( std::string("Stream ") + full + std::string(" previously registered with type ") + S->get_type().name() );
+            return Q;
+        }
+};
+
+
+/**
+ * @brief The async_handle class
+ *
+ * Passed to nodes whose body is  void operator()(async_handle h). The body
+ * can start some asynchronous work (eg: a read from disk) and return, which
+ * gives the worker back to the executor. When the work is done, any thread
+ * makes the outputs available and calls h.complete(). Until then the node
+ * counts as in flight, so the graph stays busy().
+ */
+class async_handle
+{
+public:
+    async_handle() = default;
+    explicit async_handle(exec_node * node) : m_node(node)
+    {
+    }
+
+    /**
+     * The handle is move-only, so a node is completed by exactly one
+     * handle. Moving leaves the source invalid.
+     */
+    async_handle( async_handle const & other) = delete;
+    async_handle & operator = ( async_handle const & other) = delete;
+
+    async_handle( async_handle && other) noexcept : m_node(other.m_node)
+    {
+        other.m_node = nullptr;
+    }
+
+    async_handle & operator = ( async_handle && other)
+    {
+        if( this != &other )
+        {
+            if( m_node )
+                throw std::logic_error("async_handle: assigned to a handle which has not been completed");
+            m_node = other.m_node;
+            other.m_node = nullptr;
+        }
+        return *this;
+    }
+
+    /**
+     * @brief complete
+     *
+     * Finishes the node. Must be called exactly once, after all the node's
+     * outputs have been made available. Throws std::logic_error if the
+     * handle is not valid: it was already completed or moved from.
+     */
+    void complete();
+
+    bool valid() const
+    {
+        return m_node != nullptr;
+    }
+
+protected:
+    exec_node * m_node = nullptr;
+};
+
+template<typename Node_t>
+struct is_async_node : std::is_invocable<Node_t&, async_handle> {};
+
+/**
+ * @brief The parallel_for_state struct
+ *
+ * Shared between the caller of node_graph::parallel_for() and the helper
+ * tasks it posts. Chunks are claimed with an atomic counter. The helpers
+ * keep the state alive, but only touch the body while they hold a chunk,
+ * which the caller is still waiting on.
+ */
+struct parallel_for_state
+{
+    size_t                  m_begin = 0;
+    size_t                  m_end   = 0;
+    size_t                  m_grain = 1;
+    size_t                  m_count = 0;          // number of chunks
+    std::atomic<size_t>     m_next{0};            // next chunk to claim
+    std::atomic<size_t>     m_remaining{0};       // chunks which have not finished
+    void                  * m_body = nullptr;
+    void                 (* m_call)(void*, size_t, size_t) = nullptr;
+
+    std::mutex              m_lock;               // protects m_error
+    std::condition_variable m_cv;
+    std::exception_ptr      m_error;
+
+    void run_chunks()
+    {
+        for(;;)
+        {
+            auto c = m_next.fetch_add(1, std::memory_order_relaxed);
+            if( c >= m_count )
+                return;
+
+            auto b = m_begin + c * m_grain;
+            auto e = std::min(m_end, b + m_grain);
+            try
+            {
+                m_call(m_body, b, e);
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lk(m_lock);
+                if( !m_error )
+                    m_error = std::current_exception();
+            }
+
+            if( m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+            {
+                std::lock_guard<std::mutex> lk(m_lock);
+                m_cv.notify_all();
+            }
+        }
+    }
 };
 
+/**
+ * @brief The graph_issue struct
+ *
+ * A problem found by node_graph::validate() which would stop some nodes
+ * from ever executing, or make the result depend on timing.
+ */
+struct graph_issue
+{
+    enum class kind
+    {
+        missing_producer,   // a resource is required but no node produces it
+        multiple_producers, // more than one node produces the same resource
+        cycle,              // the nodes depend on each other
+        unreachable,        // the nodes wait on a resource which is never produced
+    };
+
+    kind                     type;
+    std::string              message;
+    std::vector<exec_node*>  nodes;              // the nodes involved
+    resource_node          * resource = nullptr; // the resource involved, if any
+};
 
 class node_graph
 {
@@ -513,14 +1564,17 @@ public:
             return l->m_exec_start_time_us < r->m_exec_start_time_us;
         });
 
-        for(auto & e : m_exec_nodes)
+        while(m_exec_nodes.size())
         {
-            //std::cout << e->get_name() << " use count: " << e.use_count() << "  time: " << e->m_exec_start_time_us.count() << std::endl;
+            m_exec_pool.destroy( m_exec_nodes.back() );
+            m_exec_nodes.pop_back();
         }
 
-        while(m_exec_nodes.size())
+        // resources live in m_node_arena, which does not run destructors
+        for(auto R : m_resources)
         {
-            m_exec_nodes.pop_back();
+            if( R ) // a failed graph_serializer::load() may leave ids without a resource
+                R->~resource_node();
         }
     }
 
@@ -569,318 +1623,2371 @@ public:
     {
       typedef typename std::remove_const<_Tp>::type Node_t;
 
-      exec_node_p N   = std::make_shared<exec_node>();
+      exec_node_p N   = m_exec_pool.create();
 
       N->m_flags = F;
-      ResourceRegistry R(N,  m_resources,  N->m_requiredResources);
+      N->m_Graph = this;
+      N->m_type  = &typeid(Node_t);
+      N->m_id    = m_next_node_id;
+      ResourceRegistry R(N,  m_resources,  m_node_arena, m_scope);
+
+      Node_t * cls = nullptr;
+      try
+      {
+          cls = m_node_arena.create<Node_t>( R, std::forward<_Args>(__args)...);
+      }
+      catch(...)
+      {
+          destroy_node(N);
+          throw;
+      }
+      N->m_NodeClass        = cls;
+      N->m_destroyNodeClass = [](void * p) { static_cast<Node_t*>(p)->~Node_t(); };
+      N->m_class_size       = sizeof(Node_t);
+      N->m_class_align      = alignof(Node_t);
 
-      N->m_NodeClass.emplace<Node_t>( R, std::forward<_Args>(__args)...);
+      if( N->is_stream_node() )
+      {
+          if constexpr( is_async_node<Node_t>::value )
+          {
+              destroy_node(N);
+              throw std::runtime_error("Async nodes can not use streams");
+          }
+          else
+          {
+              N->m_stream_body = [cls]() { (*cls)(); };
+          }
+      }
 
       N->m_name      = typeid( _Tp).name();// "Node_" + std::to_string(global_count++);
-      exec_node* rawp = N.get();
-      rawp->m_Graph  = this;
+      exec_node* rawp = N;
 
       // Create the functor which will execute the
       // Node's operator(data_t &d) method.
-      N->execute = [rawp]()
+      N->execute = [rawp, cls]()
       {
-          if( !rawp->m_executed ) // if we haven't executed yet.
+          // only the thread which flips m_executed gets to execute the node.
+          if( !rawp->m_executed.exchange(true, std::memory_order_acq_rel) )
           {
-
-              if( rawp->m_mutex.try_lock() ) // try to lock the mutex
-              {                              // if we have acquired the lock, execute the node
-
-                  auto graph = rawp->m_Graph;
-                  rawp->m_executed = true;
-                  rawp->m_exec_start_time_us = std::chrono::system_clock::now();
-                  rawp->m_thread_id = std::this_thread::get_id();
-                  //======== Exectue ========================
-                  std::any_cast< Node_t&>( rawp->m_NodeClass )();
-                  //==========================================
-
-                  --rawp->m_Graph->m_numToExecute;
-                  rawp->m_mutex.unlock();
-
-                  for(auto & r : rawp->m_producedResources)
+              auto graph = rawp->m_Graph;
+              ready_scope ready(graph);
+              graph->m_numRunning.fetch_add(1, std::memory_order_relaxed);
+
+              rawp->m_exec_start_time_us = std::chrono::steady_clock::now();
+              rawp->m_thread_id = std::this_thread::get_id();
+              //======== Exectue ========================
+              rawp->m_skipped = graph->m_incremental && rawp->inputs_unchanged();
+              if( rawp->m_skipped )
+              {
+                  // keep the previous outputs
+                  for(auto R : rawp->m_producedResources)
                   {
-                    auto R = r.lock();
-
-                    if( !R->is_available() )
-                    {
-                        throw std::runtime_error( std::string("Node ") + rawp->get_name() + std::string(" failed to create resource: ") + R->get_name());
-                    }
-                  }
-
-                  if( !graph->busy() )
-                  {
-                    if(graph->onFinished)
-                    {
-                        graph->onFinished();
-                    }
+                      R->set_changed(false);
+                      if( R->make_available() )
+                          R->notify_dependents();
                   }
               }
+              else if constexpr( is_async_node<Node_t>::value )
+              {
+                  // the node stays in flight until the handle is completed,
+                  // hold the frame open in case that happens inside the call.
+                  rawp->m_has_run = true;
+                  graph->m_numToExecute.fetch_add(1, std::memory_order_relaxed);
+                  graph->m_numSuspended.fetch_add(1, std::memory_order_relaxed);
+                  (*cls)( async_handle(rawp) );
+                  graph->m_numRunning.fetch_sub(1, std::memory_order_relaxed);
+                  auto next = ready.publish(rawp);
+                  graph->node_finished();
+                  if( next )
+                      graph->run_kept(next);
+                  return;
+              }
+              else
+              {
+                  (*cls)();
+                  rawp->m_has_run = true;
+              }
+              //==========================================
+              graph->m_numRunning.fetch_sub(1, std::memory_order_relaxed);
+              auto next = ready.publish(rawp);
+              graph->finish_node(rawp);
+              if( next )
+                  graph->run_kept(next);
           }
       };
 
       if( F == node_flags::execute_once)
       {
-          for( auto & r : N->m_producedResources)
+          for( auto R : N->m_producedResources)
           {
-              auto R = r.lock();
               if( R->get_flags() != resource_flags::permanent )
               {
-
+                destroy_node(N);
                 throw std::runtime_error( std::string("Node, set as ExecuteOnce, but produces resettable resource, ") + R->get_name() + std::string(". Nodes set as ExecuteOnce may only produce permenant resources.") );
               }
           }
       }
 
-      //std::any_cast< Node_t&>(N->m_NodeClass).registerResources( std::any_cast< Data_t&>( rawp->m_NodeData ), R);
-
+      N->m_pos = static_cast<uint32_t>(m_exec_nodes.size());
       m_exec_nodes.push_back(N);
+      ++m_next_node_id;
+      if( N->is_stream_node() )
+      {
+          m_compiled = false; // the streams are set up from the plan, it must be rebuilt
+      }
+      else if( !m_defer_plan ) // graph_template adds the instance to the plan in one go
+      {
+          // patch the plan and the roots instead of rebuilding them
+          if( m_compiled )
+              plan_add(N);
+          if( !m_roots_dirty )
+              add_root(N);
+      }
 
       return *N;
     }
 
     /**
-     * @brief schedule_node
-     * @param p
+     * @brief remove_node
+     * @param N
      *
-     * Schedules this node for execution.
+     * Removes a node from the graph and destroys it. Only the entries of the
+     * node in the compiled plan and in the list of roots are patched. Nodes
+     * which wait on a resource which was produced by N will no longer
+     * execute, unless another producer is added.
+     *
+     * The storage of the node is reused by the next node of the same class,
+     * and a resource which no other node produces or consumes is destroyed
+     * (permanent resources which hold a value are kept), so adding and
+     * removing nodes does not grow the graph. Pointers to a destroyed
+     * resource must not be used, look it up again after adding its nodes
+     * back. Resource names stay interned, a node which registers the name
+     * again gets the same id.
+     *
+     * Must be called between frames.
      */
-    void schedule_node( exec_node * p)
+    void remove_node(exec_node & N)
     {
-        ++m_numToExecute;
-        if(onSchedule)
-            onSchedule(p);
+        if( N.m_Graph != this )
+            throw std::runtime_error("remove_node(): the node does not belong to this graph");
+        if( busy() )
+            throw std::runtime_error("remove_node(): nodes can only be removed between frames");
+
+        auto p = &N;
+        unlink_node(p);
+
+        auto i = p->m_pos;
+        m_exec_nodes[i] = m_exec_nodes.back();
+        m_exec_nodes[i]->m_pos = i;
+        m_exec_nodes.pop_back();
+        destroy_node(p);
     }
 
     /**
-     * @brief Reset
-     * @param destroy_resources - destroys all the resources as well. Default is false.
+     * @brief compile
+     *
+     * Freezes the current topology into contiguous arrays: every exec_node
+     * and resource_node is given an index, the dependents of each resource
+     * are stored as a CSR list and each exec_node gets an atomic counter of
+     * the inputs it is still waiting on. Once compiled, making a resource
+     * available only decrements the counters of its dependents and schedules
+     * the nodes whose counter reaches zero.
+     *
+     * Nodes added or removed afterwards are patched into the plan; their
+     * dependents are kept in short per-resource lists next to the CSR
+     * lists, and removed nodes leave an empty slot. reset() rebuilds the
+     * plan once enough of it has been patched. Adding a stream node
+     * invalidates the plan; call compile() again afterwards.
      */
-    void reset(bool destroy_resources = false)
+    void compile()
     {
-        //std::cout << "size: " << m_exec_nodes.size() << std::endl;
-        m_exec_nodes.erase(std::remove_if(m_exec_nodes.begin(),
-                                  m_exec_nodes.end(),
-                                  [](exec_node_p & x)
-                                  {
+        compile_plan(true);
+    }
 
-                                      if(x->get_flags() == node_flags::execute_once && x->m_executed)
-                                      {
-                                          x->m_executed  = false;
-                                          x->m_scheduled = false;
-                                          x.reset();
-                                          return true;
-                                      }
-                                      x->m_executed  = false;
-                                      x->m_scheduled = false;
-                                      return false;
-                                  }),
-                   m_exec_nodes.end());
-//        std::cout << "size: " << m_exec_nodes.size() << std::endl;
+    /**
+     * @brief validate
+     * @return
+     *
+     * Checks the topology of the graph and returns every problem found:
+     * resources which are required but never produced, resources with more
+     * than one producer, cycles, and nodes which can never execute because
+     * they wait, directly or through other nodes, on a resource which is
+     * never produced. Permanent resources which are already available do
+     * not need a producer. Stream nodes are not checked.
+     *
+     * compile() calls this and throws if anything is found, unless
+     * validation has been turned off with set_validation(false).
+     */
+    std::vector<graph_issue> validate()
+    {
+        std::vector<graph_issue> issues;
+        auto n = m_exec_nodes.size();
+        for(size_t i=0; i < n; ++i)
+            m_exec_nodes[i]->m_index = static_cast<uint32_t>(i);
 
-        for(auto & N : m_resources)
+        std::vector< std::vector<exec_node*> > producers( m_resources.size() );
+        for(auto E : m_exec_nodes)
         {
-            if( N.second->get_flags() != resource_flags::permanent)
+            if( E->is_stream_node() )
+                continue;
+            for(auto R : E->m_producedResources)
             {
-                N.second->make_available(false);
+                auto & p = producers[R->m_index];
+                if( std::find(p.begin(), p.end(), E) == p.end() )
+                    p.push_back(E);
             }
         }
-    }
 
+        auto names = [](std::vector<exec_node*> const & nodes)
+        {
+            std::string s;
+            for(size_t i=0; i < nodes.size() && i < 8; ++i)
+                s += (i ? ", " : "") + nodes[i]->get_name();
+            if( nodes.size() > 8 )
+                s += ", ... (" + std::to_string(nodes.size()) + " nodes)";
+            return s;
+        };
 
-    resource_node_p  get_resources(std::string const & name)
-    {
-        return m_resources.at(name);
-    }
+        for(auto R : m_resources)
+        {
+            if( !R )
+                continue;
+            auto & p = producers[R->m_index];
+            if( p.empty() && !R->m_Nodes.empty() && !R->is_available() )
+            {
+                issues.push_back( { graph_issue::kind::missing_producer,
+                                    "Resource " + R->get_name() + " is required by " + names(R->m_Nodes) + " but no node produces it",
+                                    R->m_Nodes, R } );
+            }
+            if( p.size() > 1 )
+            {
+                issues.push_back( { graph_issue::kind::multiple_producers,
+                                    "Resource " + R->get_name() + " is produced by " + names(p),
+                                    p, R } );
+            }
+        }
 
-    void print_info()
-    {
-        std::cout << "Num Nodes: " << m_exec_nodes.size() << std::endl;
-        std::cout << "Num Resources: " << m_resources.size() << std::endl;
-        std::cout << "Num Running: " << m_numRunning << std::endl;
-        std::cout << "Num To Executing: " << m_numToExecute << std::endl;
-    }
+        // execute the graph symbolically, a node runs once all its inputs
+        // are available or have been produced.
+        std::vector<uint32_t> pending(n, 0);
+        std::vector<char>     produced( m_resources.size(), 0 );
+        std::vector<char>     reached(n, 0);
+        std::vector<uint32_t> ready;
+        for(size_t i=0; i < n; ++i)
+        {
+            auto E = m_exec_nodes[i];
+            for(auto R : E->m_requiredResources)
+                pending[i] += R->is_available() ? 0 : 1;
+            if( pending[i] == 0 && !E->is_stream_node() )
+                ready.push_back( static_cast<uint32_t>(i) );
+        }
+        while( !ready.empty() )
+        {
+            auto i = ready.back();
+            ready.pop_back();
+            reached[i] = 1;
+            for(auto R : m_exec_nodes[i]->m_producedResources)
+            {
+                if( produced[R->m_index] || R->is_available() )
+                    continue;
+                produced[R->m_index] = 1;
+                for(auto C : R->m_Nodes)
+                {
+                    auto c = C->m_index;
+                    if( --pending[c] == 0 && !C->is_stream_node() )
+                        ready.push_back(c);
+                }
+            }
+        }
 
+        // of the nodes which never ran, peel off those which only wait on
+        // something upstream and those which only feed something downstream,
+        // what is left is on a cycle.
+        std::vector<char> stuck(n, 0);
+        for(size_t i=0; i < n; ++i)
+            stuck[i] = !reached[i] && !m_exec_nodes[i]->is_stream_node();
 
-    void print_node_resource_order(exec_node_p & e)
-    {
-        for(auto & r : e->m_requiredResources)
+        auto peel = [&](bool upstream)
+        {
+            bool changed = true;
+            std::vector<char> on_cycle = stuck;
+            while( changed )
+            {
+                changed = false;
+                for(size_t i=0; i < n; ++i)
+                {
+                    if( !on_cycle[i] )
+                        continue;
+                    bool linked = false;
+                    auto E = m_exec_nodes[i];
+                    if( upstream )
+                    {
+                        for(auto R : E->m_requiredResources)
+                            for(auto P : producers[R->m_index])
+                                linked = linked || on_cycle[P->m_index];
+                    }
+                    else
+                    {
+                        for(auto R : E->m_producedResources)
+                            for(auto C : R->m_Nodes)
+                                linked = linked || on_cycle[C->m_index];
+                    }
+                    if( !linked )
+                    {
+                        on_cycle[i] = 0;
+                        changed = true;
+                    }
+                }
+            }
+            return on_cycle;
+        };
+        auto a = peel(true);
+        auto b = peel(false);
+
+        std::vector<exec_node*> cycle, unreachable;
+        for(size_t i=0; i < n; ++i)
         {
-            std::cout << r.lock()->get_name() << " -> " << e->get_name() << std::endl;
+            if( a[i] && b[i] )
+                cycle.push_back(m_exec_nodes[i]);
+            else if( stuck[i] )
+                unreachable.push_back(m_exec_nodes[i]);
         }
-        for(auto & r : e->m_producedResources)
+        if( !cycle.empty() )
         {
-            std::cout << e->get_name() << " -> " << r.lock()->get_name() << std::endl;
+            issues.push_back( { graph_issue::kind::cycle,
+                                "Nodes " + names(cycle) + " depend on each other",
+                                cycle, nullptr } );
         }
-        if( e->m_producedResources.size()==0) return;
+        if( !unreachable.empty() )
+        {
+            issues.push_back( { graph_issue::kind::unreachable,
+                                "Nodes " + names(unreachable) + " can never execute",
+                                unreachable, nullptr } );
+        }
+        if( m_compiled )
+        {
+            // the plan still refers to the nodes by their old indices
+            for(size_t i=0; i < m_plan.nodes.size(); ++i)
+                if( m_plan.nodes[i] )
+                    m_plan.nodes[i]->m_index = static_cast<uint32_t>(i);
+        }
+        return issues;
+    }
 
-        //std::cout << e->m_name <<( e->m_producedResources.size()==0?"\n":" -> ");
+    /**
+     * @brief set_validation
+     * @param enable
+     *
+     * Turns the validation done by compile() on or off. Turn it off for
+     * graphs whose resources are made available from outside the graph.
+     */
+    void set_validation(bool enable)
+    {
+        m_validate = enable;
+    }
 
+    bool is_validation_enabled() const
+    {
+        return m_validate;
     }
 
-    void print_node(resource_node_p & N, time_point start)
+    /**
+     * @brief set_deferred_notify
+     * @param enable
+     *
+     * By default a node which becomes ready is scheduled as soon as its last
+     * input is set, while the producer is still running, and every one of
+     * them wakes up a thread. With deferral on, the nodes which become ready
+     * while a node runs are collected until its body returns. The most
+     * critical one which may run on any thread is then executed by the same
+     * thread, with the producer's outputs still in its cache, and the others
+     * are scheduled as a single batch.
+     *
+     * pipelined_executor turns it off, since every node it executes has to
+     * wait for the same node of the previous frame.
+     */
+    void set_deferred_notify(bool enable)
     {
-        std::cout << "{\n";
-        std::cout << "    rank=same \n";
-        std::cout << "    " << N->get_name() << "[shape=circle style=filled  color=\"0.650 0.700 0.700\"]\n";
-        if(N->get_time(start).count() != 0) std::cout << "    " << N->get_time(start).count() << "\n";
-        std::cout << "}" << std::endl;;
+        m_defer_notify = enable;
     }
 
-    void print_node(exec_node_p & N, time_point start)
+    bool is_deferred_notify() const
     {
-        std::cout << "{\n";
-        std::cout << "    rank=same \n";
-        std::cout << "    " << N->get_name() << "[shape=square]\n";
-        if(N->get_time(start).count() != 0) std::cout << "    " << N->get_time(start).count() << "\n";
-        std::cout << "}" << std::endl;;
+        return m_defer_notify;
     }
 
     /**
-     * @brief print
+     * @brief set_release_transients
+     * @param enable
      *
-     * Prints the graph in dot format.
+     * Destroys the value of a resetable resource as soon as every node which
+     * reads it has finished, instead of keeping it until reset(), so the
+     * memory of early intermediates can be reused by later ones and the peak
+     * is the largest set alive at once rather than the sum of them. The
+     * values of resources nobody reads, the results of the frame, are kept.
+     *
+     * Takes effect at the next compile(). Cannot be combined with
+     * incremental mode, which needs the previous values.
      */
-    void print()
+    void set_release_transients(bool enable)
     {
+        if( enable && m_incremental )
+            throw std::runtime_error("Transient resources cannot be released in incremental mode");
+        m_release_transients = enable;
+    }
 
-        std::map<std::thread::id, int> threadProps;
-        std::map<time_point, int> nodes;
-
-        auto min = m_exec_nodes[0]->get_time();
-        for(auto & E : m_exec_nodes)
-        {
-            auto t = E->get_time();
-            min = std::min(min, t);
-            nodes[t]=0;
-        }
-        for(auto & E : m_resources)
-        {
+    bool is_release_transients() const
+    {
+        return m_release_transients;
+    }
 
-            auto t = E.second->get_time();
-            if(E.second->get_flags() != resource_flags::permanent)
-            {
-                min    = std::min(min, t);
-            }
-            nodes[t]=0;
+    /**
+     * @brief set_fusion
+     * @param enable
+     * @param max_cost_us - nodes up to this cost are fused even if their predecessor has other successors
+     *
+     * Every scheduled node costs a hand-off to the executor, which can be
+     * more than the body of a small node. With fusion on, compile() fuses a
+     * node to its predecessor if it only waits on that one node, runs in the
+     * same domain, and is either the only successor of the predecessor, ie:
+     * a link of a chain, or costs at most max_cost_us. The cost is the cost
+     * hint, or the duration measured in the last frame (see compute_ranks()).
+     *
+     * A fused node is not handed to the executor, the thread which makes it
+     * ready runs it once the current node has finished, so a chain runs back
+     * to back on one thread. Each node still executes, and is profiled, on
+     * its own and the resources behave as before.
+     */
+    void set_fusion(bool enable, double max_cost_us = 5.0)
+    {
+        m_fuse      = enable;
+        m_fuse_cost = max_cost_us;
+        if( m_compiled )
+            compute_fusion();
+    }
 
+    bool is_fusion_enabled() const
+    {
+        return m_fuse;
+    }
 
+    /**
+     * @brief get_domain
+     * @param name
+     * @return
+     *
+     * Returns the id of the named execution domain, adding it if it does not
+     * exist yet. Executors start the dedicated threads of new domains in
+     * execute(), so name the domains before executing the graph.
+     */
+    uint32_t get_domain(std::string const & name)
+    {
+        for(size_t i=0; i < m_domains.size(); ++i)
+        {
+            if( m_domains[i] == name )
+                return exec_domain::first_named + static_cast<uint32_t>(i);
         }
+        m_domains.push_back(name);
+        return exec_domain::first_named + static_cast<uint32_t>(m_domains.size() - 1);
+    }
 
-        std::cout << "digraph G {" << std::endl;
-
-        auto s = nodes.size();
-        for(auto & E : nodes)
-        {
-            auto t = std::chrono::duration_cast<std::chrono::microseconds>(E.first - min).count();
-            std::cout << t << (s==1? "\n":" -> ") ;
-            s--;
-        };
+    /**
+     * @brief get_num_domains
+     * @return
+     *
+     * Returns one past the largest domain id, including any and main.
+     */
+    uint32_t get_num_domains() const
+    {
+        return exec_domain::first_named + static_cast<uint32_t>(m_domains.size());
+    }
 
+    std::string const & get_domain_name(uint32_t domain) const
+    {
+        return m_domains.at(domain - exec_domain::first_named);
+    }
 
-        for(auto & E : m_exec_nodes)
-        {
-            print_node(E,min);
-        }
-        for(auto & E : m_resources)
+    /**
+     * @brief compute_ranks
+     *
+     * Recomputes the critical-path rank of every node. The cost of a node is
+     * its cost hint if one was set, otherwise the duration it took the last
+     * time it executed, otherwise 1. compile() calls this, call it again
+     * after executing a frame to rank the nodes by their measured durations.
+     *
+     * The root nodes and the dependents of each resource are ordered by rank
+     * so that the executors dispatch the longest chains first.
+     */
+    void compute_ranks()
+    {
+        if( m_compiled && m_plan.num_patched != 0 )
         {
-            print_node(E.second,min);
+            // the plan no longer matches m_exec_nodes, rebuilding it ranks the nodes as well
+            build_plan();
+            return;
         }
-
-        for(auto & E : m_exec_nodes)
+        for(size_t i=0; i < m_exec_nodes.size(); ++i)
+            m_exec_nodes[i]->m_index = static_cast<uint32_t>(i);
+        update_ranks();
+        if( m_compiled )
         {
-            print_node_resource_order(E);
+            sort_successors();
+            compute_fusion();
         }
-
-
-        std::cout << "}" << std::endl;
     }
 
-    std::vector< exec_node_p > & get_exec_nodes()
+    /**
+     * @brief is_compiled
+     * @return
+     *
+     * Returns true if the graph has an up to date compiled plan.
+     */
+    bool is_compiled() const
     {
-        return m_exec_nodes;
+        return m_compiled;
     }
 
-
-    uint32_t get_num_running() const
+    /**
+     * @brief schedule_node
+     * @param p
+     *
+     * Schedules this node for execution.
+     */
+    void schedule_node( exec_node * p)
     {
-        return m_numRunning;
+        if( m_defer_notify || p->m_fused )
+        {
+            auto & D = deferred_ready::local();
+            if( D.collecting == this )
+            {
+                D.nodes.push_back(p);
+                return;
+            }
+        }
+        m_numToExecute.fetch_add(1, std::memory_order_relaxed);
+        if( is_timed() )
+            p->m_sched_time = std::chrono::steady_clock::now();
+        if(onSchedule)
+            onSchedule(p);
     }
 
-    uint32_t get_left_to_execute() const
+    /**
+     * @brief schedule_nodes
+     * @param nodes
+     * @param count
+     *
+     * Schedules a batch of nodes which have already been marked as scheduled.
+     * If an onScheduleBatch hook is set, the whole batch is handed to it in
+     * one call, otherwise each node is passed to onSchedule.
+     */
+    void schedule_nodes(exec_node * const * nodes, size_t count)
     {
-        return m_numToExecute;
+        if( count == 0 )
+            return;
+        m_numToExecute.fetch_add( static_cast<uint32_t>(count), std::memory_order_relaxed);
+        if( is_timed() )
+        {
+            auto t = std::chrono::steady_clock::now();
+            for(size_t i=0; i < count; ++i)
+                nodes[i]->m_sched_time = t;
+        }
+        if( onScheduleBatch )
+        {
+            onScheduleBatch(nodes, count);
+        }
+        else if( onSchedule )
+        {
+            for(size_t i=0; i < count; ++i)
+                onSchedule(nodes[i]);
+        }
     }
 
     /**
-     * @brief busy
+     * @brief get_root_nodes
      * @return
      *
-     * Returns true if the graph is busy. Ie; There are nodes running
+     * Returns the nodes which can execute at the start of a frame, ie: nodes
+     * whose inputs are all permanent resources which are already available.
+     * The list is cached, and only rebuilt when nodes are added, when reset()
+     * removes one-shot nodes, or while some permanent resources are still
+     * unavailable.
      */
-    bool busy() const
+    std::vector<exec_node*> const & get_root_nodes()
     {
-        return m_numRunning!=0 || m_numToExecute!=0;
+        if( m_roots_dirty )
+            update_roots();
+        return m_roots;
     }
 
-    void setOnSchedule( std::function<void(exec_node*)> f)
-    {
-        onSchedule = f;
-    }
-    void clearOnSchedule()
+    /**
+     * @brief schedule_roots
+     *
+     * Schedules all the root nodes as a single batch. This is what the
+     * executors call from execute().
+     */
+    void schedule_roots()
     {
-        onSchedule = std::function<void(exec_node*)>();
+        auto & roots = get_root_nodes();
+
+        begin_execute();
+        m_batch.clear();
+        for(auto N : roots)
+        {
+            bool expected = false;
+            if( N->m_scheduled.compare_exchange_strong(expected, true, std::memory_order_acq_rel) )
+                m_batch.push_back(N);
+        }
+        schedule_nodes(m_batch.data(), m_batch.size());
+        end_execute();
     }
 
-    void setOnComplete( std::function<void(void)> f)
+    /**
+     * @brief begin_execute
+     *
+     * Called by the executors before they schedule the root nodes. Holds the
+     * frame open so that a root which finishes before the remaining roots are
+     * scheduled does not signal completion.
+     */
+    void begin_execute()
     {
-        onFinished = f;
+#if GRAPHE_METRICS
+        if( m_metrics )
+            m_frame_start = std::chrono::steady_clock::now();
+#endif
+        m_numToExecute.fetch_add(1, std::memory_order_relaxed);
     }
-    void clearOnComplete()
+
+    /**
+     * @brief end_execute
+     *
+     * Called by the executors once all the root nodes are scheduled.
+     */
+    void end_execute()
     {
-        onFinished = std::function<void(void)> ();
+        node_finished();
     }
-protected:
 
-    std::vector< exec_node_p >             m_exec_nodes;
-    std::map<std::string, resource_node_p> m_resources;
+    /**
+     * @brief parallel_for
+     * @param begin
+     * @param end
+     * @param grain - number of indices in each chunk
+     * @param body  - called as body(chunk_begin, chunk_end)
+     *
+     * Splits [begin, end) into chunks and runs them on the executor's
+     * workers, the calling thread runs chunks as well. Returns once every
+     * chunk has finished, so a node can call it from its body and make its
+     * outputs available afterwards. If the executor does not accept tasks
+     * (see setOnTask()), all the chunks run on the calling thread. The first
+     * exception thrown by a chunk is rethrown once all the chunks are done.
+     */
+    template<typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain, F && body)
+    {
+        if( end <= begin )
+            return;
+        if( grain == 0 )
+            grain = 1;
 
-    uint32_t m_numRunning   = 0;
-    uint32_t m_numToExecute = 0;
+        auto count = (end - begin + grain - 1) / grain;
+        if( count == 1 || !onTask )
+        {
+            for(auto b = begin; b < end; b += grain)
+                body(b, std::min(end, b + grain));
+            return;
+        }
 
-   friend class exec_node;
+        using body_t = typename std::remove_reference<F>::type;
+        auto st = std::make_shared<parallel_for_state>();
+        st->m_begin = begin;
+        st->m_end   = end;
+        st->m_grain = grain;
+        st->m_count = count;
+        st->m_remaining.store(count, std::memory_order_relaxed);
+        st->m_body  = const_cast<void*>( static_cast<void const*>( std::addressof(body) ) );
+        st->m_call  = [](void * f, size_t b, size_t e) { (*static_cast<body_t*>(f))(b, e); };
+
+        auto helpers = std::min(count, m_task_concurrency) - 1;
+        for(size_t i=0; i < helpers; ++i)
+            onTask( [st]() { st->run_chunks(); } );
+
+        st->run_chunks();
+
+        std::unique_lock<std::mutex> lk(st->m_lock);
+        st->m_cv.wait(lk, [&] { return st->m_remaining.load(std::memory_order_acquire) == 0; });
+        if( st->m_error )
+            std::rethrow_exception(st->m_error);
+    }
 
-   std::function<void(exec_node*)>  onSchedule;
+    /**
+     * @brief Reset
+     * @param destroy_resources - destroys all the resources as well. Default is false.
+     */
+    void reset(bool destroy_resources = false)
+    {
+        if( m_incremental )
+        {
+            // permanent resources are only new in the frame they were created
+            for(auto R : m_resources)
+            {
+                if( R && R->get_flags() == resource_flags::permanent && R->is_available() )
+                    R->m_changed = false;
+            }
+        }
+
+        auto num_nodes = m_exec_nodes.size();
+        //std::cout << "size: " << m_exec_nodes.size() << std::endl;
+        m_exec_nodes.erase(std::remove_if(m_exec_nodes.begin(),
+                                  m_exec_nodes.end(),
+                                  [this](exec_node_p & x)
+                                  {
+
+                                      if(x->get_flags() == node_flags::execute_once && x->m_executed.load(std::memory_order_relaxed))
+                                      {
+                                          unlink_node(x);
+                                          destroy_node(x);
+                                          return true;
+                                      }
+                                      x->m_executed.store(false, std::memory_order_relaxed);
+                                      x->m_scheduled.store(false, std::memory_order_relaxed);
+                                      return false;
+                                  }),
+                   m_exec_nodes.end());
+//        std::cout << "size: " << m_exec_nodes.size() << std::endl;
+        if( num_nodes != m_exec_nodes.size() )
+        {
+            for(size_t i=0; i < m_exec_nodes.size(); ++i)
+                m_exec_nodes[i]->m_pos = static_cast<uint32_t>(i);
+        }
+
+        if( m_compiled )
+        {
+            auto & P = m_plan;
+            if( P.resetable_dirty )
+            {
+                // resources were dropped or created again since the plan was built
+                P.resetable.clear();
+                for(auto R : P.resources)
+                    if( R && R->get_flags() != resource_flags::permanent )
+                        P.resetable.push_back(R);
+                P.resetable_dirty = false;
+            }
+            for(auto R : P.resetable)
+                reset_resource(R, destroy_resources);
+        }
+        else
+        {
+            for(auto N : m_resources)
+            {
+                if( N && N->get_flags() != resource_flags::permanent)
+                {
+                    reset_resource(N, destroy_resources);
+                }
+            }
+        }
+
+        if( m_arena )
+            m_arena->rewind();
+
+        if( m_profiler )
+            m_profiler->next_frame();
+
+        if( m_roots_wait_on_permanent )
+            m_roots_dirty = true;
+
+        if( m_compiled )
+        {
+            auto & P = m_plan;
+            if( P.num_patched > 64 + P.nodes.size() / 4 )
+            {
+                // compact the slots of the removed nodes and the lists of added dependents
+                build_plan();
+                return;
+            }
+
+            if( m_plan.num_unavailable_permanent != 0 )
+                compute_initial_pending();
+
+            for(size_t i=0; i < m_plan.nodes.size(); ++i)
+                m_plan.pending[i].store( m_plan.initial_pending[i], std::memory_order_relaxed);
+            reset_readers();
+        }
+    }
+
+    /**
+     * @brief enable_frame_arena
+     * @param initial_bytes
+     *
+     * Creates a frame arena which backs the resetable resources. Values can
+     * allocate from it through out_resource::memory_resource(). reset() destroys
+     * the values whose producer asked for the arena and rewinds it, the other
+     * values are kept and reused as usual.
+     */
+    void enable_frame_arena(size_t initial_bytes = 1u << 20)
+    {
+        if( m_incremental )
+            throw std::runtime_error("The frame arena cannot be used in incremental mode");
+        m_arena.reset( new frame_arena(initial_bytes) );
+    }
+
+    /**
+     * @brief set_incremental
+     * @param enable
+     *
+     * In incremental mode, reset() keeps the values of the resources and a
+     * node whose inputs are all unchanged is not executed, its outputs are
+     * made available with their previous values. Producers mark an output
+     * as unchanged with out_resource::make_available_unchanged() or
+     * out_resource::set_if_changed(). Nodes without inputs, and nodes which
+     * produce moveable resources, always execute.
+     *
+     * Cannot be combined with the frame arena, which destroys the values
+     * every frame.
+     */
+    void set_incremental(bool enable = true)
+    {
+        if( enable && m_arena )
+            throw std::runtime_error("Incremental mode cannot be used with the frame arena");
+        if( enable && m_release_transients )
+            throw std::runtime_error("Incremental mode cannot be used while transient resources are released");
+        m_incremental = enable;
+    }
+
+    bool is_incremental() const
+    {
+        return m_incremental;
+    }
+
+    /**
+     * @brief get_frame_arena
+     * @return
+     *
+     * Returns the frame arena, or nullptr if it has not been enabled. Values
+     * should get it through out_resource::memory_resource(), so that reset()
+     * knows to destroy them before the arena is rewound.
+     */
+    frame_arena * get_frame_arena() const
+    {
+        return m_arena.get();
+    }
+
+
+    /**
+     * @brief set_profiler
+     * @param p - the profiler, or nullptr to stop profiling
+     *
+     * Records the scheduled, start and end time of every node execution
+     * into p. The graph does not own the profiler, it must outlive the
+     * graph or be removed with set_profiler(nullptr). Must not be called
+     * while the graph is executing.
+     */
+    void set_profiler(node_profiler * p)
+    {
+        m_profiler = p;
+        for(auto E : m_exec_nodes)
+            E->m_profile_id = node_profiler::invalid_id;
+    }
+
+    node_profiler * get_profiler() const
+    {
+        return m_profiler;
+    }
+
+    /**
+     * @brief set_metrics
+     * @param m - the metrics, or nullptr to stop collecting them
+     *
+     * Counts every node execution and frame into m, which can be read with
+     * graph_metrics::snapshot() while the graph is running. The graph does
+     * not own it. Must not be called while the graph is executing. Does
+     * nothing if GRAPHE_METRICS is 0.
+     */
+    void set_metrics(graph_metrics * m)
+    {
+#if GRAPHE_METRICS
+        m_metrics = m;
+        for(auto E : m_exec_nodes)
+            E->m_metrics_id = graph_metrics::invalid_id;
+#else
+        (void)m;
+#endif
+    }
+
+    graph_metrics * get_metrics() const
+    {
+#if GRAPHE_METRICS
+        return m_metrics;
+#else
+        return nullptr;
+#endif
+    }
+
+    resource_node_p  get_resources(std::string const & name)
+    {
+        return m_resources[ m_resources.at(name) ];
+    }
+
+    /**
+     * @brief get_resources
+     * @param id
+     * @return
+     *
+     * Returns the resource with the given id. Use get_resource_id() to
+     * look the id up once and avoid hashing the name on every access.
+     */
+    resource_node_p  get_resources(resource_id id)
+    {
+        return m_resources[id];
+    }
+
+    /**
+     * @brief get_resource_id
+     * @param name
+     * @return
+     *
+     * Returns the id of the named resource, or invalid_resource_id if
+     * no resource with that name has been registered.
+     */
+    resource_id get_resource_id(std::string const & name) const
+    {
+        return m_resources.find(name);
+    }
+
+    void print_info()
+    {
+        std::cout << "Num Nodes: " << m_exec_nodes.size() << std::endl;
+        std::cout << "Num Resources: " << m_resources.size() << std::endl;
+        std::cout << "Num Running: " << m_numRunning << std::endl;
+        std::cout << "Num To Executing: " << m_numToExecute << std::endl;
+    }
+
+
+    void print_node_resource_order(exec_node_p & e)
+    {
+        for(auto & r : e->m_requiredResources)
+        {
+            std::cout << r->get_name() << " -> " << e->get_name() << std::endl;
+        }
+        for(auto & r : e->m_producedResources)
+        {
+            std::cout << e->get_name() << " -> " << r->get_name() << std::endl;
+        }
+        if( e->m_producedResources.size()==0) return;
+
+        //std::cout << e->m_name <<( e->m_producedResources.size()==0?"\n":" -> ");
+
+    }
+
+    void print_node(resource_node_p N, time_point start)
+    {
+        std::cout << "{\n";
+        std::cout << "    rank=same \n";
+        std::cout << "    " << N->get_name() << "[shape=circle style=filled  color=\"0.650 0.700 0.700\"]\n";
+        if(N->get_time(start).count() != 0) std::cout << "    " << N->get_time(start).count() << "\n";
+        std::cout << "}" << std::endl;;
+    }
+
+    void print_node(exec_node_p & N, time_point start)
+    {
+        std::cout << "{\n";
+        std::cout << "    rank=same \n";
+        std::cout << "    " << N->get_name() << "[shape=square]\n";
+        if(N->get_time(start).count() != 0) std::cout << "    " << N->get_time(start).count() << "\n";
+        std::cout << "}" << std::endl;;
+    }
+
+    /**
+     * @brief print
+     *
+     * Prints the graph in dot format.
+     */
+    void print()
+    {
+
+        std::map<std::thread::id, int> threadProps;
+        std::map<time_point, int> nodes;
+
+        auto min = m_exec_nodes[0]->get_time();
+        for(auto & E : m_exec_nodes)
+        {
+            auto t = E->get_time();
+            min = std::min(min, t);
+            nodes[t]=0;
+        }
+        for(auto & E : m_resources)
+        {
+            if( !E )
+                continue;
+            auto t = E->get_time();
+            if(E->get_flags() != resource_flags::permanent)
+            {
+                min    = std::min(min, t);
+            }
+            nodes[t]=0;
+
+
+        }
+
+        std::cout << "digraph G {" << std::endl;
+
+        auto s = nodes.size();
+        for(auto & E : nodes)
+        {
+            auto t = std::chrono::duration_cast<std::chrono::microseconds>(E.first - min).count();
+            std::cout << t << (s==1? "\n":" -> ") ;
+            s--;
+        };
+
+
+        for(auto & E : m_exec_nodes)
+        {
+            print_node(E,min);
+        }
+        for(auto E : m_resources)
+        {
+            if( E )
+                print_node(E,min);
+        }
+
+        for(auto & E : m_exec_nodes)
+        {
+            print_node_resource_order(E);
+        }
+
+
+        std::cout << "}" << std::endl;
+    }
+
+    std::vector< exec_node_p > & get_exec_nodes()
+    {
+        return m_exec_nodes;
+    }
+
+    /**
+     * @brief get_stream
+     * @param name
+     * @return
+     *
+     * Returns the named stream, or nullptr.
+     */
+    stream_base * get_stream(std::string const & name) const
+    {
+        auto it = m_streams.find(name);
+        return it == m_streams.end() ? nullptr : it->second.get();
+    }
+
+    std::map< std::string, std::unique_ptr<stream_base> > const & get_streams() const
+    {
+        return m_streams;
+    }
+
+    /**
+     * @brief get_num_node_ids
+     * @return
+     *
+     * Returns one more than the largest id given to a node.
+     */
+    uint32_t get_num_node_ids() const
+    {
+        return m_next_node_id;
+    }
+
+
+    uint32_t get_num_running() const
+    {
+        return m_numRunning.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief get_num_suspended
+     * @return
+     *
+     * Returns the number of async nodes which have returned from their body
+     * but have not called async_handle::complete() yet.
+     */
+    uint32_t get_num_suspended() const
+    {
+        return m_numSuspended.load(std::memory_order_relaxed);
+    }
+
+    uint32_t get_left_to_execute() const
+    {
+        return m_numToExecute.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief busy
+     * @return
+     *
+     * Returns true if the graph is busy. Ie; There are nodes running
+     */
+    bool busy() const
+    {
+        return m_numRunning.load(std::memory_order_acquire)!=0 || m_numToExecute.load(std::memory_order_acquire)!=0;
+    }
+
+    /**
+     * @brief get_completion_event
+     * @return
+     *
+     * Signalled every time the last outstanding node finishes. It belongs
+     * to the graph, so a notification can never touch an executor which
+     * has already been destroyed.
+     */
+    completion_event & get_completion_event()
+    {
+        return m_completed;
+    }
+
+    /**
+     * @brief set_error
+     * @param e
+     *
+     * Records an error raised while a frame executes, on whichever thread
+     * raised it. Only the first error is kept until take_error().
+     */
+    void set_error(std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> lk(m_error_lock);
+        if( !m_error )
+        {
+            m_error = std::move(e);
+            m_has_error.store(true, std::memory_order_release);
+        }
+    }
+
+    /**
+     * @brief take_error
+     * @return
+     *
+     * Returns the error recorded by set_error() and clears it, or nullptr.
+     * The executors rethrow it from wait(), or from execute() for the
+     * serial_executor.
+     */
+    std::exception_ptr take_error()
+    {
+        if( !m_has_error.load(std::memory_order_acquire) )
+            return nullptr;
+        std::lock_guard<std::mutex> lk(m_error_lock);
+        m_has_error.store(false, std::memory_order_relaxed);
+        return std::exchange(m_error, nullptr);
+    }
+
+    /**
+     * @brief rethrow_error
+     *
+     * Throws the error recorded by set_error(), if any, and clears it.
+     */
+    void rethrow_error()
+    {
+        if( auto e = take_error() )
+            std::rethrow_exception(e);
+    }
+
+    void setOnSchedule( std::function<void(exec_node*)> f)
+    {
+        onSchedule = f;
+    }
+    void clearOnSchedule()
+    {
+        onSchedule = std::function<void(exec_node*)>();
+    }
+
+    /**
+     * @brief setOnScheduleBatch
+     * @param f
+     *
+     * Optional hook which receives a whole batch of nodes in one call,
+     * used by schedule_nodes(). Without it, each node goes to onSchedule.
+     */
+    void setOnScheduleBatch( std::function<void(exec_node * const *, size_t)> f)
+    {
+        onScheduleBatch = f;
+    }
+    void clearOnScheduleBatch()
+    {
+        onScheduleBatch = std::function<void(exec_node * const *, size_t)>();
+    }
+
+    /**
+     * @brief setOnTask
+     * @param f
+     * @param concurrency - number of threads which can run tasks, including the caller
+     *
+     * Hook used by parallel_for() to run helper tasks on the executor.
+     */
+    void setOnTask( std::function<void(std::function<void(void)>)> f, size_t concurrency)
+    {
+        onTask = f;
+        m_task_concurrency = std::max<size_t>(concurrency, 1);
+    }
+    void clearOnTask()
+    {
+        onTask = std::function<void(std::function<void(void)>)>();
+        m_task_concurrency = 1;
+    }
+
+    void setOnComplete( std::function<void(void)> f)
+    {
+        onFinished = f;
+    }
+    void clearOnComplete()
+    {
+        onFinished = std::function<void(void)> ();
+    }
+protected:
+
+    /**
+     * @brief update_roots
+     *
+     * Rebuilds the cached list of root nodes.
+     */
+    void update_roots()
+    {
+        m_roots.clear();
+        m_roots_wait_on_permanent = false;
+        for(auto E : m_exec_nodes)
+        {
+            if( E->is_stream_node() )
+                continue; // run by stream_executor
+
+            bool wait = false;
+            if( is_root(E, wait) )
+                m_roots.push_back(E);
+            m_roots_wait_on_permanent = m_roots_wait_on_permanent || wait;
+        }
+        std::stable_sort(m_roots.begin(), m_roots.end(), [](exec_node * a, exec_node * b) { return a->m_rank > b->m_rank; });
+        m_roots_dirty = false;
+    }
+
+    /**
+     * @brief is_root
+     * @param E
+     * @param wait - set if E becomes a root once its permanent inputs are available
+     * @return
+     *
+     * Returns true if E only requires permanent resources which are available.
+     */
+    static bool is_root(exec_node const * E, bool & wait)
+    {
+        bool root = true;
+        wait = false;
+        for(auto r : E->m_requiredResources)
+        {
+            if( r->get_flags() != resource_flags::permanent )
+            {
+                wait = false;
+                return false;
+            }
+            if( !r->is_available() )
+            {
+                root = false;
+                wait = true;
+            }
+        }
+        return root;
+    }
+
+    /**
+     * @brief add_root
+     * @param E
+     *
+     * Adds a new node to the cached list of roots if it is one, keeping the
+     * list ordered by rank.
+     */
+    void add_root(exec_node * E)
+    {
+        bool wait = false;
+        if( is_root(E, wait) )
+        {
+            auto by_rank = [](exec_node * a, exec_node * b) { return a->m_rank > b->m_rank; };
+            m_roots.insert( std::upper_bound(m_roots.begin(), m_roots.end(), E, by_rank), E);
+        }
+        m_roots_wait_on_permanent = m_roots_wait_on_permanent || wait;
+    }
+
+    /**
+     * @brief is_timed
+     * @return
+     *
+     * Returns true if the time at which nodes are scheduled is needed.
+     */
+    bool is_timed() const
+    {
+#if GRAPHE_METRICS
+        return m_profiler || m_metrics;
+#else
+        return m_profiler;
+#endif
+    }
+
+    /**
+     * @brief node_cost
+     * @param E
+     * @return
+     *
+     * The cost hint of the node, otherwise the duration measured the last
+     * time it executed, in microseconds, or 1 if it has not executed yet.
+     */
+    static double node_cost(exec_node const * E)
+    {
+        double cost = E->m_cost_hint;
+        if( cost <= 0.0 )
+        {
+            auto d = std::chrono::duration<double, std::micro>(E->m_exec_end_time - E->m_exec_start_time_us).count();
+            cost = d > 0.0 ? d : 1.0;
+        }
+        return cost;
+    }
+
+    /**
+     * @brief compile_plan
+     * @param rank_nodes - false keeps the ranks the nodes already have
+     *
+     * compile(), for graph_serializer::load() which restores the saved
+     * ranks before the plan is ordered and fused by them.
+     */
+    void compile_plan(bool rank_nodes)
+    {
+        if( m_validate )
+        {
+            auto issues = validate();
+            if( !issues.empty() )
+            {
+                std::string msg = "Invalid graph:";
+                for(auto & i : issues)
+                    msg += "\n  " + i.message;
+                throw std::runtime_error(msg);
+            }
+        }
+        build_plan(rank_nodes);
+    }
+
+    /**
+     * @brief build_plan
+     *
+     * Builds the compiled plan from the current topology, without
+     * validating it. The successors are ordered and the chains fused by
+     * rank, which is recomputed unless rank_nodes is false.
+     */
+    void build_plan(bool rank_nodes = true)
+    {
+        auto & P = m_plan;
+
+        P.nodes.clear();
+        P.resources.clear();
+        P.resetable.clear();
+        P.resetable_dirty = false;
+        P.extra.clear();
+        P.num_patched = 0;
+
+        for(auto & E : m_exec_nodes)
+        {
+            E->m_index = static_cast<uint32_t>(P.nodes.size());
+            P.nodes.push_back(E);
+        }
+        if( rank_nodes )
+            update_ranks();
+        else
+            m_roots_dirty = true;
+
+        // resources are indexed by their interned id, ids without a resource stay null
+        for(auto R : m_resources)
+        {
+            P.resources.push_back(R);
+            if( R && R->get_flags() != resource_flags::permanent )
+                P.resetable.push_back(R);
+        }
+
+        // build the CSR list of dependents for each resource.
+        P.succ_offsets.assign(P.resources.size()+1, 0);
+        for(size_t r=0; r < P.resources.size(); ++r)
+        {
+            P.succ_offsets[r+1] = P.succ_offsets[r] + ( P.resources[r] ? static_cast<uint32_t>(P.resources[r]->m_Nodes.size()) : 0u );
+        }
+
+        P.succ.resize(P.succ_offsets.back());
+        for(size_t r=0; r < P.resources.size(); ++r)
+        {
+            if( !P.resources[r] )
+                continue;
+            auto i = P.succ_offsets[r];
+            for(auto n : P.resources[r]->m_Nodes)
+            {
+                P.succ[i++] = n->m_index;
+            }
+        }
+        sort_successors();
+
+        P.pending.reset( new std::atomic<uint32_t>[P.nodes.size()] );
+        P.pending_capacity = P.nodes.size();
+        P.initial_pending.resize(P.nodes.size());
+
+        m_compiled = true;
+
+        compute_lifetimes();
+        compute_fusion();
+        compute_initial_pending();
+        for(size_t i=0; i < P.nodes.size(); ++i)
+        {
+            // inputs which are already available do not need to be waited on
+            uint32_t c = 0;
+            for(auto r : P.nodes[i]->m_requiredResources)
+            {
+                if( !r->is_available() ) ++c;
+            }
+            P.pending[i].store(c, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief compute_fusion
+     *
+     * Marks the nodes which are fused to their predecessor, see set_fusion().
+     */
+    void compute_fusion()
+    {
+        auto & P = m_plan;
+        m_has_fused = false;
+        for(auto N : P.nodes)
+            if( N )
+                N->m_fused = false;
+        if( !m_fuse )
+            return;
+
+        std::vector<exec_node*> fused(P.nodes.size(), nullptr); // predecessor index -> its fused successor
+        for(auto Y : P.nodes)
+        {
+            if( !Y || Y->is_stream_node() )
+                continue;
+
+            // the single node Y waits on, permanent inputs do not count
+            exec_node * X = nullptr;
+            bool single = true;
+            for(auto R : Y->m_requiredResources)
+            {
+                if( R->get_flags() == resource_flags::permanent )
+                    continue;
+                if( !R->m_parent || (X && X != R->m_parent) )
+                {
+                    single = false;
+                    break;
+                }
+                X = R->m_parent;
+            }
+            if( !single || !X || X == Y || X->is_stream_node() )
+                continue;
+            if( Y->m_domain != X->m_domain || Y->m_affinity != X->m_affinity )
+                continue;
+
+            bool chain = true;
+            for(auto R : X->m_producedResources)
+                for(auto C : R->m_Nodes)
+                    chain = chain && C == Y;
+
+            // a link of a chain could not run in parallel anyway, other
+            // successors are only fused if they are cheap
+            if( !chain && node_cost(Y) > m_fuse_cost )
+                continue;
+
+            auto & f = fused[X->m_index];
+            if( f && f->m_rank >= Y->m_rank )
+                continue;
+            if( f )
+                f->m_fused = false;
+            f = Y;
+            Y->m_fused  = true;
+            m_has_fused = true;
+        }
+    }
+
+    /**
+     * @brief update_ranks
+     *
+     * Computes m_rank for every node in reverse topological order. The
+     * nodes must have been indexed by their position in m_exec_nodes.
+     * Nodes which are part of a cycle are only ranked by their own cost.
+     */
+    void update_ranks()
+    {
+        auto n = m_exec_nodes.size();
+
+        std::vector<uint32_t> indeg(n, 0);
+        for(auto E : m_exec_nodes)
+        {
+            for(auto R : E->m_producedResources)
+                for(auto C : R->m_Nodes)
+                    ++indeg[C->m_index];
+        }
+
+        std::vector<exec_node*> order;
+        order.reserve(n);
+        for(auto E : m_exec_nodes)
+        {
+            if( indeg[E->m_index] == 0 )
+                order.push_back(E);
+        }
+        for(size_t i=0; i < order.size(); ++i)
+        {
+            for(auto R : order[i]->m_producedResources)
+                for(auto C : R->m_Nodes)
+                    if( --indeg[C->m_index] == 0 )
+                        order.push_back(C);
+        }
+
+        for(auto E : m_exec_nodes)
+            E->m_rank = node_cost(E);
+
+        for(auto it = order.rbegin(); it != order.rend(); ++it)
+        {
+            auto E = *it;
+            double longest = 0.0;
+            for(auto R : E->m_producedResources)
+                for(auto C : R->m_Nodes)
+                    longest = std::max(longest, C->m_rank);
+            E->m_rank += longest;
+        }
+        m_roots_dirty = true;
+    }
+
+    /**
+     * @brief sort_successors
+     *
+     * Orders the dependents of each resource in the compiled plan by
+     * decreasing rank, so the nodes which become ready together are
+     * scheduled with the most critical one first.
+     */
+    void sort_successors()
+    {
+        auto & P = m_plan;
+        for(size_t r=0; r+1 < P.succ_offsets.size(); ++r)
+        {
+            std::stable_sort(P.succ.begin() + P.succ_offsets[r], P.succ.begin() + P.succ_offsets[r+1],
+                             [&P](uint32_t a, uint32_t b) { return P.nodes[a]->m_rank > P.nodes[b]->m_rank; });
+        }
+    }
+
+    /**
+     * @brief compute_initial_pending
+     *
+     * Computes the number of inputs each node waits on at the start of
+     * a frame. Permanent resources which have already been made available
+     * are not waited on.
+     */
+    void compute_initial_pending()
+    {
+        auto & P = m_plan;
+
+        P.num_unavailable_permanent = 0;
+        for(auto R : P.resources)
+        {
+            if( R && R->get_flags() == resource_flags::permanent && !R->is_available() )
+                ++P.num_unavailable_permanent;
+        }
+
+        for(size_t i=0; i < P.nodes.size(); ++i)
+        {
+            if( !P.nodes[i] )
+                continue; // removed
+            uint32_t c = 0;
+            for(auto r : P.nodes[i]->m_requiredResources)
+            {
+                if( r->get_flags() != resource_flags::permanent || !r->is_available() ) ++c;
+            }
+            P.initial_pending[i] = c;
+        }
+    }
+
+    /**
+     * @brief resource_available
+     * @param r - index of the resource in the compiled plan
+     *
+     * Decrements the pending-input counter of every dependent of
+     * resource r and schedules the nodes which are no longer waiting.
+     */
+    void resource_available(uint32_t r);
+
+    /**
+     * @brief compute_lifetimes
+     *
+     * Finds the transient resources, ie: resetable resources with at least
+     * one consumer, and lists the ones each node reads, so their values can
+     * be destroyed as soon as the last consumer has finished.
+     */
+    void compute_lifetimes()
+    {
+        auto & P = m_plan;
+        P.release_offsets.assign(P.nodes.size()+1, 0);
+        P.release.clear();
+        P.initial_readers.assign(P.resources.size(), 0);
+        P.readers.reset( new std::atomic<uint32_t>[P.resources.size()] );
+        P.readers_capacity = P.resources.size();
+        if( !m_release_transients )
+            return;
+
+        for(size_t r=0; r < P.resources.size(); ++r)
+        {
+            if( P.resources[r] && P.resources[r]->get_flags() == resource_flags::resetable )
+                P.initial_readers[r] = P.succ_offsets[r+1] - P.succ_offsets[r];
+        }
+        for(size_t i=0; i < P.nodes.size(); ++i)
+        {
+            for(auto R : P.nodes[i]->m_requiredResources)
+            {
+                if( P.initial_readers[R->m_index] != 0 )
+                    P.release.push_back(R->m_index);
+            }
+            P.release_offsets[i+1] = static_cast<uint32_t>(P.release.size());
+        }
+        reset_readers();
+    }
+
+    void reset_readers()
+    {
+        auto & P = m_plan;
+        if( !m_release_transients )
+            return;
+        for(size_t r=0; r < P.initial_readers.size(); ++r)
+            P.readers[r].store(P.initial_readers[r], std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief grow_counters
+     * @param a - array of counters
+     * @param capacity - number of counters allocated in a
+     * @param used - number of counters in use, they are kept
+     * @param size - number of counters needed
+     *
+     * Reallocates a if it can not hold size counters, doubling its capacity.
+     */
+    static void grow_counters(std::unique_ptr< std::atomic<uint32_t>[] > & a, size_t & capacity, size_t used, size_t size)
+    {
+        if( size <= capacity )
+            return;
+        capacity = std::max(size, capacity * 2);
+        std::unique_ptr< std::atomic<uint32_t>[] > b( new std::atomic<uint32_t>[capacity] );
+        for(size_t i=0; i < used; ++i)
+            b[i].store( a[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        a = std::move(b);
+    }
+
+    /**
+     * @brief plan_add
+     * @param N
+     *
+     * Appends a node added after compile() to the plan, along with the
+     * resources it registered. The CSR lists are not touched, N is added to
+     * the extra dependents of its inputs instead.
+     */
+    void plan_add(exec_node * N)
+    {
+        plan_add_resources(nullptr, 0);
+        plan_add_node(N, 0, 0);
+        ++m_plan.num_patched;
+    }
+
+    /**
+     * @brief plan_add_resources
+     * @param T - the plan of the template instance which registered the new resources, or nullptr
+     * @param first_local - id of the instance's first resource
+     *
+     * Appends the resources registered since the plan was last patched. The
+     * CSR lists of the instance's own resources are copied from T, offset by
+     * the index of the instance's first node, the other new resources get
+     * empty lists.
+     */
+    void plan_add_resources(template_plan const * T, resource_id first_local)
+    {
+        auto & P = m_plan;
+
+        auto num_resources = P.resources.size();
+        auto first_node    = static_cast<uint32_t>(P.nodes.size());
+        for(auto r = num_resources; r < m_resources.size(); ++r)
+        {
+            auto R = m_resources[static_cast<resource_id>(r)];
+            P.resources.push_back(R);
+            if( R && R->get_flags() != resource_flags::permanent )
+                P.resetable.push_back(R);
+            else if( R && !R->is_available() )
+                ++P.num_unavailable_permanent;
+
+            auto k = r - first_local;
+            if( T && r >= first_local && k < T->num_local() )
+            {
+                for(auto i = T->succ_offsets[k]; i != T->succ_offsets[k+1]; ++i)
+                    P.succ.push_back( first_node + T->succ[i] );
+            }
+            P.succ_offsets.push_back( static_cast<uint32_t>(P.succ.size()) );
+            P.initial_readers.push_back(0);
+        }
+        grow_counters(P.readers, P.readers_capacity, num_resources, P.resources.size());
+        for(auto r = num_resources; r < P.resources.size(); ++r)
+            P.readers[r].store(0, std::memory_order_relaxed);
+        P.extra.resize(P.resources.size());
+    }
+
+    /**
+     * @brief plan_add_node
+     * @param N
+     * @param first_local - id of the first resource whose CSR list already has N, see plan_add_resources()
+     * @param num_local - number of such resources
+     * @return
+     *
+     * Appends a node to the plan, after its resources were appended. N is
+     * added to the extra dependents of its other inputs, returns true if it
+     * had any.
+     */
+    bool plan_add_node(exec_node * N, resource_id first_local, size_t num_local)
+    {
+        auto & P = m_plan;
+
+        // ids whose resource was dropped get the new resource_node
+        auto patch = [&P](resource_node * R)
+        {
+            if( P.resources[R->m_index] == R )
+                return;
+            P.resources[R->m_index] = R;
+            P.resetable_dirty       = true;
+            if( R->get_flags() == resource_flags::permanent && !R->is_available() )
+                ++P.num_unavailable_permanent;
+        };
+        for(auto R : N->m_requiredResources)
+            patch(R);
+        for(auto R : N->m_producedResources)
+            patch(R);
+
+        N->m_index = static_cast<uint32_t>(P.nodes.size());
+        N->m_rank  = node_cost(N);
+        P.nodes.push_back(N);
+        grow_counters(P.pending, P.pending_capacity, N->m_index, P.nodes.size());
+
+        uint32_t initial = 0;
+        uint32_t pending = 0;
+        bool     extra   = false;
+        for(auto R : N->m_requiredResources)
+        {
+            auto r = R->m_index;
+            if( r < first_local || r - first_local >= num_local )
+            {
+                P.extra[r].push_back(N->m_index);
+                extra = true;
+            }
+            if( R->get_flags() != resource_flags::permanent || !R->is_available() ) ++initial;
+            if( !R->is_available() ) ++pending;
+            if( m_release_transients && R->get_flags() == resource_flags::resetable )
+            {
+                ++P.initial_readers[r];
+                P.readers[r].store( P.readers[r].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                P.release.push_back(r);
+            }
+        }
+        P.release_offsets.push_back( static_cast<uint32_t>(P.release.size()) );
+        P.initial_pending.push_back(initial);
+        P.pending[N->m_index].store(pending, std::memory_order_relaxed);
+        return extra;
+    }
+
+    /**
+     * @brief add_instance
+     * @param nodes - the nodes of one instance of a graph_template, added while m_defer_plan was set
+     * @param T - the plan of the template
+     * @param first_local - id of the instance's first resource
+     *
+     * Adds the nodes of a template instance to the compiled plan and to the
+     * roots. The lists of dependents of the instance's own resources are
+     * copied from the template instead of being patched node by node.
+     */
+    void add_instance(std::vector<exec_node*> const & nodes, template_plan const & T, resource_id first_local)
+    {
+        if( m_compiled )
+        {
+            auto & P = m_plan;
+            // the instance's resources must not be in the plan yet
+            bool block = P.resources.size() <= first_local;
+            if( block )
+                plan_add_resources(&T, first_local);
+            for(auto N : nodes)
+            {
+                if( !block )
+                    plan_add_resources(nullptr, 0);
+                if( plan_add_node(N, first_local, block ? T.num_local() : 0) )
+                    ++P.num_patched;
+            }
+        }
+        if( !m_roots_dirty )
+        {
+            for(auto N : nodes)
+            {
+                if( !N->is_stream_node() )
+                    add_root(N);
+            }
+        }
+    }
+
+    /**
+     * @brief discard_instance
+     * @param nodes - nodes added while m_defer_plan was set
+     *
+     * Destroys the nodes of a template instance which could not be
+     * completed, before they were added to the plan.
+     */
+    void discard_instance(std::vector<exec_node*> const & nodes)
+    {
+        for(auto it = nodes.rbegin(); it != nodes.rend(); ++it)
+        {
+            auto p = *it;
+            auto i = p->m_pos;
+            m_exec_nodes[i] = m_exec_nodes.back();
+            m_exec_nodes[i]->m_pos = i;
+            m_exec_nodes.pop_back();
+            destroy_node(p);
+        }
+    }
+
+    /**
+     * @brief unlink_node
+     * @param N
+     *
+     * Removes a node which is about to be destroyed from the list of roots
+     * and empties its slot in the plan. The slot stays in the CSR lists
+     * until the plan is rebuilt, making a resource available skips it.
+     */
+    void unlink_node(exec_node * N)
+    {
+        if( !m_roots_dirty )
+        {
+            auto it = std::find(m_roots.begin(), m_roots.end(), N);
+            if( it != m_roots.end() )
+                m_roots.erase(it);
+        }
+        if( !m_compiled )
+            return;
+
+        auto & P = m_plan;
+        auto i = N->m_index;
+        for(auto j = P.release_offsets[i]; j != P.release_offsets[i+1]; ++j)
+        {
+            auto r = P.release[j];
+            --P.initial_readers[r];
+            P.readers[r].store( P.readers[r].load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        }
+        P.nodes[i] = nullptr;
+        ++P.num_patched;
+    }
+
+    /**
+     * @brief destroy_node
+     * @param N
+     *
+     * Unlinks the node from the resources it uses and returns it, and the
+     * storage of its node class, to the pools. Resources which no node
+     * uses any more are dropped, see drop_resource().
+     */
+    void destroy_node(exec_node * N)
+    {
+        for(auto R : N->m_requiredResources)
+        {
+            R->m_Nodes.erase( std::remove(R->m_Nodes.begin(), R->m_Nodes.end(), N), R->m_Nodes.end() );
+        }
+        for(auto R : N->m_producedResources)
+        {
+            if( R->m_parent == N )
+                R->m_parent = nullptr;
+            --R->m_num_producers;
+        }
+        for(auto & S : m_streams)
+            S.second->remove_node(N);
+
+        auto used = std::move(N->m_requiredResources);
+        used.insert(used.end(), N->m_producedResources.begin(), N->m_producedResources.end());
+        std::sort(used.begin(), used.end());
+        used.erase( std::unique(used.begin(), used.end()), used.end() );
+
+        auto cls   = N->m_NodeClass;
+        auto size  = N->m_class_size;
+        auto align = N->m_class_align;
+        m_exec_pool.destroy(N);
+        if( cls )
+            m_node_arena.deallocate(cls, size, align);
+
+        for(auto R : used)
+        {
+            if( m_resources[R->m_index] == R && R->m_num_producers == 0 && R->m_Nodes.empty() &&
+                !( R->get_flags() == resource_flags::permanent && R->is_available() ) )
+                drop_resource(R);
+        }
+    }
+
+    /**
+     * @brief drop_resource
+     * @param R - a resource which no node produces or consumes
+     *
+     * Destroys the resource and gives its storage back to the arena. Its
+     * name stays interned, so a node which registers it again gets the same
+     * id and a new resource_node. Permanent resources which hold a value
+     * are kept, since a node added later may still read them.
+     */
+    void drop_resource(resource_node * R)
+    {
+        auto id = R->m_index;
+        if( m_compiled && id < m_plan.resources.size() )
+        {
+            auto & P = m_plan;
+            P.resources[id]      = nullptr;
+            P.initial_readers[id] = 0;
+            P.readers[id].store(0, std::memory_order_relaxed);
+            P.resetable_dirty    = true;
+        }
+        m_resources.set(id, nullptr);
+        auto size  = R->m_storage_size;
+        auto align = R->m_storage_align;
+        R->~resource_node();
+        m_node_arena.deallocate(R, size, align);
+    }
+
+    /**
+     * @brief reset_resource
+     * @param R
+     * @param destroy_value
+     *
+     * Makes R unavailable. Values which may hold memory from the frame
+     * arena are destroyed as well, since the arena is about to be rewound,
+     * other values are kept so their storage is reused by the next frame.
+     */
+    static void reset_resource(resource_node * R, bool destroy_value)
+    {
+        R->make_available(false);
+        if( destroy_value || R->m_arena_backed )
+            R->destroy_value();
+        R->m_arena_backed = false;
+    }
+
+    /**
+     * @brief The deferred_ready struct
+     *
+     * Per thread state of set_deferred_notify().
+     */
+    struct deferred_ready
+    {
+        node_graph            * collecting = nullptr; // graph whose ready nodes go into nodes
+        node_graph            * trampoline = nullptr; // graph whose kept nodes are run by run_kept() further up the stack
+        exec_node             * next = nullptr;       // the node that run_kept() executes next
+        std::vector<exec_node*> nodes;
+
+        static deferred_ready & local()
+        {
+            static thread_local deferred_ready D;
+            return D;
+        }
+    };
+
+    /**
+     * @brief The ready_scope struct
+     *
+     * Collects the nodes which become ready while one node executes, if
+     * deferral is on or some nodes are fused. The executing body is a fresh context, so a graph
+     * executed from inside a node does not collect into the outer one.
+     */
+    struct ready_scope
+    {
+        node_graph * graph = nullptr;
+        node_graph * prev_collecting = nullptr;
+        node_graph * prev_trampoline = nullptr;
+        size_t       mark = 0;
+
+        explicit ready_scope(node_graph * G)
+        {
+            if( !G->m_defer_notify && !G->m_has_fused )
+                return;
+            auto & D = deferred_ready::local();
+            graph           = G;
+            prev_collecting = D.collecting;
+            prev_trampoline = D.trampoline;
+            mark            = D.nodes.size();
+            D.collecting = G;
+            D.trampoline = nullptr;
+        }
+
+        ~ready_scope()
+        {
+            if( graph )
+                restore();
+        }
+
+        /**
+         * Schedules the collected nodes and returns the one which the
+         * calling thread should run, if any.
+         */
+        exec_node * publish(exec_node * by)
+        {
+            if( !graph )
+                return nullptr;
+            restore();
+            auto G = graph;
+            graph = nullptr;
+            return G->publish_ready(mark, by);
+        }
+
+        void restore()
+        {
+            auto & D = deferred_ready::local();
+            D.collecting = prev_collecting;
+            D.trampoline = prev_trampoline;
+        }
+    };
+
+    exec_node * publish_ready(size_t mark, exec_node * by)
+    {
+        auto & D = deferred_ready::local();
+        auto first = D.nodes.data() + mark;
+        auto count = D.nodes.size() - mark;
+        if( count == 0 )
+            return nullptr;
+
+        // keep a fused node, or else the most critical node which the
+        // executor does not have to route. A node restricted to the same
+        // thread as the one which just ran can be kept as well.
+        exec_node * keep = nullptr;
+        size_t      k    = 0;
+        for(size_t i=0; i < count; ++i)
+        {
+            auto N = first[i];
+            bool here = ( N->m_domain == exec_domain::any && N->m_affinity < 0 ) ||
+                        ( N->m_domain == by->m_domain && N->m_affinity == by->m_affinity );
+            if( !here || (!N->m_fused && !m_defer_notify) )
+                continue;
+            if( !keep || (N->m_fused && !keep->m_fused) ||
+                (N->m_fused == keep->m_fused && N->m_rank > keep->m_rank) )
+            {
+                keep = N;
+                k    = i;
+            }
+        }
+        if( keep )
+        {
+            std::swap(first[k], first[count-1]);
+            --count;
+            m_numToExecute.fetch_add(1, std::memory_order_relaxed);
+            if( is_timed() )
+                keep->m_sched_time = std::chrono::steady_clock::now();
+        }
+        schedule_nodes(first, count);
+        D.nodes.resize(mark);
+        return keep;
+    }
+
+    /**
+     * @brief run_kept
+     * @param N
+     *
+     * Executes a node kept by publish_ready() on the calling thread. The
+     * nodes it keeps in turn are run by the same loop instead of recursing,
+     * so a long chain does not grow the stack.
+     */
+    void run_kept(exec_node * N)
+    {
+        auto & D = deferred_ready::local();
+        if( D.trampoline == this )
+        {
+            D.next = N;
+            return;
+        }
+        auto prev_trampoline = D.trampoline;
+        auto prev_next       = D.next;
+        D.trampoline = this;
+        while( N )
+        {
+            D.next = nullptr;
+            N->execute();
+            N = D.next;
+        }
+        D.trampoline = prev_trampoline;
+        D.next       = prev_next;
+    }
+
+    /**
+     * @brief release_inputs
+     * @param N
+     *
+     * Counts N as done with its transient inputs and destroys the value of
+     * each one whose consumers have all finished.
+     */
+    void release_inputs(exec_node * N)
+    {
+        auto & P = m_plan;
+        for(auto i = P.release_offsets[N->m_index]; i != P.release_offsets[N->m_index+1]; ++i)
+        {
+            auto r = P.release[i];
+            if( P.readers[r].fetch_sub(1, std::memory_order_acq_rel) == 1 )
+                P.resources[r]->destroy_value();
+        }
+    }
+
+    /**
+     * @brief finish_node
+     * @param N
+     *
+     * Runs once the body of N has finished, releases its moveable inputs,
+     * and its transient inputs once all their consumers are done, checks
+     * that it produced all its outputs and retires it.
+     */
+    void finish_node(exec_node * N)
+    {
+        N->m_exec_end_time = std::chrono::steady_clock::now();
+
+        if( m_profiler )
+        {
+            m_profiler->record(N->m_profile_id, N->get_name(),
+                               N->m_sched_time, N->m_exec_start_time_us, N->m_exec_end_time);
+        }
+#if GRAPHE_METRICS
+        if( m_metrics )
+        {
+            m_metrics->record(N->m_metrics_id, N->get_name(),
+                              N->m_sched_time, N->m_exec_start_time_us, N->m_exec_end_time);
+        }
+#endif
+
+        // the only consumer of a moveable resource has finished with it.
+        for(auto R : N->m_moveableInputs)
+            R->destroy_value();
+
+        if( m_release_transients && m_compiled )
+            release_inputs(N);
+
+#if GRAPHE_RUNTIME_CHECKS
+        // this runs on a worker, so the error is handed to the executor's wait() instead of thrown
+        for(auto R : N->m_producedResources)
+        {
+          if( !R->is_available() )
+          {
+              set_error( std::make_exception_ptr( std::runtime_error( std::string("Node ") + N->get_name() + std::string(" failed to create resource: ") + R->get_name()) ) );
+              break;
+          }
+        }
+#endif
+
+        node_finished();
+    }
+
+    /**
+     * @brief node_finished
+     *
+     * Called once for every scheduled node after it has executed. The call
+     * which brings the number of outstanding nodes to zero fires onFinished,
+     * so completion is detected exactly once.
+     */
+    void node_finished()
+    {
+        if( m_numToExecute.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+        {
+#if GRAPHE_METRICS
+            if( m_metrics )
+                m_metrics->record_frame( std::chrono::steady_clock::now() - m_frame_start );
+#endif
+            if(onFinished)
+            {
+                onFinished();
+            }
+            m_completed.notify_all();
+        }
+    }
+
+    /**
+     * @brief The compiled_plan struct
+     *
+     * Flattened copy of the topology built by compile().
+     */
+    struct compiled_plan
+    {
+        std::vector<exec_node*>        nodes;            // node index -> exec_node
+        std::vector<resource_node*>    resources;        // resource index -> resource_node
+        std::vector<resource_node*>    resetable;        // resources which are reset by reset()
+        std::vector<uint32_t>          succ_offsets;     // resource index -> first entry in succ
+        std::vector<uint32_t>          succ;             // dependent node indices
+        std::vector<uint32_t>          initial_pending;  // pending-input count at the start of a frame
+        std::unique_ptr< std::atomic<uint32_t>[] > pending; // inputs each node is still waiting on
+        std::vector<uint32_t>          release_offsets;  // node index -> first entry in release
+        std::vector<uint32_t>          release;          // transient resources each node reads, see set_release_transients()
+        std::vector<uint32_t>          initial_readers;  // resource index -> number of nodes reading it
+        std::unique_ptr< std::atomic<uint32_t>[] > readers; // consumers of each resource which have not finished
+        size_t                         pending_capacity = 0; // number of counters allocated in pending
+        size_t                         readers_capacity = 0; // number of counters allocated in readers
+        std::vector< std::vector<uint32_t> > extra;      // resource index -> dependents added after compile()
+        uint32_t                       num_patched = 0;  // nodes added or removed since the plan was built
+        uint32_t                       num_unavailable_permanent = 0;
+        bool                           resetable_dirty = false; // resources were dropped or replaced, resetable must be rebuilt
+    };
+
+    node_arena                             m_node_arena; // storage for the resources and node classes
+    object_pool<exec_node>                 m_exec_pool;  // storage for the exec_nodes
+
+    std::vector< exec_node_p >             m_exec_nodes;
+    resource_table                         m_resources;
+    std::map< std::string, std::unique_ptr<stream_base> > m_streams;
+    uint32_t                               m_next_node_id = 0;
+
+    compiled_plan m_plan;
+    bool          m_compiled = false;
+
+    std::vector<exec_node*> m_roots;                     // cached list of root nodes
+    std::vector<exec_node*> m_batch;                     // scratch space used by schedule_roots()
+    bool                    m_roots_dirty = true;
+    bool                    m_roots_wait_on_permanent = false; // some node is waiting on a permanent resource
+
+    std::unique_ptr<frame_arena> m_arena; // optional arena backing the resetable resources
+    registration_scope         * m_scope = nullptr; // set by graph_template and graph_serializer while they add nodes
+    bool                         m_defer_plan = false; // set by graph_template, the nodes are added with add_instance()
+    node_profiler              * m_profiler = nullptr; // optional, not owned
+#if GRAPHE_METRICS
+    graph_metrics              * m_metrics = nullptr;  // optional, not owned
+    time_point                   m_frame_start;        // when the roots of the current frame were scheduled
+#endif
+    bool                         m_incremental = false; // skip nodes whose inputs have not changed
+    bool                         m_validate = true;     // compile() checks the topology
+    std::vector<std::string>     m_domains;             // names of the named execution domains
+    bool                         m_defer_notify = false; // see set_deferred_notify()
+    bool                         m_release_transients = false; // see set_release_transients()
+    bool                         m_fuse = false;        // see set_fusion()
+    bool                         m_has_fused = false;   // some node is fused to its predecessor
+    double                       m_fuse_cost = 5.0;     // nodes up to this cost are fused, in microseconds
+
+    std::atomic<uint32_t> m_numRunning{0};   // number of nodes currently inside their body
+    std::atomic<uint32_t> m_numToExecute{0}; // number of scheduled nodes which have not finished
+    std::atomic<uint32_t> m_numSuspended{0}; // number of async nodes waiting for complete()
+
+    std::mutex            m_error_lock;       // protects m_error
+    std::exception_ptr    m_error;            // first error of the frame, see set_error()
+    std::atomic<bool>     m_has_error{false}; // m_error is set, lets take_error() skip the lock
+
+   friend class exec_node;
+   friend class resource_node;
+   friend class async_handle;
+   friend class graph_template;
+   friend class graph_serializer;
+   friend class ResourceRegistry;
+
+   std::function<void(exec_node*)>  onSchedule;
+   std::function<void(exec_node * const *, size_t)> onScheduleBatch;
    std::function<void(void)>        onFinished;
+   completion_event                 m_completed;
+   std::function<void(std::function<void(void)>)> onTask;
+   size_t                           m_task_concurrency = 1;
 };
 
 inline void exec_node::trigger()
 {
     if( can_execute() )
     {
-        if(!m_scheduled)
+        try_schedule();
+    }
+}
+
+inline bool exec_node::try_schedule()
+{
+    bool expected = false;
+    if( m_scheduled.compare_exchange_strong(expected, true, std::memory_order_acq_rel) )
+    {
+        m_Graph->schedule_node(this);
+        return true;
+    }
+    return false;
+}
+
+inline void async_handle::complete()
+{
+    if( !m_node )
+        throw std::logic_error("async_handle::complete() called on a handle which is not valid");
+    auto N = m_node;
+    m_node = nullptr;
+    auto graph = N->m_Graph;
+    graph->m_numSuspended.fetch_sub(1, std::memory_order_relaxed);
+    graph->finish_node(N);
+}
+
+inline stream_base * ResourceRegistry::find_stream(std::string const & name) const
+{
+    return m_Node->m_Graph->get_stream(name);
+}
+
+inline stream_base * ResourceRegistry::add_stream(std::unique_ptr<stream_base> S)
+{
+    auto & streams = m_Node->m_Graph->m_streams;
+    auto p = S.get();
+    streams[p->get_name()] = std::move(S);
+    return p;
+}
+
+inline void node_graph::resource_available(uint32_t r)
+{
+    auto & P = m_plan;
+    for(auto i = P.succ_offsets[r]; i != P.succ_offsets[r+1]; ++i)
+    {
+        auto n = P.succ[i];
+        if( P.pending[n].fetch_sub(1, std::memory_order_acq_rel) == 1 && P.nodes[n] )
+        {
+            P.nodes[n]->try_schedule();
+        }
+    }
+    if( P.extra.empty() )
+        return;
+    for(auto n : P.extra[r])
+    {
+        if( P.pending[n].fetch_sub(1, std::memory_order_acq_rel) == 1 && P.nodes[n] )
         {
-            m_scheduled = true;
-            m_Graph->schedule_node(this);
+            P.nodes[n]->try_schedule();
         }
     }
 }
 
+template<typename T>
+inline std::pmr::memory_resource * out_resource<T>::memory_resource() const
+{
+    auto A = m_node->get_graph() ? m_node->get_graph()->get_frame_arena() : nullptr;
+    if( A && m_node->get_flags() != resource_flags::permanent )
+    {
+        m_node->m_arena_backed = true; // reset() must destroy the value before the arena is rewound
+        return A;
+    }
+    return std::pmr::get_default_resource();
+}
+
+inline void resource_node::notify_dependents()
+{
+    if( m_Graph && m_Graph->is_compiled() )
+    {
+        m_Graph->resource_available(m_index);
+        return;
+    }
+    for(auto n : m_Nodes)
+    {
+        n->trigger();
+    }
+}
+
+inline bool exec_node::inputs_unchanged() const
+{
+    if( !m_has_run || m_requiredResources.empty() )
+        return false;
+    for(auto r : m_requiredResources)
+    {
+        if( r->is_changed() )
+            return false;
+    }
+    for(auto r : m_producedResources)
+    {
+        if( r->get_flags() == resource_flags::moveable || !r->has_value() )
+            return false;
+    }
+    return true;
+}
+
 inline bool exec_node::can_execute() const
 {
-    for(auto & R : m_requiredResources)
+    for(auto r : m_requiredResources)
     {
-        auto r = R.lock();
-        if( r )
+        if( !r->is_available() )
         {
-            if( !r->is_available() )
-            {
-                return false;
-            }
-        } else {
             return false;
         }
     }
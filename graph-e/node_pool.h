@@ -0,0 +1,193 @@
+#pragma once
+
+#ifndef NODE_POOL_GRAPH_3_H
+#define NODE_POOL_GRAPH_3_H
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <utility>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace graphe
+{
+
+/**
+ * @brief The node_arena class
+ *
+ * Chunked, monotonic storage for objects whose lifetime is tied to the
+ * node_graph. Objects are constructed in place in large chunks, so that
+ * building a graph does not make one heap allocation per node. The arena
+ * never runs destructors, the owner must destroy the objects it created
+ * before the arena goes away.
+ *
+ * Storage given back with deallocate() is kept on a free list per size and
+ * alignment and reused by the next allocation of the same size, so nodes
+ * which are removed and added again do not grow the arena.
+ */
+class node_arena
+{
+public:
+    explicit node_arena(std::size_t chunk_size = 64*1024) : m_chunk_size(chunk_size)
+    {
+    }
+
+    node_arena( node_arena const & other) = delete;
+    node_arena & operator = ( node_arena const & other) = delete;
+
+    void * allocate(std::size_t bytes, std::size_t alignment)
+    {
+        bytes = std::max(bytes, sizeof(void*)); // room for the free list link
+        if( m_num_free != 0 )
+        {
+            auto it = m_free.find( size_class(bytes, alignment) );
+            if( it != m_free.end() && it->second )
+            {
+                auto p = it->second;
+                std::memcpy(&it->second, p, sizeof(void*));
+                --m_num_free;
+                return p;
+            }
+        }
+
+        auto p = align(m_ptr, alignment);
+        if( m_ptr == nullptr || p + bytes > m_end )
+        {
+            // objects larger than a quarter of a chunk get their own chunk
+            auto size = std::max(bytes + alignment, bytes > m_chunk_size/4 ? std::size_t(0) : m_chunk_size);
+            m_chunks.emplace_back( new std::byte[size] );
+            m_ptr = m_chunks.back().get();
+            m_end = m_ptr + size;
+            p     = align(m_ptr, alignment);
+        }
+        m_ptr = p + bytes;
+        return p;
+    }
+
+    /**
+     * @brief deallocate
+     * @param p - returned by allocate(bytes, alignment)
+     * @param bytes
+     * @param alignment
+     *
+     * Gives the storage back to be reused. The object must already have
+     * been destroyed.
+     */
+    void deallocate(void * p, std::size_t bytes, std::size_t alignment)
+    {
+        bytes = std::max(bytes, sizeof(void*));
+        auto & head = m_free[ size_class(bytes, alignment) ];
+        std::memcpy(p, &head, sizeof(void*));
+        head = p;
+        ++m_num_free;
+    }
+
+    template<typename T, typename... _Args>
+    T * create(_Args&&... __args)
+    {
+        auto p = allocate(sizeof(T), alignof(T));
+        try
+        {
+            return new (p) T( std::forward<_Args>(__args)...);
+        }
+        catch(...)
+        {
+            deallocate(p, sizeof(T), alignof(T));
+            throw;
+        }
+    }
+
+protected:
+    static std::uint64_t size_class(std::size_t bytes, std::size_t alignment)
+    {
+        return (std::uint64_t(bytes) << 16) ^ std::uint64_t(alignment);
+    }
+
+    static std::byte * align(std::byte * p, std::size_t alignment)
+    {
+        auto i = reinterpret_cast<std::uintptr_t>(p);
+        return reinterpret_cast<std::byte*>( (i + alignment - 1) & ~(std::uintptr_t(alignment) - 1) );
+    }
+
+    std::size_t                            m_chunk_size;
+    std::vector< std::unique_ptr<std::byte[]> > m_chunks;
+    std::byte                            * m_ptr = nullptr;
+    std::byte                            * m_end = nullptr;
+    std::unordered_map<std::uint64_t, void*> m_free;     // size class -> first free block, linked through the blocks
+    std::size_t                            m_num_free = 0;
+};
+
+/**
+ * @brief The object_pool class
+ *
+ * Fixed-size slots for objects of type T, allocated from chunks. Destroyed
+ * objects put their slot on a free list, so it is reused by the next create().
+ * Pointers returned by create() stay valid until the object is destroyed.
+ */
+template<typename T>
+class object_pool
+{
+    union slot
+    {
+        slot() {}
+        ~slot() {}
+        slot * m_next;
+        alignas(T) std::byte m_storage[sizeof(T)];
+    };
+
+public:
+    explicit object_pool(std::size_t chunk_count = 256) : m_chunk_count(chunk_count ? chunk_count : 1)
+    {
+    }
+
+    object_pool( object_pool const & other) = delete;
+    object_pool & operator = ( object_pool const & other) = delete;
+
+    template<typename... _Args>
+    T * create(_Args&&... __args)
+    {
+        if( m_free == nullptr )
+        {
+            m_chunks.emplace_back( new slot[m_chunk_count] );
+            auto c = m_chunks.back().get();
+            for(std::size_t i=0; i < m_chunk_count; ++i)
+            {
+                c[i].m_next = m_free;
+                m_free = &c[i];
+            }
+        }
+        auto s = m_free;
+        m_free = s->m_next;
+        try
+        {
+            return new (s->m_storage) T( std::forward<_Args>(__args)...);
+        }
+        catch(...)
+        {
+            s->m_next = m_free;
+            m_free = s;
+            throw;
+        }
+    }
+
+    void destroy(T * p)
+    {
+        p->~T();
+        auto s = reinterpret_cast<slot*>(p);
+        s->m_next = m_free;
+        m_free = s;
+    }
+
+protected:
+    std::size_t                           m_chunk_count;
+    std::vector< std::unique_ptr<slot[]> > m_chunks;
+    slot                                * m_free = nullptr;
+};
+
+}
+
+#endif
@@ -0,0 +1,312 @@
+#pragma once
+
+#ifndef PIPELINED_EXECUTE_GRAPH_3_H
+#define PIPELINED_EXECUTE_GRAPH_3_H
+
+#include "node_graph.h"
+#include <condition_variable>
+#include <mutex>
+
+namespace graphe
+{
+
+/**
+ * @brief The pipelined_executor class
+ *
+ * Runs up to K frames at the same time. Each frame in flight has its own
+ * copy of the graph, created by calling the build function K times, so the
+ * resources of frame N+1 never overwrite those of frame N. A node of frame
+ * N+1 starts as soon as its own inputs are available and the same node has
+ * finished executing frame N, so the frames overlap instead of waiting for
+ * each other to drain.
+ *
+ * Nodes run on a thread pool, using the same wrapper as threaded_executor.
+ * submit() must only be called from one thread. Since every copy of the
+ * graph has its own nodes, one-shot nodes run once per copy.
+ * An async node counts as finished for the next frame once its body
+ * returns, not when it calls async_handle::complete().
+ */
+template<typename ThreadPool_t>
+class pipelined_executor
+{
+public:
+    pipelined_executor(size_t frames_in_flight, std::function<void(node_graph&)> build)
+    {
+        if( frames_in_flight == 0 )
+            frames_in_flight = 1;
+
+        for(size_t i=0; i < frames_in_flight; ++i)
+        {
+            m_slots.emplace_back( new slot() );
+            build(m_slots.back()->m_graph);
+            m_slots.back()->m_graph.compile();
+        }
+
+        m_num_ids = m_slots.front()->m_graph.get_num_node_ids();
+        for(auto & S : m_slots)
+        {
+            if( S->m_graph.get_num_node_ids() != m_num_ids || S->m_graph.get_exec_nodes().size() != m_slots.front()->m_graph.get_exec_nodes().size() )
+                throw std::runtime_error("pipelined_executor: the build function must create the same graph every time");
+        }
+
+        m_done.reset( new std::atomic<uint64_t>[m_num_ids] );
+        for(size_t i=0; i < m_num_ids; ++i)
+            m_done[i].store(0, std::memory_order_relaxed);
+
+        for(auto & s : m_slots)
+        {
+            auto S = s.get();
+            S->m_parked.reset( new std::atomic<uint64_t>[m_num_ids] );
+            for(size_t i=0; i < m_num_ids; ++i)
+                S->m_parked[i].store(0, std::memory_order_relaxed);
+
+            S->m_tasks.resize(m_num_ids);
+            for(auto N : S->m_graph.get_exec_nodes())
+            {
+                S->m_tasks[N->get_id()] = [this, S, N]() { run(*S, N); };
+            }
+
+            // every ready node has to go through ready(), a node kept by
+            // deferred notification or fusion would skip the previous frame check.
+            S->m_graph.set_deferred_notify(false);
+            S->m_graph.set_fusion(false);
+            S->m_graph.clearOnScheduleBatch();
+            S->m_graph.clearOnTask();
+
+            S->m_graph.setOnSchedule(
+            [this, S](exec_node * N)
+            {
+                ready(*S, N);
+            });
+
+            S->m_graph.setOnComplete(
+            [this, S]()
+            {
+                frame_finished(*S);
+            });
+        }
+    }
+
+    ~pipelined_executor()
+    {
+        wait();
+        for(auto & S : m_slots)
+        {
+            S->m_graph.clearOnSchedule();
+            S->m_graph.clearOnScheduleBatch();
+            S->m_graph.clearOnComplete();
+            S->m_graph.clearOnTask();
+        }
+    }
+
+    pipelined_executor( pipelined_executor const & other) = delete;
+    pipelined_executor & operator = ( pipelined_executor const & other) = delete;
+
+    void set_thread_pool(ThreadPool_t * T)
+    {
+        m_thread_pool = T;
+    }
+
+    ThreadPool_t * get_thread_pool() const
+    {
+        return m_thread_pool;
+    }
+
+    size_t frames_in_flight() const
+    {
+        return m_slots.size();
+    }
+
+    /**
+     * @brief get_graph
+     * @param frame
+     * @return
+     *
+     * Returns the copy of the graph which executes the given frame.
+     */
+    node_graph & get_graph(uint64_t frame)
+    {
+        return m_slots[ frame % m_slots.size() ]->m_graph;
+    }
+
+    /**
+     * @brief submit
+     * @return
+     *
+     * Starts the next frame and returns its number. If K frames are already
+     * in flight, blocks until the oldest one has finished.
+     */
+    uint64_t submit()
+    {
+        std::unique_lock<std::mutex> lk(m_lock);
+        auto f   = m_next_frame;
+        auto K   = m_slots.size();
+        auto & S = *m_slots[f % K];
+
+        // the slot is free once its last frame, and every frame before it, has finished
+        m_cv.wait(lk, [&] { return S.m_idle && m_completed + K > f; });
+        S.m_idle = false;
+        ++m_next_frame;
+        lk.unlock();
+
+        if( f >= K )
+            S.m_graph.reset();
+        S.m_frame.store(f, std::memory_order_release);
+        S.m_graph.schedule_roots();
+        return f;
+    }
+
+    /**
+     * @brief wait
+     * @param frame
+     *
+     * Waits until the given frame, and every frame before it, has finished.
+     */
+    void wait(uint64_t frame)
+    {
+        {
+            std::unique_lock<std::mutex> lk(m_lock);
+            m_cv.wait(lk, [&] { return m_completed > frame || m_completed == m_next_frame; });
+        }
+        rethrow_error();
+    }
+
+    /**
+     * @brief wait
+     *
+     * Waits until all the submitted frames have finished.
+     */
+    void wait()
+    {
+        {
+            std::unique_lock<std::mutex> lk(m_lock);
+            m_cv.wait(lk, [&] { return m_completed == m_next_frame && m_tasks_in_flight.load() == 0; });
+        }
+        rethrow_error();
+    }
+
+protected:
+    /**
+     * Throws the first error recorded by any copy of the graph, see
+     * node_graph::set_error().
+     */
+    void rethrow_error()
+    {
+        for(auto & S : m_slots)
+            S->m_graph.rethrow_error();
+    }
+
+    struct slot
+    {
+        node_graph                                  m_graph;
+        std::atomic<uint64_t>                       m_frame{0};  // frame currently executed by this copy
+        bool                                        m_idle = true;
+        std::unique_ptr< std::atomic<uint64_t>[] >  m_parked;    // frame+1 of a node waiting for its previous frame, or 0
+        std::vector< std::function<void(void)> >    m_tasks;     // node id -> task posted to the thread pool
+    };
+
+    void dispatch(slot & S, size_t id)
+    {
+        m_tasks_in_flight.fetch_add(1, std::memory_order_relaxed);
+        m_thread_pool->operator()( S.m_tasks[id] );
+    }
+
+    /**
+     * Called when a node of slot S is ready. It is dispatched if the same
+     * node has finished the previous frame, otherwise it is parked and
+     * dispatched by node_done().
+     */
+    void ready(slot & S, exec_node * N)
+    {
+        auto id = N->get_id();
+        auto f  = S.m_frame.load(std::memory_order_acquire);
+
+        if( m_done[id].load() >= f )
+        {
+            dispatch(S, id);
+            return;
+        }
+
+        S.m_parked[id].store(f+1);
+        // the previous frame may have finished in between, if so, whoever
+        // clears the parked entry dispatches the node
+        if( m_done[id].load() >= f )
+        {
+            uint64_t expected = f+1;
+            if( S.m_parked[id].compare_exchange_strong(expected, 0) )
+                dispatch(S, id);
+        }
+    }
+
+    /**
+     * Records that node id has finished frame f and releases the same
+     * node of frame f+1 if it was parked.
+     */
+    void node_done(size_t id, uint64_t f)
+    {
+        auto cur = m_done[id].load();
+        while( cur < f+1 && !m_done[id].compare_exchange_weak(cur, f+1) )
+        {
+        }
+
+        auto & next = *m_slots[ (f+1) % m_slots.size() ];
+        uint64_t expected = f+2;
+        if( next.m_parked[id].load() == expected && next.m_parked[id].compare_exchange_strong(expected, 0) )
+            dispatch(next, id);
+    }
+
+    void run(slot & S, exec_node * N)
+    {
+        auto f  = S.m_frame.load(std::memory_order_acquire);
+        auto id = N->get_id();
+        N->execute();
+        node_done(id, f);
+
+        // the frame may have finished inside execute(), wait() must
+        // not return while a task is still using the executor.
+        if( m_tasks_in_flight.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            m_cv.notify_all();
+        }
+    }
+
+    /**
+     * Called when all the nodes of the frame executed by slot S have finished.
+     * Frames are retired in order. Nodes which did not execute in a retired
+     * frame are marked as done so they do not hold up the next frame.
+     */
+    void frame_finished(slot & S)
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        S.m_idle = true;
+
+        auto K = m_slots.size();
+        while( m_completed < m_next_frame )
+        {
+            auto & T = *m_slots[ m_completed % K ];
+            if( !T.m_idle || T.m_frame.load(std::memory_order_relaxed) != m_completed )
+                break;
+            for(size_t id=0; id < m_num_ids; ++id)
+                node_done(id, m_completed);
+            ++m_completed;
+        }
+        m_cv.notify_all();
+    }
+
+    std::vector< std::unique_ptr<slot> >     m_slots;
+    size_t                                   m_num_ids = 0;
+    std::unique_ptr< std::atomic<uint64_t>[] > m_done; // node id -> number of frames the node has finished
+
+    ThreadPool_t                           * m_thread_pool = nullptr;
+
+    std::mutex                               m_lock;    // protects m_next_frame, m_completed and slot::m_idle
+    std::condition_variable                  m_cv;
+    uint64_t                                 m_next_frame = 0;
+    uint64_t                                 m_completed  = 0; // frames before this one have all finished
+    std::atomic<uint32_t>                    m_tasks_in_flight{0};
+};
+
+}
+
+#endif
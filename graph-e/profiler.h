@@ -0,0 +1,247 @@
+#pragma once
+
+#ifndef PROFILER_GRAPH_3_H
+#define PROFILER_GRAPH_3_H
+
+#include "thread_slots.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <algorithm>
+#include <cstdint>
+
+namespace graphe
+{
+
+/**
+ * @brief The node_profiler class
+ *
+ * Records when every exec_node was scheduled, started and finished, and
+ * which worker ran it. Each thread writes into its own ring buffer, so
+ * recording an event takes no locks once the thread has been seen. When a
+ * ring is full the oldest events are overwritten.
+ *
+ * Attach it with node_graph::set_profiler(). collect() and
+ * write_chrome_trace() must only be called while the graph is not executing.
+ */
+class node_profiler
+{
+public:
+    using clock      = std::chrono::steady_clock;
+    using time_point = clock::time_point;
+
+    static constexpr uint32_t invalid_id = ~uint32_t(0);
+
+    struct event
+    {
+        uint32_t node;         // index into get_node_names()
+        uint32_t worker;       // index of the thread which executed the node
+        uint32_t frame;        // frame number, incremented by next_frame()
+        int64_t  scheduled_ns; // times in nanoseconds since the profiler was created
+        int64_t  start_ns;
+        int64_t  end_ns;
+    };
+
+    explicit node_profiler(size_t events_per_thread = 1u << 16) :
+        m_capacity( events_per_thread ? events_per_thread : 1 ),
+        m_epoch( clock::now() )
+    {
+    }
+
+    node_profiler( node_profiler const & other) = delete;
+    node_profiler & operator = ( node_profiler const & other) = delete;
+
+    /**
+     * @brief record
+     * @param node_id - the node's profile id, assigned on first use
+     * @param name    - the name of the node, copied the first time the node is seen
+     *
+     * Records one execution of a node.
+     */
+    void record(uint32_t & node_id, std::string const & name, time_point scheduled, time_point start, time_point end)
+    {
+        if( node_id == invalid_id )
+            node_id = register_node(name);
+
+        auto & r = local_ring();
+        auto i = r.m_count.load(std::memory_order_relaxed);
+        auto & e = r.m_events[ i % m_capacity ];
+        e.node         = node_id;
+        e.worker       = r.m_worker;
+        e.frame        = m_frame.load(std::memory_order_relaxed);
+        e.scheduled_ns = to_ns(scheduled);
+        e.start_ns     = to_ns(start);
+        e.end_ns       = to_ns(end);
+        r.m_count.store(i+1, std::memory_order_release);
+    }
+
+    /**
+     * @brief next_frame
+     *
+     * Starts a new frame. node_graph::reset() calls this.
+     */
+    void next_frame()
+    {
+        m_frame.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint32_t get_frame() const
+    {
+        return m_frame.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief collect
+     * @return
+     *
+     * Returns all the recorded events which are still in the ring
+     * buffers, sorted by start time.
+     */
+    std::vector<event> collect() const
+    {
+        std::vector<event> out;
+        std::lock_guard<std::mutex> lk(m_mutex);
+        for(auto & r : m_rings.all())
+        {
+            auto count = r->m_count.load(std::memory_order_acquire);
+            auto first = count > m_capacity ? count - m_capacity : 0;
+            for(auto i = first; i < count; ++i)
+                out.push_back( r->m_events[ i % m_capacity ] );
+        }
+        std::sort(out.begin(), out.end(), [](event const & a, event const & b) { return a.start_ns < b.start_ns; });
+        return out;
+    }
+
+    /**
+     * @brief get_node_names
+     * @return
+     *
+     * Names of the nodes referenced by event::node.
+     */
+    std::vector<std::string> get_node_names() const
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        return m_names;
+    }
+
+    size_t num_workers() const
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        return m_rings.all().size();
+    }
+
+    /**
+     * @brief clear
+     *
+     * Discards all recorded events.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        for(auto & r : m_rings.all())
+            r->m_count.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief write_chrome_trace
+     * @param out
+     *
+     * Writes the recorded events in the Chrome trace-event JSON format,
+     * which can be loaded into chrome://tracing or Perfetto. Each worker
+     * is shown as a thread, each node execution as a complete event. The
+     * time the node spent queued is stored in its args.
+     */
+    void write_chrome_trace(std::ostream & out) const
+    {
+        auto events = collect();
+        auto names  = get_node_names();
+        auto workers = num_workers();
+
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for(size_t w=0; w < workers; ++w)
+        {
+            out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << w
+                << ",\"args\":{\"name\":\"worker " << w << "\"}}";
+            first = false;
+        }
+        for(auto & e : events)
+        {
+            out << (first ? "" : ",") << "\n{\"name\":\"";
+            write_escaped(out, names[e.node]);
+            out << "\",\"cat\":\"node\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.worker
+                << ",\"ts\":"  << to_us(e.start_ns)
+                << ",\"dur\":" << to_us(e.end_ns - e.start_ns)
+                << ",\"args\":{\"frame\":" << e.frame
+                << ",\"queued_us\":" << to_us(e.start_ns - e.scheduled_ns) << "}}";
+            first = false;
+        }
+        out << "\n]}\n";
+    }
+
+protected:
+    struct ring
+    {
+        explicit ring(size_t capacity, uint32_t worker) : m_events(capacity), m_worker(worker)
+        {
+        }
+        std::vector<event>    m_events;
+        std::atomic<uint64_t> m_count{0}; // number of events ever written
+        uint32_t              m_worker;
+    };
+
+    int64_t to_ns(time_point t) const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t - m_epoch).count();
+    }
+
+    static double to_us(int64_t ns)
+    {
+        return static_cast<double>(ns) / 1000.0;
+    }
+
+    static void write_escaped(std::ostream & out, std::string const & s)
+    {
+        for(auto c : s)
+        {
+            if( c == '"' || c == '\\' ) out << '\\' << c;
+            else if( static_cast<unsigned char>(c) < 0x20 ) out << ' ';
+            else out << c;
+        }
+    }
+
+    uint32_t register_node(std::string const & name)
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_names.push_back(name);
+        return static_cast<uint32_t>(m_names.size()-1);
+    }
+
+    /**
+     * Returns the ring of the calling thread, creating it the first time
+     * the thread records an event for this profiler.
+     */
+    ring & local_ring()
+    {
+        return m_rings.local(m_mutex, [this](size_t worker)
+        {
+            return std::make_unique<ring>( m_capacity, static_cast<uint32_t>(worker) );
+        });
+    }
+
+    size_t                               m_capacity;
+    time_point                           m_epoch;
+    std::atomic<uint32_t>                m_frame{0};
+
+    mutable std::mutex                   m_mutex;    // protects m_rings and m_names
+    thread_slots<ring>                   m_rings;    // one ring per thread
+    std::vector<std::string>             m_names;
+};
+
+}
+
+#endif
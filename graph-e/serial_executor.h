@@ -4,44 +4,134 @@
 #define SERIAL_EXECUTE_GRAPH_3_H
 
 #include "node_graph.h"
+#include "completion_event.h"
+#include <mutex>
+#include <thread>
 
 namespace graphe
 {
 
-
+/**
+ * @brief The serial_executor class
+ *
+ * Executes the graph on the calling thread. Ready nodes are executed in
+ * order of their critical-path rank (see node_graph::compute_ranks()),
+ * nodes with the same rank are executed in the order they were scheduled.
+ *
+ * If the graph has async nodes, execute() waits for them to complete and
+ * runs the nodes they make ready. Nodes scheduled on the calling thread
+ * go straight onto the queue, only the ones scheduled by async nodes
+ * completing on other threads take a lock.
+ */
 class serial_executor
 {
 public:
     serial_executor(node_graph & graph) : m_graph(graph)
     {
+        // nodes are run one at a time, no hook left behind by another
+        // executor may hand them or parallel_for() chunks to other threads
+        m_graph.clearOnScheduleBatch();
+        m_graph.clearOnTask();
         m_graph.setOnSchedule(
         [this](exec_node *N)
         {
-            m_ToExecute.push(N);
+            if( std::this_thread::get_id() == m_thread )
+            {
+                m_ToExecute.push( entry{N, m_count++} );
+                return;
+            }
+            // an async node completed on another thread
+            {
+                std::lock_guard<std::mutex> lk(m_lock);
+                m_remote.push_back(N);
+            }
+            m_wake.notify_all();
+        });
+
+        m_graph.setOnComplete(
+        [this]()
+        {
+            if( std::this_thread::get_id() != m_thread )
+                m_wake.notify_all();
         });
     }
 
+    ~serial_executor()
+    {
+        m_graph.clearOnSchedule();
+        m_graph.clearOnScheduleBatch();
+        m_graph.clearOnComplete();
+        m_graph.clearOnTask();
+    }
+
+    serial_executor( serial_executor const & other) = delete;
+    serial_executor & operator = ( serial_executor const & other) = delete;
+
     void execute()
     {
-        for(auto & N : m_graph.get_exec_nodes()) // place all the nodes with no resource requirements onto the queue.
-        {
-            if( N->can_execute() )
-            {
-                m_graph.schedule_node(N.get());
-            }
-        }
+        m_thread = std::this_thread::get_id();
+        m_graph.schedule_roots(); // place all the nodes with no resource requirements onto the queue.
         // execute the all nodes in the queue.
         // New nodes will be added
-        while( m_ToExecute.size() )
+        for(;;)
         {
-            m_ToExecute.front()->execute();
-            m_ToExecute.pop();
+            if( m_ToExecute.size() )
+            {
+                auto N = m_ToExecute.top().node;
+                m_ToExecute.pop();
+                N->execute();
+                continue;
+            }
+            auto seen = m_wake.epoch();
+            if( take_remote() )
+                continue;
+            if( !m_graph.busy() )
+                break;
+            m_wake.wait(seen); // an async node has not completed yet
         }
+        m_count = 0;
+        m_graph.rethrow_error();
     }
 
 protected:
+    /**
+     * Moves the nodes scheduled by other threads onto the queue. Returns
+     * false if there were none.
+     */
+    bool take_remote()
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        if( m_remote.empty() )
+            return false;
+        for(auto N : m_remote)
+            m_ToExecute.push( entry{N, m_count++} );
+        m_remote.clear();
+        return true;
+    }
+
+    struct entry
+    {
+        exec_node * node;
+        uint64_t    order; // breaks ties between nodes of equal rank
+    };
+
+    struct lower_priority
+    {
+        bool operator()(entry const & a, entry const & b) const
+        {
+            if( a.node->get_rank() != b.node->get_rank() )
+                return a.node->get_rank() < b.node->get_rank();
+            return a.order > b.order;
+        }
+    };
+
     node_graph                 & m_graph;
-    std::queue<exec_node*>       m_ToExecute;
+    std::priority_queue<entry, std::vector<entry>, lower_priority> m_ToExecute;
+    uint64_t                     m_count = 0;
+    std::thread::id              m_thread; // the thread which calls execute(), the only one which touches m_ToExecute
+    std::mutex                   m_lock;   // protects m_remote
+    std::vector<exec_node*>      m_remote; // scheduled by other threads
+    completion_event             m_wake;   // signalled when m_remote grows or the graph finishes off-thread
 
 };
 
@@ -0,0 +1,266 @@
+#pragma once
+
+#ifndef STREAM_EXECUTE_GRAPH_3_H
+#define STREAM_EXECUTE_GRAPH_3_H
+
+#include "node_graph.h"
+#include <condition_variable>
+#include <mutex>
+
+namespace graphe
+{
+
+/**
+ * @brief The stream_executor class
+ *
+ * Runs the stream nodes of a graph (see ResourceRegistry::register_input_stream()
+ * and register_output_stream()) on a thread pool, using the same wrapper as
+ * threaded_executor. There are no frames: nodes run whenever they can make
+ * progress, until every stream has been closed and drained.
+ *
+ *  - a node with input streams runs while any of its inputs has items. Once
+ *    all its inputs are closed and empty it runs one last time, so it can
+ *    flush, and its output streams are closed.
+ *  - a node without input streams (a source) runs until it has closed all
+ *    its output streams.
+ *  - a node never runs while one of its output streams is full. It is woken
+ *    again when a consumer pops an item, so full queues push back on the
+ *    producers.
+ *
+ * A node runs at most batch times in a row before it is posted to the
+ * thread pool again, so one busy node does not hold a worker forever. Each
+ * node is only ever run by one thread at a time.
+ *
+ * The frame executors ignore stream nodes and stream_executor ignores the
+ * other nodes, as well as stream nodes added after it was created. A stream node may read permanent resources produced by
+ * one-shot nodes, as long as the graph has been executed once beforehand.
+ */
+template<typename ThreadPool_t>
+class stream_executor
+{
+public:
+    stream_executor(node_graph & graph, size_t batch = 64) :
+        m_graph(graph),
+        m_batch( batch ? batch : 1 )
+    {
+        m_by_id.resize( m_graph.get_num_node_ids(), nullptr );
+        for(auto N : m_graph.get_exec_nodes())
+        {
+            if( N->is_stream_node() )
+            {
+                m_nodes.emplace_back( new node_state() );
+                auto S = m_nodes.back().get();
+                S->m_node = N;
+                S->m_task = [this, S]() { run(*S); };
+                m_by_id[N->get_id()] = S;
+            }
+        }
+
+        for(auto & S : m_graph.get_streams())
+        {
+            if( S.second->num_producers() == 0 )
+                throw std::runtime_error( std::string("Stream ") + S.first + std::string(" has no producer") );
+            if( S.second->get_consumers().empty() )
+                throw std::runtime_error( std::string("Stream ") + S.first + std::string(" has no consumer") );
+
+            S.second->set_wake_hook(
+            [this](exec_node * N)
+            {
+                wake(N);
+            });
+        }
+    }
+
+    ~stream_executor()
+    {
+        wait();
+        for(auto & S : m_graph.get_streams())
+            S.second->clear_wake_hook();
+    }
+
+    stream_executor( stream_executor const & other) = delete;
+    stream_executor & operator = ( stream_executor const & other) = delete;
+
+    void set_thread_pool(ThreadPool_t * T)
+    {
+        m_thread_pool = T;
+    }
+
+    ThreadPool_t * get_thread_pool() const
+    {
+        return m_thread_pool;
+    }
+
+    /**
+     * @brief start
+     *
+     * Reopens all the streams and starts running the stream nodes.
+     * Returns immediately, call wait() to wait for the streams to finish.
+     */
+    void start()
+    {
+        wait();
+        for(auto & S : m_graph.get_streams())
+            S.second->reopen();
+
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            m_finished = 0;
+            m_started  = true;
+            for(auto & S : m_nodes)
+                S->m_finished = false;
+        }
+        for(auto & S : m_nodes)
+            wake(S->m_node);
+    }
+
+    /**
+     * @brief wait
+     *
+     * Waits until every stream node has finished.
+     */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lk(m_lock);
+        m_cv.wait(lk, [&] { return !m_started || (m_finished == m_nodes.size() && m_tasks_in_flight.load() == 0); });
+    }
+
+    /**
+     * @brief execute
+     *
+     * Runs the streams to completion.
+     */
+    void execute()
+    {
+        start();
+        wait();
+    }
+
+protected:
+    struct node_state
+    {
+        exec_node               * m_node = nullptr;
+        std::atomic<uint32_t>     m_signals{0}; // wake-ups since the node was last posted, 0 if it is idle
+        bool                      m_finished = false;
+        std::function<void(void)> m_task;
+    };
+
+    enum class readiness
+    {
+        idle,  // nothing to do until the node is woken
+        run,   // run the body
+        last,  // run the body one last time and close the outputs
+        done,  // close the outputs without running the body
+    };
+
+    void post(node_state & S)
+    {
+        m_tasks_in_flight.fetch_add(1, std::memory_order_relaxed);
+        m_thread_pool->operator()( S.m_task );
+    }
+
+    void wake(exec_node * N)
+    {
+        // nodes added after the executor was created are not run by it, like frame nodes
+        auto id = N->get_id();
+        auto S  = id < m_by_id.size() ? m_by_id[id] : nullptr;
+        if( S && S->m_signals.fetch_add(1, std::memory_order_acq_rel) == 0 )
+            post(*S);
+    }
+
+    static readiness check(exec_node const * N)
+    {
+        auto & outputs = N->get_stream_outputs();
+        bool all_closed = !outputs.empty();
+        for(auto & o : outputs)
+        {
+            if( o.first->full() )
+                return readiness::idle;
+            all_closed = all_closed && o.first->is_closed_by(o.second);
+        }
+
+        auto & inputs = N->get_stream_inputs();
+        if( inputs.empty() )
+            return all_closed ? readiness::done : readiness::run;
+
+        bool eof = true;
+        for(auto i : inputs)
+        {
+            if( !i->empty() )
+                return readiness::run;
+            eof = eof && i->eof();
+        }
+        return eof ? readiness::last : readiness::idle;
+    }
+
+    void finish(node_state & S)
+    {
+        for(auto & o : S.m_node->get_stream_outputs())
+            o.first->close(o.second);
+
+        std::lock_guard<std::mutex> lk(m_lock);
+        S.m_finished = true;
+        if( ++m_finished == m_nodes.size() )
+            m_cv.notify_all();
+    }
+
+    void run(node_state & S)
+    {
+        size_t calls = 0;
+        for(;;)
+        {
+            auto seen = S.m_signals.load(std::memory_order_acquire);
+            while( !S.m_finished )
+            {
+                auto r = check(S.m_node);
+                if( r == readiness::idle )
+                    break;
+                if( calls == m_batch )
+                {
+                    // still has work, give the worker back and carry on later.
+                    // the node stays signalled so nobody else posts it.
+                    post(S);
+                    task_done();
+                    return;
+                }
+                if( r != readiness::done )
+                {
+                    S.m_node->step();
+                    ++calls;
+                }
+                if( r != readiness::run )
+                    finish(S);
+            }
+            if( S.m_signals.compare_exchange_strong(seen, 0, std::memory_order_acq_rel) )
+                break;
+        }
+        task_done();
+    }
+
+    void task_done()
+    {
+        // wait() must not return while a task is still using the executor.
+        if( m_tasks_in_flight.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            m_cv.notify_all();
+        }
+    }
+
+    node_graph                               & m_graph;
+    size_t                                     m_batch;
+    ThreadPool_t                             * m_thread_pool = nullptr;
+
+    std::vector< std::unique_ptr<node_state> > m_nodes;
+    std::vector< node_state* >                 m_by_id;   // node id -> state, nullptr for frame nodes
+
+    std::mutex                                 m_lock;    // protects m_finished, m_started and node_state::m_finished
+    std::condition_variable                    m_cv;
+    size_t                                     m_finished = 0;
+    bool                                       m_started  = false;
+    std::atomic<uint32_t>                      m_tasks_in_flight{0};
+};
+
+}
+
+#endif
@@ -0,0 +1,512 @@
+#pragma once
+
+#ifndef STREAM_QUEUE_GRAPH_3_H
+#define STREAM_QUEUE_GRAPH_3_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <typeinfo>
+#include <thread>
+#include <new>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+namespace graphe
+{
+
+class exec_node;
+class node_graph;
+class ResourceRegistry;
+
+/**
+ * @brief The stream_base class
+ *
+ * The untyped part of a stream: a bounded queue between the nodes which
+ * push into it (producers) and the nodes which pop from it (consumers).
+ * The stream is closed once every producer has closed its end.
+ *
+ * stream_executor installs a wake hook, which is called for every consumer
+ * when an item is pushed or the stream is closed, and for every producer
+ * when an item is popped.
+ */
+class stream_base
+{
+public:
+    stream_base(std::string const & name, std::type_info const & type, size_t capacity) :
+        m_name(name),
+        m_type(&type),
+        m_capacity( round_capacity(capacity) )
+    {
+    }
+
+    virtual ~stream_base() = default;
+
+    stream_base( stream_base const & other) = delete;
+    stream_base & operator = ( stream_base const & other) = delete;
+
+    std::string const & get_name() const
+    {
+        return m_name;
+    }
+
+    std::type_info const & get_type() const
+    {
+        return *m_type;
+    }
+
+    /**
+     * @brief capacity
+     * @return
+     *
+     * The maximum number of queued items, the requested capacity rounded
+     * up to a power of two.
+     */
+    size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    virtual size_t size() const = 0;
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    bool full() const
+    {
+        return size() >= m_capacity;
+    }
+
+    /**
+     * @brief closed
+     * @return
+     *
+     * Returns true once every producer has closed the stream. Nothing is
+     * pushed after that, but items may still be queued.
+     */
+    bool closed() const
+    {
+        return m_open.load(std::memory_order_acquire) == 0;
+    }
+
+    /**
+     * @brief eof
+     * @return
+     *
+     * Returns true if the stream is closed and every item has been popped.
+     */
+    bool eof() const
+    {
+        return closed() && empty();
+    }
+
+    /**
+     * @brief is_closed_by
+     * @param producer - the producer's slot, see out_stream
+     */
+    bool is_closed_by(uint32_t producer) const
+    {
+        return m_closed[producer] != 0;
+    }
+
+    /**
+     * @brief close
+     * @param producer - the producer's slot, see out_stream
+     *
+     * Closes the producer's end of the stream. Closing it again does nothing.
+     */
+    void close(uint32_t producer)
+    {
+        if( m_closed[producer] )
+            return;
+        m_closed[producer] = 1;
+        if( m_open.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+            wake(m_consumers);
+    }
+
+    /**
+     * @brief reopen
+     *
+     * Reopens the stream for every producer. Called by stream_executor
+     * before it starts, the stream must not be in use.
+     */
+    void reopen()
+    {
+        uint32_t open = 0;
+        for(size_t i=0; i < m_producers.size(); ++i)
+        {
+            m_closed[i] = m_producers[i] ? 0 : 1;
+            open += m_closed[i] ? 0 : 1;
+        }
+        m_open.store(open, std::memory_order_release);
+    }
+
+    /**
+     * @brief num_producers
+     * @return
+     *
+     * Number of nodes pushing into the stream.
+     */
+    size_t num_producers() const
+    {
+        return m_producers.size() - static_cast<size_t>( std::count(m_producers.begin(), m_producers.end(), nullptr) );
+    }
+
+    std::vector<exec_node*> const & get_producers() const
+    {
+        return m_producers;
+    }
+
+    std::vector<exec_node*> const & get_consumers() const
+    {
+        return m_consumers;
+    }
+
+    void set_wake_hook(std::function<void(exec_node*)> f)
+    {
+        m_wake = f;
+    }
+
+    void clear_wake_hook()
+    {
+        m_wake = nullptr;
+    }
+
+protected:
+    friend class ResourceRegistry;
+    friend class node_graph;
+
+    static size_t round_capacity(size_t capacity)
+    {
+        size_t c = 2;
+        while( c < capacity )
+            c <<= 1;
+        return c;
+    }
+
+    uint32_t add_producer(exec_node * N)
+    {
+        m_producers.push_back(N);
+        m_closed.push_back(0);
+        m_open.fetch_add(1, std::memory_order_relaxed);
+        return static_cast<uint32_t>(m_producers.size()-1);
+    }
+
+    void add_consumer(exec_node * N)
+    {
+        m_consumers.push_back(N);
+    }
+
+    /**
+     * Unlinks a node which is being destroyed. Producer slots of the other
+     * nodes do not move, the node's slot is left closed.
+     */
+    void remove_node(exec_node * N)
+    {
+        for(size_t i=0; i < m_producers.size(); ++i)
+        {
+            if( m_producers[i] == N )
+            {
+                m_producers[i] = nullptr;
+                close( static_cast<uint32_t>(i) );
+            }
+        }
+        m_consumers.erase( std::remove(m_consumers.begin(), m_consumers.end(), N), m_consumers.end() );
+    }
+
+    void wake(std::vector<exec_node*> const & nodes) const
+    {
+        if( m_wake )
+        {
+            for(auto N : nodes)
+            {
+                if( N )
+                    m_wake(N);
+            }
+        }
+    }
+
+    void pushed() const
+    {
+        wake(m_consumers);
+    }
+
+    void popped() const
+    {
+        wake(m_producers);
+    }
+
+    virtual void set_capacity(size_t capacity) = 0;
+
+    std::string                        m_name;
+    std::type_info const             * m_type;
+    size_t                             m_capacity;
+    std::atomic<uint32_t>              m_open{0};   // number of producers which have not closed the stream
+    std::vector<uint8_t>               m_closed;    // producer slot -> has closed its end
+    std::vector<exec_node*>            m_producers;
+    std::vector<exec_node*>            m_consumers;
+    std::function<void(exec_node*)>    m_wake;
+};
+
+/**
+ * @brief The stream_queue class
+ *
+ * A bounded multi-producer, multi-consumer queue. Each cell carries a
+ * sequence number which tells pushers and poppers whether it is free or
+ * full, so neither side takes a lock.
+ */
+template<typename T>
+class stream_queue : public stream_base
+{
+public:
+    stream_queue(std::string const & name, size_t capacity) :
+        stream_base(name, typeid(T), capacity)
+    {
+        allocate();
+    }
+
+    ~stream_queue()
+    {
+        destroy_items();
+    }
+
+    size_t size() const override
+    {
+        auto tail = m_tail.load(std::memory_order_acquire);
+        auto head = m_head.load(std::memory_order_acquire);
+        return head > tail ? head - tail : 0;
+    }
+
+    /**
+     * @brief try_push
+     * @param v - only moved from if the push succeeds
+     * @return
+     *
+     * Returns false if the queue is full.
+     */
+    bool try_push(T && v)
+    {
+        auto pos = m_head.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            auto & c   = m_cells[pos & m_mask];
+            auto seq   = c.seq.load(std::memory_order_acquire);
+            auto diff  = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if( diff == 0 )
+            {
+                if( m_head.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed) )
+                {
+                    new (&c.storage) T( std::move(v) );
+                    c.seq.store(pos+1, std::memory_order_release);
+                    pushed();
+                    return true;
+                }
+            }
+            else if( diff < 0 )
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief try_pop
+     * @param v
+     * @return
+     *
+     * Returns false if the queue is empty.
+     */
+    bool try_pop(T & v)
+    {
+        if( !try_pop_quiet(v) )
+            return false;
+        popped();
+        return true;
+    }
+
+protected:
+    struct cell
+    {
+        std::atomic<size_t> seq;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    void allocate()
+    {
+        m_cells.reset( new cell[m_capacity] );
+        m_mask = m_capacity - 1;
+        for(size_t i=0; i < m_capacity; ++i)
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    void destroy_items()
+    {
+        auto head = m_head.load(std::memory_order_relaxed);
+        for(auto i = m_tail.load(std::memory_order_relaxed); i < head; ++i)
+            std::launder( reinterpret_cast<T*>(&m_cells[i & m_mask].storage) )->~T();
+    }
+
+    void set_capacity(size_t capacity) override
+    {
+        destroy_items();
+        m_capacity = round_capacity(capacity);
+        allocate();
+    }
+
+    bool try_pop_quiet(T & v)
+    {
+        auto pos = m_tail.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            auto & c   = m_cells[pos & m_mask];
+            auto seq   = c.seq.load(std::memory_order_acquire);
+            auto diff  = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos+1);
+            if( diff == 0 )
+            {
+                if( m_tail.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed) )
+                {
+                    auto p = std::launder( reinterpret_cast<T*>(&c.storage) );
+                    v = std::move(*p);
+                    p->~T();
+                    c.seq.store(pos + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if( diff < 0 )
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::unique_ptr<cell[]>          m_cells;
+    size_t                           m_mask = 0;
+    alignas(64) std::atomic<size_t>  m_head{0}; // next position to push
+    alignas(64) std::atomic<size_t>  m_tail{0}; // next position to pop
+};
+
+/**
+ * @brief The in_stream class
+ *
+ * The consumer's end of a stream, returned by
+ * ResourceRegistry::register_input_stream().
+ */
+template<typename T>
+class in_stream
+{
+    friend class ResourceRegistry;
+    stream_queue<T> * m_queue = nullptr;
+
+public:
+    bool try_pop(T & v)
+    {
+        return m_queue->try_pop(v);
+    }
+
+    size_t size() const
+    {
+        return m_queue->size();
+    }
+
+    bool empty() const
+    {
+        return m_queue->empty();
+    }
+
+    /**
+     * @brief eof
+     * @return
+     *
+     * Returns true once every producer has closed the stream and every
+     * item has been popped.
+     */
+    bool eof() const
+    {
+        return m_queue->eof();
+    }
+
+    std::string const & get_name() const
+    {
+        return m_queue->get_name();
+    }
+};
+
+/**
+ * @brief The out_stream class
+ *
+ * The producer's end of a stream, returned by
+ * ResourceRegistry::register_output_stream().
+ */
+template<typename T>
+class out_stream
+{
+    friend class ResourceRegistry;
+    stream_queue<T> * m_queue = nullptr;
+    uint32_t          m_slot  = 0;
+
+public:
+    bool try_push(T && v)
+    {
+        return m_queue->try_push( std::move(v) );
+    }
+
+    bool try_push(T const & v)
+    {
+        T c(v);
+        return m_queue->try_push( std::move(c) );
+    }
+
+    /**
+     * @brief push
+     * @param v
+     *
+     * Pushes v, yielding while the queue is full. stream_executor only runs
+     * a node when none of its output streams are full, so a node which
+     * pushes one item per output each time it runs never waits.
+     */
+    void push(T v)
+    {
+        while( !m_queue->try_push( std::move(v) ) )
+            std::this_thread::yield();
+    }
+
+    bool full() const
+    {
+        return m_queue->full();
+    }
+
+    /**
+     * @brief close
+     *
+     * Tells the consumers that this node will not push any more items.
+     */
+    void close()
+    {
+        m_queue->close(m_slot);
+    }
+
+    std::string const & get_name() const
+    {
+        return m_queue->get_name();
+    }
+};
+
+}
+
+#endif
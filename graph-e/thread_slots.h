@@ -0,0 +1,118 @@
+#pragma once
+
+#ifndef THREAD_SLOTS_GRAPH_3_H
+#define THREAD_SLOTS_GRAPH_3_H
+
+#include <atomic>
+#include <array>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+namespace graphe
+{
+
+/**
+ * @brief The thread_slots class
+ *
+ * Gives every thread which uses an object its own T, eg: the event ring of
+ * a node_profiler or the counters of a graph_metrics. A thread gets the
+ * same slot every time it asks the same object, even when it alternates
+ * between several objects. The last few objects each thread used are
+ * cached in a thread_local, so finding the slot takes no locks in the
+ * common case.
+ *
+ * The slots are created and read under a mutex owned by the caller.
+ */
+template<typename T>
+class thread_slots
+{
+public:
+    thread_slots() : m_instance( next_instance() )
+    {
+    }
+
+    thread_slots( thread_slots const & other) = delete;
+    thread_slots & operator = ( thread_slots const & other) = delete;
+
+    /**
+     * @brief local
+     * @param lock - protects the slots
+     * @param make - creates the slot of a new thread, make(index) -> std::unique_ptr<T>
+     * @return
+     *
+     * Returns the slot of the calling thread.
+     */
+    template<typename Make>
+    T & local(std::mutex & lock, Make && make)
+    {
+        auto & cache = thread_cache();
+        for(auto & e : cache.entries)
+        {
+            if( e.instance == m_instance )
+                return *e.slot;
+        }
+
+        T * slot = nullptr;
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            auto & s = m_by_thread[ std::this_thread::get_id() ];
+            if( !s )
+            {
+                m_slots.push_back( make( m_slots.size() ) );
+                s = m_slots.back().get();
+            }
+            slot = s;
+        }
+        cache.entries[ cache.next++ % cache.entries.size() ] = entry{ m_instance, slot };
+        return *slot;
+    }
+
+    /**
+     * @brief all
+     * @return
+     *
+     * Returns the slots of every thread, in the order they were created.
+     * The caller must hold the lock passed to local().
+     */
+    std::vector< std::unique_ptr<T> > const & all() const
+    {
+        return m_slots;
+    }
+
+protected:
+    struct entry
+    {
+        uint64_t instance = 0;
+        T      * slot     = nullptr;
+    };
+
+    struct cache_t
+    {
+        std::array<entry, 8> entries;
+        uint32_t             next = 0; // entry replaced by the next miss
+    };
+
+    static cache_t & thread_cache()
+    {
+        static thread_local cache_t cache;
+        return cache;
+    }
+
+    static uint64_t next_instance()
+    {
+        static std::atomic<uint64_t> instance{0};
+        return ++instance;
+    }
+
+    uint64_t                                  m_instance; // unique per object, never reused, so stale cache entries never match
+    std::vector< std::unique_ptr<T> >         m_slots;
+    std::unordered_map<std::thread::id, T*>   m_by_thread;
+};
+
+}
+
+#endif
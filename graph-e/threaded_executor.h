@@ -4,35 +4,94 @@
 #define THREAD_POOL_EXECUTE_GRAPH_3_H
 
 #include "node_graph.h"
-#include <condition_variable>
+#include "completion_event.h"
+#include "domain_queues.h"
 #include <mutex>
 
 namespace graphe
 {
 
+/**
+ * Detects whether a thread pool wrapper can accept a batch of tasks, ie: it
+ * provides  void operator()( std::function<void(void)> ** exec, size_t count)
+ */
+template<typename T, typename = void>
+struct has_batch_submit : std::false_type {};
 
+template<typename T>
+struct has_batch_submit<T, decltype( std::declval<T&>()( std::declval<std::function<void(void)>**>(), size_t() ), void() )> : std::true_type {};
+
+/**
+ * Detects whether a thread pool wrapper can run tasks which are not nodes,
+ * ie: it provides  void operator()( std::function<void(void)> && task).
+ * parallel_for() uses it to run its chunks on the pool.
+ */
+template<typename T, typename = void>
+struct has_task_submit : std::false_type {};
+
+template<typename T>
+struct has_task_submit<T, decltype( std::declval<T&>()( std::declval<std::function<void(void)>&&>() ), void() )> : std::true_type {};
+
+/**
+ * Detects whether a thread pool wrapper can run one of its queued tasks on
+ * the calling thread, ie: it provides  bool try_run_one(), which returns
+ * false if there was nothing to run.
+ */
+template<typename T, typename = void>
+struct has_try_run : std::false_type {};
+
+template<typename T>
+struct has_try_run<T, decltype( bool( std::declval<T&>().try_run_one() ), void() )> : std::true_type {};
+
+/**
+ * Detects whether a thread pool wrapper knows how many threads it runs, ie:
+ * it provides  size_t size(). parallel_for() splits its work across that
+ * many threads, otherwise across std::thread::hardware_concurrency().
+ */
+template<typename T, typename = void>
+struct has_pool_size : std::false_type {};
+
+template<typename T>
+struct has_pool_size<T, decltype( size_t( std::declval<T&>().size() ), void() )> : std::true_type {};
+
+/**
+ * @brief The threaded_executor class
+ *
+ * Executes the graph on a thread pool. wait() blocks on the graph's
+ * completion_event, which is signalled when the last scheduled node of the
+ * frame finishes (see set_wait_policy()).
+ *
+ * Nodes in the exec_domain::main domain are queued for the thread which
+ * calls wait(), which runs them while it waits, so a frame with main nodes
+ * only completes inside wait(). Each named domain gets a dedicated thread,
+ * started by execute().
+ */
 template<typename ThreadPool_t>
 class threaded_executor
 {
 public:
-    threaded_executor(node_graph & graph) : m_graph(graph)
+    threaded_executor(node_graph & graph) : m_graph(graph), m_domains(graph)
     {
+        // completion is detected through the graph's completion_event, so
+        // no hook left behind by another executor may be called
+        graph.clearOnComplete();
         graph.setOnSchedule(
         [this](exec_node *N)
         {
-            m_thread_pool->operator()(N->execute);
+            if( N->get_domain() == exec_domain::any )
+                m_thread_pool->operator()(N->execute);
+            else
+                post_to_domain(N);
         });
 
-        graph.setOnComplete(
-        [this]()
-        {
-           m_cv.notify_all();
-        });
+        set_batch_hook( has_batch_submit<ThreadPool_t>() );
+        set_task_hook( has_task_submit<ThreadPool_t>() );
     }
 
     void set_thread_pool(ThreadPool_t * T)
     {
         m_thread_pool = T;
+        set_task_hook( has_task_submit<ThreadPool_t>() ); // the concurrency depends on the pool
     }
 
     ThreadPool_t * get_thread_pool() const
@@ -42,31 +101,145 @@ public:
     ~threaded_executor()
     {
         wait();
+        m_graph.clearOnSchedule();
+        m_graph.clearOnScheduleBatch();
+        m_graph.clearOnComplete();
+        m_graph.clearOnTask();
+        m_domains.stop();
     }
 
-    void wait()
+    /**
+     * @brief set_wait_policy
+     * @param spin - number of times wait() checks for completion before it blocks
+     * @param help - if the wrapper provides try_run_one(), run queued tasks while waiting
+     *
+     * By default wait() blocks straight away. At high frame rates spinning
+     * for a while avoids the cost of being woken up. With help set, the
+     * thread which calls wait() executes nodes as well, so node bodies may
+     * run on the caller's thread.
+     */
+    void set_wait_policy(uint32_t spin, bool help = false)
     {
-        std::unique_lock<std::mutex> lk(m_wait_lock);
-        m_cv.wait(lk, [this] { return !m_graph.busy(); } );
+        m_spin = spin;
+        m_help = help;
     }
 
-    void execute()
+    void wait()
     {
-        for(auto & N : m_graph.get_exec_nodes()) // place all the nodes with no resource requirements onto the queue.
+        auto & done = m_graph.get_completion_event();
+        for(uint32_t i=0; ; ++i)
         {
-            if( N->can_execute() )
+            // read the epoch first, so a completion after the check wakes us
+            auto seen = done.epoch();
+            if( m_domains.run_main() )
+            {
+                i = 0;
+                continue;
+            }
+            if( !m_graph.busy() )
+            {
+                m_graph.rethrow_error();
+                return;
+            }
+            if( m_help && try_run_one( has_try_run<ThreadPool_t>() ) )
+                continue;
+            if( i < m_spin )
             {
-                m_graph.schedule_node(N.get());
+                std::this_thread::yield();
+                continue;
             }
+            done.wait(seen);
         }
     }
 
+    void execute()
+    {
+        m_domains.start();
+        m_graph.schedule_roots(); // place all the nodes with no resource requirements onto the queue.
+    }
+
 
 private:
+    /**
+     * @brief post_to_domain
+     * @param N
+     *
+     * Queues a node which may not run on the pool. A domain which was named
+     * after the last execute() has no thread yet, its nodes run on the pool.
+     */
+    void post_to_domain(exec_node * N)
+    {
+        if( !m_domains.post(N) )
+            m_thread_pool->operator()(N->execute);
+    }
+
+    bool try_run_one(std::false_type)
+    {
+        return false;
+    }
+
+    bool try_run_one(std::true_type)
+    {
+        return m_thread_pool->try_run_one();
+    }
+
+    void set_batch_hook(std::false_type)
+    {
+        m_graph.clearOnScheduleBatch();
+    }
+
+    void set_batch_hook(std::true_type)
+    {
+        // hand all the roots to the pool in one call so it can
+        // enqueue them under a single lock. With deferred notification the
+        // workers publish their successors through here as well.
+        m_graph.setOnScheduleBatch(
+        [this](exec_node * const * N, size_t count)
+        {
+            static thread_local std::vector< std::function<void(void)>* > batch;
+            batch.clear();
+            for(size_t i=0; i < count; ++i)
+            {
+                if( N[i]->get_domain() == exec_domain::any )
+                    batch.push_back(&N[i]->execute);
+                else
+                    post_to_domain(N[i]);
+            }
+            if( !batch.empty() )
+                m_thread_pool->operator()(batch.data(), batch.size());
+        });
+    }
+
+    void set_task_hook(std::false_type)
+    {
+        m_graph.clearOnTask();
+    }
+
+    void set_task_hook(std::true_type)
+    {
+        m_graph.setOnTask(
+        [this](std::function<void(void)> task)
+        {
+            m_thread_pool->operator()( std::move(task) );
+        }, pool_size( has_pool_size<ThreadPool_t>() ) );
+    }
+
+    size_t pool_size(std::false_type) const
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    size_t pool_size(std::true_type) const
+    {
+        return m_thread_pool ? std::max<size_t>(1, m_thread_pool->size()) : pool_size( std::false_type() );
+    }
+
     node_graph                 & m_graph;
     ThreadPool_t               *m_thread_pool = nullptr;
-    std::mutex                  m_wait_lock;
-    std::condition_variable     m_cv;
+    uint32_t                    m_spin = 0;
+    bool                        m_help = false;
+
+    domain_queues               m_domains;  // main and named domain nodes
 };
 
 }
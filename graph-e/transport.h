@@ -0,0 +1,385 @@
+#pragma once
+
+#ifndef TRANSPORT_GRAPH_3_H
+#define TRANSPORT_GRAPH_3_H
+
+#include "node_graph.h"
+#include <mutex>
+#include <thread>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+namespace graphe
+{
+
+/**
+ * @brief The resource_message struct
+ *
+ * The value of a resource, sent by the partition which produced it to a
+ * partition which consumes it.
+ */
+struct resource_message
+{
+    resource_id          resource = invalid_resource_id;
+    uint64_t             frame    = 0; // frame of the sender which produced the value, counted from 0
+    std::vector<uint8_t> data;
+};
+
+/**
+ * @brief The transport class
+ *
+ * Connects the partitions of a distributed graph. Each process owns one
+ * transport, which knows its own rank and can send messages to the others.
+ * Messages from the same peer are delivered in the order they were sent.
+ *
+ * Implementations call deliver() from whichever thread receives a message.
+ * Messages which arrive before a receiver has been set are kept until one is.
+ */
+class transport
+{
+public:
+    using receiver = std::function<void(resource_message &&)>;
+
+    virtual ~transport() = default;
+
+    /**
+     * @brief rank
+     * @return
+     *
+     * Returns the partition this process executes.
+     */
+    virtual uint32_t rank() const = 0;
+
+    /**
+     * @brief size
+     * @return
+     *
+     * Returns the number of partitions.
+     */
+    virtual uint32_t size() const = 0;
+
+    /**
+     * @brief send
+     * @param peer
+     * @param m
+     *
+     * Sends a message to a peer. May be called from several threads at once.
+     */
+    virtual void send(uint32_t peer, resource_message const & m) = 0;
+
+    /**
+     * @brief set_receiver
+     * @param r
+     *
+     * Sets the function which is called for every message. Once this
+     * returns, the previous receiver is no longer called.
+     */
+    void set_receiver(receiver r)
+    {
+        std::lock_guard<std::mutex> lk(m_receive_lock);
+        m_receiver = std::move(r);
+        if( !m_receiver )
+            return;
+        for(auto & m : m_early)
+            m_receiver( std::move(m) );
+        m_early.clear();
+    }
+
+protected:
+    void deliver(resource_message && m)
+    {
+        std::lock_guard<std::mutex> lk(m_receive_lock);
+        if( m_receiver )
+            m_receiver( std::move(m) );
+        else
+            m_early.push_back( std::move(m) );
+    }
+
+    std::mutex                    m_receive_lock; // held while the receiver is called
+    receiver                      m_receiver;
+    std::vector<resource_message> m_early;        // received before there was a receiver
+};
+
+/**
+ * @brief The local_network class
+ *
+ * Connects partitions which run in the same process, one endpoint per
+ * partition. A message is delivered on the thread which sends it.
+ */
+class local_network
+{
+public:
+    explicit local_network(uint32_t size)
+    {
+        for(uint32_t i=0; i < size; ++i)
+            m_endpoints.emplace_back( new endpoint(*this, i) );
+    }
+
+    transport & get_endpoint(uint32_t rank)
+    {
+        return *m_endpoints[rank];
+    }
+
+protected:
+    class endpoint : public transport
+    {
+    public:
+        endpoint(local_network & net, uint32_t rank) : m_net(net), m_rank(rank)
+        {
+        }
+
+        uint32_t rank() const override
+        {
+            return m_rank;
+        }
+
+        uint32_t size() const override
+        {
+            return static_cast<uint32_t>(m_net.m_endpoints.size());
+        }
+
+        void send(uint32_t peer, resource_message const & m) override
+        {
+            resource_message copy(m);
+            m_net.m_endpoints[peer]->deliver( std::move(copy) );
+        }
+
+    protected:
+        local_network & m_net;
+        uint32_t        m_rank;
+    };
+
+    std::vector< std::unique_ptr<endpoint> > m_endpoints;
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+
+/**
+ * @brief The socket_transport class
+ *
+ * Connects partitions over stream sockets, one connected socket per peer:
+ * TCP sockets between machines, or socketpair() / unix domain sockets between
+ * processes on the same machine. Each message is framed by the id of its
+ * resource, its frame and the number of bytes which follow. Values are sent in the byte
+ * order of the host, so all the processes must run on the same architecture.
+ *
+ * A thread per peer reads the incoming messages.
+ */
+class socket_transport : public transport
+{
+public:
+    /**
+     * @brief socket_transport
+     * @param rank
+     * @param sockets - a connected socket for every peer, -1 for rank itself.
+     *                  The transport closes them.
+     */
+    socket_transport(uint32_t rank, std::vector<int> sockets) : m_rank(rank), m_sockets( std::move(sockets) ), m_send_locks( m_sockets.size() )
+    {
+        for(size_t i=0; i < m_sockets.size(); ++i)
+        {
+            if( m_sockets[i] < 0 )
+                continue;
+            int one = 1;
+            ::setsockopt(m_sockets[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly on unix sockets
+            m_readers.emplace_back( [this, i]() { read_loop( m_sockets[i] ); } );
+        }
+    }
+
+    ~socket_transport()
+    {
+        for(auto s : m_sockets)
+            if( s >= 0 )
+                ::shutdown(s, SHUT_RDWR);
+        for(auto & t : m_readers)
+            t.join();
+        for(auto s : m_sockets)
+            if( s >= 0 )
+                ::close(s);
+    }
+
+    /**
+     * @brief connect_tcp
+     * @param rank
+     * @param hosts - host:port of every partition, the same list in every process
+     * @return
+     *
+     * Listens on the port of rank, connects to the partitions before it and
+     * accepts connections from the ones after it. Blocks until every
+     * partition is connected.
+     */
+    static std::unique_ptr<socket_transport> connect_tcp(uint32_t rank, std::vector<std::string> const & hosts)
+    {
+        auto n = static_cast<uint32_t>(hosts.size());
+        std::vector<int> sockets(n, -1);
+
+        int listener = -1;
+        if( rank + 1 < n )
+        {
+            listener = open_socket(hosts[rank], true);
+        }
+        for(uint32_t peer=0; peer < rank; ++peer)
+        {
+            auto s = open_socket(hosts[peer], false);
+            write_all(s, &rank, sizeof(rank));
+            sockets[peer] = s;
+        }
+        for(uint32_t i=rank+1; i < n; ++i)
+        {
+            int s = ::accept(listener, nullptr, nullptr);
+            uint32_t peer = 0;
+            if( s < 0 || !read_all(s, &peer, sizeof(peer)) || peer <= rank || peer >= n || sockets[peer] >= 0 )
+            {
+                ::close(listener);
+                throw std::runtime_error("socket_transport: bad connection from a peer");
+            }
+            sockets[peer] = s;
+        }
+        if( listener >= 0 )
+            ::close(listener);
+        return std::make_unique<socket_transport>(rank, std::move(sockets));
+    }
+
+    uint32_t rank() const override
+    {
+        return m_rank;
+    }
+
+    uint32_t size() const override
+    {
+        return static_cast<uint32_t>(m_sockets.size());
+    }
+
+    void send(uint32_t peer, resource_message const & m) override
+    {
+        uint64_t h[3] = { m.resource, m.frame, m.data.size() }; // resource id, frame, bytes
+        std::lock_guard<std::mutex> lk(m_send_locks[peer]);
+        if( !write_all(m_sockets[peer], h, sizeof(h)) || !write_all(m_sockets[peer], m.data.data(), m.data.size()) )
+            throw std::runtime_error("socket_transport: the connection to a peer was lost");
+    }
+
+protected:
+    void read_loop(int s)
+    {
+        for(;;)
+        {
+            uint64_t h[3];
+            resource_message m;
+            if( !read_all(s, h, sizeof(h)) )
+                return;
+            m.resource = static_cast<resource_id>(h[0]);
+            m.frame    = h[1];
+            m.data.resize( static_cast<size_t>(h[2]) );
+            if( !read_all(s, m.data.data(), m.data.size()) )
+                return;
+            deliver( std::move(m) );
+        }
+    }
+
+    static bool write_all(int s, void const * p, size_t size)
+    {
+        auto b = static_cast<char const*>(p);
+        while( size )
+        {
+#if defined(MSG_NOSIGNAL)
+            auto k = ::send(s, b, size, MSG_NOSIGNAL); // a lost peer is reported, not raised as SIGPIPE
+#else
+            auto k = ::send(s, b, size, 0);
+#endif
+            if( k <= 0 )
+                return false;
+            b    += k;
+            size -= static_cast<size_t>(k);
+        }
+        return true;
+    }
+
+    static bool read_all(int s, void * p, size_t size)
+    {
+        auto b = static_cast<char*>(p);
+        while( size )
+        {
+            auto k = ::recv(s, b, size, 0);
+            if( k <= 0 )
+                return false;
+            b    += k;
+            size -= static_cast<size_t>(k);
+        }
+        return true;
+    }
+
+    /**
+     * @brief open_socket
+     * @param host - host:port
+     * @param listen - listen on the port instead of connecting to it
+     * @return
+     *
+     * Connecting retries until the peer is listening.
+     */
+    static int open_socket(std::string const & host, bool listen)
+    {
+        auto colon = host.rfind(':');
+        if( colon == std::string::npos )
+            throw std::runtime_error("socket_transport: expected host:port, got " + host);
+        auto name = host.substr(0, colon);
+        auto port = host.substr(colon + 1);
+
+        addrinfo hints{};
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags    = listen ? AI_PASSIVE : 0;
+        addrinfo * info = nullptr;
+        if( ::getaddrinfo(name.empty() ? nullptr : name.c_str(), port.c_str(), &hints, &info) != 0 )
+            throw std::runtime_error("socket_transport: can not resolve " + host);
+
+        for(int attempt=0; attempt < 600; ++attempt)
+        {
+            for(auto a = info; a; a = a->ai_next)
+            {
+                int s = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if( s < 0 )
+                    continue;
+                if( listen )
+                {
+                    int one = 1;
+                    ::setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+                    if( ::bind(s, a->ai_addr, a->ai_addrlen) == 0 && ::listen(s, 64) == 0 )
+                    {
+                        ::freeaddrinfo(info);
+                        return s;
+                    }
+                }
+                else if( ::connect(s, a->ai_addr, a->ai_addrlen) == 0 )
+                {
+                    ::freeaddrinfo(info);
+                    return s;
+                }
+                ::close(s);
+            }
+            if( listen )
+                break;
+            std::this_thread::sleep_for( std::chrono::milliseconds(100) );
+        }
+        ::freeaddrinfo(info);
+        throw std::runtime_error("socket_transport: can not " + std::string(listen ? "listen on " : "connect to ") + host);
+    }
+
+    uint32_t                  m_rank;
+    std::vector<int>          m_sockets;    // peer -> connected socket, -1 for this rank
+    std::vector<std::mutex>   m_send_locks; // one per peer, a message is written in one piece
+    std::vector<std::thread>  m_readers;
+};
+
+#endif
+
+}
+
+#endif
@@ -0,0 +1,203 @@
+#pragma once
+
+#ifndef VALUE_SERIALIZER_GRAPH_3_H
+#define VALUE_SERIALIZER_GRAPH_3_H
+
+#include "node_graph.h"
+#include <typeindex>
+#include <cstring>
+
+namespace graphe
+{
+
+/**
+ * @brief The value_codec struct
+ *
+ * Converts values of type T to bytes and back. The default handles
+ * trivially copyable types, std::vector and std::basic_string of trivially
+ * copyable types. Specialise it for other types:
+ *
+ *   template<> struct value_codec<Mesh>
+ *   {
+ *       static void save(Mesh const & m, std::vector<uint8_t> & out);
+ *       static Mesh load(uint8_t const * data, size_t size);
+ *   };
+ */
+template<typename T, typename = void>
+struct value_codec
+{
+    static_assert( std::is_trivially_copyable<T>::value, "value_codec<T> must be specialised for types which are not trivially copyable" );
+
+    static void save(T const & x, std::vector<uint8_t> & out)
+    {
+        auto p = reinterpret_cast<uint8_t const*>(&x);
+        out.insert(out.end(), p, p + sizeof(T));
+    }
+
+    static T load(uint8_t const * data, size_t size)
+    {
+        if( size != sizeof(T) )
+            throw std::runtime_error("value_codec: wrong number of bytes");
+        T x;
+        std::memcpy(&x, data, sizeof(T));
+        return x;
+    }
+};
+
+/**
+ * Detects the containers whose elements can be copied as one block of bytes.
+ */
+template<typename T>
+struct is_flat_container : std::false_type {};
+
+template<typename V, typename A>
+struct is_flat_container< std::vector<V, A> > : std::integral_constant<bool, std::is_trivially_copyable<V>::value && !std::is_same<V, bool>::value> {};
+
+template<typename Ch, typename Tr, typename A>
+struct is_flat_container< std::basic_string<Ch, Tr, A> > : std::true_type {};
+
+template<typename C>
+struct value_codec<C, std::enable_if_t< is_flat_container<C>::value > >
+{
+    using V = typename C::value_type;
+
+    static void save(C const & x, std::vector<uint8_t> & out)
+    {
+        auto p = reinterpret_cast<uint8_t const*>(x.data());
+        out.insert(out.end(), p, p + x.size() * sizeof(V));
+    }
+
+    static C load(uint8_t const * data, size_t size)
+    {
+        if( size % sizeof(V) != 0 )
+            throw std::runtime_error("value_codec: wrong number of bytes");
+        C x;
+        x.resize(size / sizeof(V));
+        if( size )
+            std::memcpy(&x[0], data, size);
+        return x;
+    }
+};
+
+/**
+ * @brief The value_serializer_registry class
+ *
+ * Maps the value types of resources to the functions which move their
+ * values between processes, see distributed_executor. Every type held by a
+ * resource which crosses a partition must be registered in every process.
+ */
+class value_serializer_registry
+{
+public:
+    struct entry
+    {
+        std::function<void(resource_node &, std::vector<uint8_t> &)>     save;       // appends the value of the resource
+        std::function<void(resource_node &, uint8_t const *, size_t)>    load;       // replaces the value of the resource
+        std::function<void(resource_node &)>                             clear;      // replaces the value of the resource with T()
+        std::function<void(ResourceRegistry &, resource_node const &)>   add_input;  // registers the resource as an input of a node
+        std::function<void(ResourceRegistry &, resource_node const &)>   add_output; // registers the resource as an output of a node
+        size_t                                                           size_hint;  // bytes of a value, used before the resource holds one
+    };
+
+    static value_serializer_registry & global()
+    {
+        static value_serializer_registry R;
+        return R;
+    }
+
+    /**
+     * @brief add
+     * @param size_hint - typical number of bytes of a value, 0 for sizeof(T)
+     *
+     * Registers T, converted with value_codec<T>. Registering the same type
+     * twice replaces the first registration. T must be default constructible,
+     * T() stands in for a value which can not be decoded.
+     */
+    template<typename T>
+    void add(size_t size_hint = 0)
+    {
+        static_assert( std::is_default_constructible<T>::value, "values which cross partitions must be default constructible" );
+
+        entry e;
+        e.save = [](resource_node & R, std::vector<uint8_t> & out)
+        {
+            value_codec<T>::save( R.template Get<T>(), out );
+        };
+        e.load = [](resource_node & R, uint8_t const * data, size_t size)
+        {
+            static_cast< typed_resource_node<T>& >(R).set( value_codec<T>::load(data, size) );
+        };
+        e.clear = [](resource_node & R)
+        {
+            static_cast< typed_resource_node<T>& >(R).set( T() );
+        };
+        e.add_input = [](ResourceRegistry & reg, resource_node const & R)
+        {
+            switch( R.get_flags() )
+            {
+                case resource_flags::permanent: reg.register_input_resource<T, resource_flags::permanent>( R.get_name() ); break;
+                case resource_flags::moveable:  reg.register_input_resource<T, resource_flags::moveable>( R.get_name() ); break;
+                default:                        reg.register_input_resource<T, resource_flags::resetable>( R.get_name() ); break;
+            }
+        };
+        e.add_output = [](ResourceRegistry & reg, resource_node const & R)
+        {
+            switch( R.get_flags() )
+            {
+                case resource_flags::permanent: reg.register_output_resource<T, resource_flags::permanent>( R.get_name() ); break;
+                case resource_flags::moveable:  reg.register_output_resource<T, resource_flags::moveable>( R.get_name() ); break;
+                default:                        reg.register_output_resource<T, resource_flags::resetable>( R.get_name() ); break;
+            }
+        };
+        e.size_hint = size_hint ? size_hint : sizeof(T);
+        m_entries[ std::type_index(typeid(T)) ] = std::move(e);
+    }
+
+    /**
+     * @brief find
+     * @param type
+     * @return
+     *
+     * Returns the entry of a value type, or nullptr if it is not registered.
+     */
+    entry const * find(std::type_info const & type) const
+    {
+        auto it = m_entries.find( std::type_index(type) );
+        return it == m_entries.end() ? nullptr : &it->second;
+    }
+
+    /**
+     * @brief size_of
+     * @param R
+     * @return
+     *
+     * Returns the number of bytes the value of R takes when it is sent, or
+     * its size hint if R holds no value. Unregistered types count as 0.
+     */
+    double size_of(resource_node & R) const
+    {
+        auto e = find( R.get_type() );
+        if( !e )
+            return 0.0;
+        if( !R.has_value() )
+            return static_cast<double>(e->size_hint);
+        std::vector<uint8_t> bytes;
+        e->save(R, bytes);
+        return static_cast<double>(bytes.size());
+    }
+
+protected:
+    std::unordered_map<std::type_index, entry> m_entries;
+};
+
+/**
+ * Registers a value type with the global value_serializer_registry when the
+ * program starts: GRAPHE_REGISTER_VALUE(Particles);
+ * The type may be qualified, eg: GRAPHE_REGISTER_VALUE(sim::Particles);
+ */
+#define GRAPHE_REGISTER_VALUE(T) \
+    static const bool GRAPHE_CONCAT(graphe_registered_value_, __COUNTER__) = ( ::graphe::value_serializer_registry::global().add<T>(), true )
+
+}
+
+#endif
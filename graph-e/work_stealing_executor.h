@@ -0,0 +1,632 @@
+#pragma once
+
+#ifndef WORK_STEALING_EXECUTE_GRAPH_3_H
+#define WORK_STEALING_EXECUTE_GRAPH_3_H
+
+#include "node_graph.h"
+#include "affinity.h"
+#include "domain_queues.h"
+#include <condition_variable>
+#include <mutex>
+#include <deque>
+
+namespace graphe
+{
+
+/**
+ * @brief The work_stealing_deque class
+ *
+ * A Chase-Lev work-stealing deque. The owning thread pushes and pops
+ * at the bottom, any other thread may steal from the top. T must be a
+ * pointer type, nullptr is returned when there is nothing to take.
+ */
+template<typename T>
+class work_stealing_deque
+{
+    struct ring
+    {
+        explicit ring(int64_t cap) : m_capacity(cap), m_mask(cap-1), m_data( new std::atomic<T>[cap] )
+        {
+        }
+
+        T get(int64_t i) const
+        {
+            return m_data[i & m_mask].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T x)
+        {
+            m_data[i & m_mask].store(x, std::memory_order_relaxed);
+        }
+
+        ring * grow(int64_t bottom, int64_t top) const
+        {
+            auto r = new ring(m_capacity*2);
+            for(auto i=top; i != bottom; ++i)
+                r->put(i, get(i));
+            return r;
+        }
+
+        int64_t                         m_capacity;
+        int64_t                         m_mask;
+        std::unique_ptr<std::atomic<T>[]> m_data;
+    };
+
+public:
+    explicit work_stealing_deque(int64_t capacity = 256) : m_ring( new ring(capacity) )
+    {
+        m_rings.emplace_back( m_ring.load(std::memory_order_relaxed) );
+    }
+
+    work_stealing_deque( work_stealing_deque const & other) = delete;
+    work_stealing_deque & operator = ( work_stealing_deque const & other) = delete;
+
+    /**
+     * @brief push
+     * @param x
+     *
+     * Pushes an item onto the bottom of the deque. Only the owner may call this.
+     */
+    void push(T x)
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed);
+        auto t = m_top.load(std::memory_order_acquire);
+        auto a = m_ring.load(std::memory_order_relaxed);
+
+        if( b - t > a->m_capacity - 1 )
+        {
+            // thieves may still be reading the old ring, so keep it alive
+            a = a->grow(b, t);
+            m_rings.emplace_back(a);
+            m_ring.store(a, std::memory_order_release);
+        }
+        a->put(b, x);
+        m_bottom.store(b+1, std::memory_order_release); // publishes the item to the thieves
+    }
+
+    /**
+     * @brief pop
+     * @return
+     *
+     * Pops the most recently pushed item. Only the owner may call this.
+     */
+    T pop()
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed) - 1;
+        auto a = m_ring.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = m_top.load(std::memory_order_relaxed);
+
+        T x = nullptr;
+        if( t <= b )
+        {
+            x = a->get(b);
+            if( t == b )
+            {
+                // last item, race against the thieves for it
+                if( !m_top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed) )
+                    x = nullptr;
+                m_bottom.store(b+1, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            m_bottom.store(b+1, std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    /**
+     * @brief steal
+     * @return
+     *
+     * Steals the oldest item. May be called from any thread. Returns
+     * nullptr if the deque was empty or another thread won the item.
+     */
+    T steal()
+    {
+        auto t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = m_bottom.load(std::memory_order_acquire);
+
+        if( t < b )
+        {
+            auto a = m_ring.load(std::memory_order_acquire);
+            T x = a->get(t);
+            if( !m_top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed) )
+                return nullptr;
+            return x;
+        }
+        return nullptr;
+    }
+
+    bool empty() const
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed);
+        auto t = m_top.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+protected:
+    alignas(64) std::atomic<int64_t> m_top{0};
+    alignas(64) std::atomic<int64_t> m_bottom{0};
+    std::atomic<ring*>                m_ring;
+    std::vector< std::unique_ptr<ring> >   m_rings; // every ring ever allocated, freed on destruction
+};
+
+/**
+ * @brief The work_stealing_executor class
+ *
+ * Executes the graph on its own set of workers. Each worker has a
+ * work_stealing_deque. When a worker makes a resource available, the
+ * ready node with the highest critical-path rank is run inline as soon as
+ * the current node returns, and any other ready nodes are pushed onto the
+ * worker's own deque where idle workers can steal them.
+ *
+ * Nodes scheduled from outside the workers (eg: the roots scheduled by
+ * execute()) are placed on a shared injection queue. A node with an
+ * affinity hint (see exec_node::set_affinity()) is placed in the mailbox of
+ * that worker and is never stolen.
+ *
+ * If pin_workers is set, worker i is pinned to the i-th cpu of the machine,
+ * counting node by node (see cpu_topology), and idle workers steal from
+ * workers on their own NUMA node before they steal across nodes. Since a
+ * node made ready by a worker is run by that worker, or queued on its
+ * deque, consumers normally run next to the data their producer just wrote.
+ *
+ * Nodes in the exec_domain::main domain are run by the thread which calls
+ * wait(), and each named domain gets a dedicated thread, started by
+ * execute(), as with threaded_executor.
+ */
+class work_stealing_executor
+{
+public:
+    work_stealing_executor(node_graph & graph, size_t num_workers = std::thread::hardware_concurrency(), bool pin_workers = false) : m_graph(graph), m_domains(graph)
+    {
+        if( num_workers == 0 )
+            num_workers = 1;
+
+        m_graph.setOnSchedule(
+        [this](exec_node *N)
+        {
+            schedule(N);
+        });
+
+        m_graph.setOnScheduleBatch(
+        [this](exec_node * const * N, size_t count)
+        {
+            schedule_batch(N, count);
+        });
+
+        // wait() blocks on the graph's completion_event
+        m_graph.clearOnComplete();
+
+        m_graph.setOnTask(
+        [this](std::function<void(void)> task)
+        {
+           schedule_task( std::move(task) );
+        }, num_workers);
+
+        cpu_topology topology;
+        std::vector<int> cpus;
+        if( pin_workers )
+        {
+            topology = cpu_topology::detect();
+            cpus     = topology.cpus();
+        }
+
+        for(size_t i=0; i < num_workers; ++i)
+        {
+            m_workers.emplace_back( new worker() );
+            m_workers.back()->m_owner = this;
+            m_workers.back()->m_index = i;
+            if( !cpus.empty() )
+            {
+                auto cpu = cpus[i % cpus.size()];
+                m_workers.back()->m_cpu   = cpu;
+                m_workers.back()->m_group = topology.node_of(cpu);
+                m_num_groups = std::max(m_num_groups, m_workers.back()->m_group + 1);
+            }
+        }
+        for(auto & w : m_workers)
+        {
+            auto W = w.get();
+            W->m_thread = std::thread( [this,W](){ run(*W); } );
+        }
+    }
+
+    ~work_stealing_executor()
+    {
+        wait();
+        {
+            std::lock_guard<std::mutex> lk(m_sleep_lock);
+            m_stop.store(true);
+        }
+        m_sleep_cv.notify_all();
+        for(auto & w : m_workers)
+        {
+            if( w->m_thread.joinable() )
+                w->m_thread.join();
+        }
+        m_graph.clearOnSchedule();
+        m_graph.clearOnScheduleBatch();
+        m_graph.clearOnComplete();
+        m_graph.clearOnTask();
+        m_domains.stop();
+    }
+
+    work_stealing_executor( work_stealing_executor const & other) = delete;
+    work_stealing_executor & operator = ( work_stealing_executor const & other) = delete;
+
+    /**
+     * @brief execute
+     *
+     * Schedules all the nodes which can be executed. The call returns
+     * immediately, use wait() to wait for the graph to finish.
+     */
+    void execute()
+    {
+        m_domains.start();
+        m_graph.schedule_roots(); // place all the nodes with no resource requirements onto the queue.
+    }
+
+    /**
+     * @brief wait
+     *
+     * Waits until all the scheduled nodes have executed, running the
+     * main nodes on the calling thread as they become ready.
+     */
+    void wait()
+    {
+        auto & done = m_graph.get_completion_event();
+        for(;;)
+        {
+            // read the epoch first, so a completion after the check wakes us
+            auto seen = done.epoch();
+            if( m_domains.run_main() )
+                continue;
+            if( !m_graph.busy() )
+            {
+                m_graph.rethrow_error();
+                return;
+            }
+            done.wait(seen);
+        }
+    }
+
+    size_t num_workers() const
+    {
+        return m_workers.size();
+    }
+
+    /**
+     * @brief worker_cpu
+     * @param worker
+     * @return
+     *
+     * Returns the cpu the worker is pinned to, or -1.
+     */
+    int worker_cpu(size_t worker) const
+    {
+        return m_workers[worker]->m_cpu;
+    }
+
+    /**
+     * @brief worker_group
+     * @param worker
+     * @return
+     *
+     * Returns the NUMA node of the worker, 0 if the workers are not pinned.
+     */
+    size_t worker_group(size_t worker) const
+    {
+        return m_workers[worker]->m_group;
+    }
+
+protected:
+    struct worker
+    {
+        work_stealing_deque<exec_node*> m_deque;
+        exec_node *                     m_next  = nullptr; // next node to run inline, it cannot be stolen
+        work_stealing_executor *        m_owner = nullptr;
+        size_t                          m_index = 0;
+        uint32_t                        m_seed  = 0;      // state for picking steal victims
+        int                             m_cpu   = -1;     // cpu the worker is pinned to, or -1
+        size_t                          m_group = 0;      // NUMA node of m_cpu
+        std::mutex                      m_mail_lock;      // protects m_mail
+        std::deque<exec_node*>          m_mail;           // nodes with an affinity for this worker
+        std::atomic<size_t>             m_mail_size{0};
+        std::thread                     m_thread;
+    };
+
+    static worker* & current_worker()
+    {
+        static thread_local worker * w = nullptr;
+        return w;
+    }
+
+    void schedule(exec_node * N)
+    {
+        if( N->get_domain() != exec_domain::any && m_domains.post(N) )
+            return;
+        if( N->get_affinity() >= 0 )
+        {
+            post_to(N);
+            return;
+        }
+
+        auto w = current_worker();
+        if( w && w->m_owner == this )
+        {
+            if( w->m_next == nullptr )
+            {
+                w->m_next = N;
+                return;
+            }
+            // keep the most critical node for ourselves, the other one can be stolen
+            if( N->get_rank() > w->m_next->get_rank() )
+                std::swap(N, w->m_next);
+            w->m_deque.push(N);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lk(m_inject_lock);
+            m_inject.push_back(N);
+            m_inject_size.store(m_inject.size(), std::memory_order_relaxed);
+        }
+        wake_one();
+    }
+
+    void schedule_batch(exec_node * const * N, size_t count)
+    {
+        if( std::any_of(N, N+count, [](exec_node * n) { return n->get_affinity() >= 0 || n->get_domain() != exec_domain::any; }) )
+        {
+            for(size_t i=0; i < count; ++i)
+                schedule(N[i]);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lk(m_inject_lock);
+            m_inject.insert(m_inject.end(), N, N+count);
+            m_inject_size.store(m_inject.size(), std::memory_order_relaxed);
+        }
+        if( count == 1 )
+        {
+            wake_one();
+            return;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if( m_num_sleeping.load(std::memory_order_relaxed) != 0 )
+        {
+            std::lock_guard<std::mutex> lk(m_sleep_lock);
+            m_sleep_cv.notify_all();
+        }
+    }
+
+    /**
+     * Places a node with an affinity in its worker's mailbox.
+     */
+    void post_to(exec_node * N)
+    {
+        auto & w = *m_workers[ static_cast<size_t>(N->get_affinity()) % m_workers.size() ];
+        {
+            std::lock_guard<std::mutex> lk(w.m_mail_lock);
+            w.m_mail.push_back(N);
+            w.m_mail_size.store(w.m_mail.size(), std::memory_order_relaxed);
+        }
+        if( current_worker() == &w )
+            return;
+
+        // only the owner can take it, so every sleeper has to check
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if( m_num_sleeping.load(std::memory_order_relaxed) != 0 )
+        {
+            std::lock_guard<std::mutex> lk(m_sleep_lock);
+            m_sleep_cv.notify_all();
+        }
+    }
+
+    exec_node * take_mail(worker & w)
+    {
+        if( w.m_mail_size.load(std::memory_order_relaxed) == 0 )
+            return nullptr;
+
+        std::lock_guard<std::mutex> lk(w.m_mail_lock);
+        if( w.m_mail.empty() )
+            return nullptr;
+        auto N = w.m_mail.front();
+        w.m_mail.pop_front();
+        w.m_mail_size.store(w.m_mail.size(), std::memory_order_relaxed);
+        return N;
+    }
+
+    /**
+     * Queues a helper task posted by node_graph::parallel_for(). Tasks are
+     * run before any queued node, since a running node is waiting on them.
+     */
+    void schedule_task(std::function<void(void)> task)
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_inject_lock);
+            m_tasks.push_back( std::move(task) );
+            m_tasks_size.store(m_tasks.size(), std::memory_order_relaxed);
+        }
+        wake_one();
+    }
+
+    bool run_task()
+    {
+        if( m_tasks_size.load(std::memory_order_relaxed) == 0 )
+            return false;
+
+        std::function<void(void)> task;
+        {
+            std::lock_guard<std::mutex> lk(m_inject_lock);
+            if( m_tasks.empty() )
+                return false;
+            task = std::move( m_tasks.front() );
+            m_tasks.pop_front();
+            m_tasks_size.store(m_tasks.size(), std::memory_order_relaxed);
+        }
+        task();
+        return true;
+    }
+
+    void wake_one()
+    {
+        // pairs with the fence in sleep(), either we see the sleeper
+        // or the sleeper sees the work we have just published.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if( m_num_sleeping.load(std::memory_order_relaxed) != 0 )
+        {
+            std::lock_guard<std::mutex> lk(m_sleep_lock);
+            m_sleep_cv.notify_one();
+        }
+    }
+
+    exec_node * take_injected()
+    {
+        if( m_inject_size.load(std::memory_order_relaxed) == 0 )
+            return nullptr;
+
+        std::lock_guard<std::mutex> lk(m_inject_lock);
+        if( m_inject.empty() )
+            return nullptr;
+        auto N = m_inject.front();
+        m_inject.pop_front();
+        m_inject_size.store(m_inject.size(), std::memory_order_relaxed);
+        return N;
+    }
+
+    exec_node * steal(worker & w)
+    {
+        auto n = m_workers.size();
+        w.m_seed = w.m_seed * 1664525u + 1013904223u;
+        auto start = static_cast<size_t>(w.m_seed >> 8) % n;
+
+        // workers on the same NUMA node first, then everyone else
+        for(int pass=0; pass < (m_num_groups > 1 ? 2 : 1); ++pass)
+        {
+            for(size_t i=0; i < n; ++i)
+            {
+                auto & victim = *m_workers[ (start+i) % n ];
+                if( &victim == &w || (m_num_groups > 1 && (victim.m_group == w.m_group) != (pass == 0)) )
+                    continue;
+                if( auto N = victim.m_deque.steal() )
+                {
+#if GRAPHE_METRICS
+                    if( auto M = m_graph.get_metrics() )
+                        M->record_steal();
+#endif
+                    return N;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    exec_node * find_work(worker & w)
+    {
+        if( auto N = w.m_next )
+        {
+            w.m_next = nullptr;
+            return N;
+        }
+        if( auto N = take_mail(w) )
+            return N;
+        if( auto N = w.m_deque.pop() )
+            return N;
+        if( auto N = take_injected() )
+            return N;
+        return steal(w);
+    }
+
+    bool has_work(worker const & self) const
+    {
+        if( self.m_mail_size.load(std::memory_order_relaxed) != 0 )
+            return true;
+        if( m_inject_size.load(std::memory_order_relaxed) != 0 || m_tasks_size.load(std::memory_order_relaxed) != 0 )
+            return true;
+        for(auto & w : m_workers)
+        {
+            if( !w->m_deque.empty() )
+                return true;
+        }
+        return false;
+    }
+
+    void sleep(worker & w)
+    {
+#if GRAPHE_METRICS
+        auto M = m_graph.get_metrics();
+        auto t = M ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+#endif
+        {
+            std::unique_lock<std::mutex> lk(m_sleep_lock);
+            m_num_sleeping.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_sleep_cv.wait(lk, [this, &w] { return m_stop.load() || has_work(w); });
+            m_num_sleeping.fetch_sub(1, std::memory_order_relaxed);
+        }
+#if GRAPHE_METRICS
+        if( M )
+            M->record_idle( std::chrono::steady_clock::now() - t );
+#endif
+    }
+
+    void run(worker & w)
+    {
+        current_worker() = &w;
+        if( w.m_cpu >= 0 )
+            pin_current_thread(w.m_cpu);
+        w.m_seed = static_cast<uint32_t>(w.m_index * 2654435761u + 1);
+
+        while( !m_stop.load(std::memory_order_relaxed) )
+        {
+            if( run_task() )
+                continue;
+
+            exec_node * N = find_work(w);
+
+            // spin for a little while before going to sleep
+            for(int i=0; N == nullptr && i < 64; ++i)
+            {
+                std::this_thread::yield();
+                if( m_tasks_size.load(std::memory_order_relaxed) != 0 )
+                    break;
+                N = find_work(w);
+            }
+
+            if( N )
+            {
+                N->execute();
+                continue;
+            }
+            if( m_tasks_size.load(std::memory_order_relaxed) == 0 )
+                sleep(w);
+        }
+        current_worker() = nullptr;
+    }
+
+    node_graph                           & m_graph;
+    std::vector< std::unique_ptr<worker> > m_workers;
+    size_t                                 m_num_groups = 1; // number of NUMA nodes the workers are spread over
+
+    std::mutex                             m_inject_lock;  // protects m_inject
+    std::deque<exec_node*>                 m_inject;       // nodes scheduled from outside the workers
+    std::atomic<size_t>                    m_inject_size{0};
+    std::deque< std::function<void(void)> > m_tasks;       // parallel_for helpers, also protected by m_inject_lock
+    std::atomic<size_t>                    m_tasks_size{0};
+
+    std::mutex                             m_sleep_lock;
+    std::condition_variable                m_sleep_cv;
+    std::atomic<uint32_t>                  m_num_sleeping{0};
+    std::atomic<bool>                      m_stop{false};
+
+    domain_queues                          m_domains;      // main and named domain nodes
+};
+
+}
+
+#endif
@@ -0,0 +1,269 @@
+/**
+ * Async nodes completed from other threads, and parallel_for() inside a
+ * node, on every executor.
+ */
+#include <thread>
+#include <vector>
+
+#include "graph-e/node_graph.h"
+#include "graph-e/serial_executor.h"
+#include "graph-e/threaded_executor.h"
+#include "graph-e/work_stealing_executor.h"
+
+#include "test_common.h"
+
+/**
+ * Produces its output on a thread of its own, after the body returned.
+ */
+class async_load
+{
+public:
+    graphe::out_resource<int> out;
+    int const * frame;
+    std::vector<std::thread> * threads;
+
+    async_load( graphe::ResourceRegistry & G, int const * f, std::vector<std::thread> * t) : frame(f), threads(t)
+    {
+        out = G.register_output_resource<int>("loaded");
+    }
+    void operator()( graphe::async_handle h)
+    {
+        auto value = *frame;
+        threads->emplace_back( [this, h = std::move(h), value]() mutable
+        {
+            std::this_thread::sleep_for( std::chrono::microseconds(200) );
+            out.set(value);
+            h.complete();
+        });
+    }
+};
+
+class scale
+{
+public:
+    graphe::in_resource<int>                  in;
+    graphe::out_resource< std::vector<int> >  out;
+    graphe::node_graph * graph;
+
+    scale( graphe::ResourceRegistry & G) : graph( G.get_graph() )
+    {
+        in  = G.register_input_resource<int>("loaded");
+        out = G.register_output_resource< std::vector<int> >("scaled");
+    }
+    void operator()()
+    {
+        auto k = *in;
+        out.emplace( 100000 );
+        auto & dst = out.get();
+        graph->parallel_for(0, dst.size(), 1000, [&dst, k](size_t b, size_t e)
+        {
+            for(auto i=b; i < e; ++i)
+                dst[i] = static_cast<int>(i) * k;
+        });
+        out.make_available();
+    }
+};
+
+class verify
+{
+public:
+    graphe::in_resource< std::vector<int> > in;
+    int const * frame;
+    bool * ok;
+
+    verify( graphe::ResourceRegistry & G, int const * f, bool * o) : frame(f), ok(o)
+    {
+        in = G.register_input_resource< std::vector<int> >("scaled");
+    }
+    void operator()()
+    {
+        auto & v = *in;
+        bool good = v.size() == 100000;
+        for(size_t i=0; good && i < v.size(); ++i)
+            good = v[i] == static_cast<int>(i) * *frame;
+        *ok = good;
+    }
+};
+
+template<typename Run>
+static void run_frames(Run && run)
+{
+    graphe::node_graph G;
+    int frame = 0;
+    bool ok = false;
+    std::vector<std::thread> threads;
+    G.add_node<async_load>(&frame, &threads);
+    G.add_node<scale>();
+    G.add_node<verify>(&frame, &ok);
+    G.compile();
+
+    run(G, [&](int f)
+    {
+        frame = f;
+        ok    = false;
+    }, [&]()
+    {
+        CHECK( ok );
+        CHECK( !G.busy() );
+        for(auto & t : threads)
+            t.join();
+        threads.clear();
+    });
+}
+
+static void test_serial()
+{
+    run_frames( [](graphe::node_graph & G, auto && begin, auto && end)
+    {
+        graphe::serial_executor E(G);
+        for(int f=1; f <= 20; ++f)
+        {
+            G.reset();
+            begin(f);
+            E.execute(); // waits for the async node
+            end();
+        }
+    });
+}
+
+static void test_threaded()
+{
+    run_frames( [](graphe::node_graph & G, auto && begin, auto && end)
+    {
+        gnl::thread_pool T(4);
+        ThreadPoolWrapper TW(T);
+        graphe::threaded_executor<ThreadPoolWrapper> E(G);
+        E.set_thread_pool(&TW);
+        for(int f=1; f <= 20; ++f)
+        {
+            G.reset();
+            begin(f);
+            E.execute();
+            E.wait();
+            end();
+        }
+    });
+}
+
+static void test_work_stealing()
+{
+    run_frames( [](graphe::node_graph & G, auto && begin, auto && end)
+    {
+        graphe::work_stealing_executor E(G, 4);
+        for(int f=1; f <= 20; ++f)
+        {
+            G.reset();
+            begin(f);
+            E.execute();
+            E.wait();
+            end();
+        }
+    });
+}
+
+/**
+ * Runs on a pool of four threads but says it has three, and counts the
+ * helper tasks parallel_for() submits.
+ */
+struct counting_pool : ThreadPoolWrapper
+{
+    using ThreadPoolWrapper::ThreadPoolWrapper;
+    using ThreadPoolWrapper::operator();
+
+    void operator()( std::function<void(void)> && task)
+    {
+        ++m_tasks;
+        ThreadPoolWrapper::operator()( std::move(task) );
+    }
+    size_t size()
+    {
+        return 3;
+    }
+    std::atomic<int> m_tasks{0};
+};
+
+/**
+ * parallel_for() uses as many threads as the wrapper's size(), the calling
+ * node being one of them.
+ */
+static void test_pool_size()
+{
+    run_frames( [](graphe::node_graph & G, auto && begin, auto && end)
+    {
+        gnl::thread_pool T(4);
+        counting_pool TW(T);
+        graphe::threaded_executor<counting_pool> E(G);
+        E.set_thread_pool(&TW);
+        for(int f=1; f <= 20; ++f)
+        {
+            G.reset();
+            begin(f);
+            E.execute();
+            E.wait();
+            end();
+        }
+        CHECK( TW.m_tasks == 20 * 2 );
+    });
+}
+
+static_assert( !std::is_copy_constructible<graphe::async_handle>::value, "async_handle must be move-only" );
+static_assert( !std::is_copy_assignable<graphe::async_handle>::value, "async_handle must be move-only" );
+
+static std::atomic<int> g_misuse_caught{0};
+
+class complete_twice
+{
+public:
+    graphe::out_resource<int> out;
+
+    complete_twice( graphe::ResourceRegistry & G)
+    {
+        out = G.register_output_resource<int>("once");
+    }
+    void operator()( graphe::async_handle h)
+    {
+        auto moved = std::move(h);
+        CHECK( !h.valid() && moved.valid() );
+        try { h.complete(); } catch(std::logic_error const &) { ++g_misuse_caught; }
+
+        out.set(1);
+        moved.complete();
+        CHECK( !moved.valid() );
+        try { moved.complete(); } catch(std::logic_error const &) { ++g_misuse_caught; }
+    }
+};
+
+/**
+ * A handle which was moved from or already completed can not finish the
+ * node a second time.
+ */
+static void test_handle()
+{
+    graphe::node_graph G;
+    G.add_node<complete_twice>();
+    G.compile();
+
+    gnl::thread_pool T(2);
+    ThreadPoolWrapper TW(T);
+    graphe::threaded_executor<ThreadPoolWrapper> E(G);
+    E.set_thread_pool(&TW);
+    for(int f=0; f < 10; ++f)
+    {
+        G.reset();
+        E.execute();
+        E.wait();
+        CHECK( !G.busy() );
+        CHECK( G.get_resources("once")->Get<int>() == 1 );
+    }
+    CHECK( g_misuse_caught == 20 );
+}
+
+int main()
+{
+    test_handle();
+    test_serial();
+    test_threaded();
+    test_pool_size();
+    test_work_stealing();
+    return test_result("test_async_nodes");
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#ifndef TEST_COMMON_GRAPH_3_H
+#define TEST_COMMON_GRAPH_3_H
+
+#include <atomic>
+#include <iostream>
+#include <functional>
+#include <string>
+
+#include "gnl/gnl_threadpool.h"
+
+/**
+ * Shared by the tests. Every test is a plain executable which returns 0 when
+ * all of its checks passed, so ctest can run it without a test framework.
+ */
+
+/**
+ * Checks may fail on any thread.
+ */
+inline std::atomic<int> & test_failures()
+{
+    static std::atomic<int> failures{0};
+    return failures;
+}
+
+/**
+ * Checks a condition. A failed check is reported and counted, the test
+ * keeps running so that one run shows every failure.
+ */
+#define CHECK(cond) \
+    do { \
+        if( !(cond) ) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+            ++test_failures(); \
+        } \
+    } while(0)
+
+/**
+ * Checks that an expression throws an exception derived from std::exception.
+ */
+#define CHECK_THROWS(expr) \
+    do { \
+        bool test_threw = false; \
+        try { expr; } catch(std::exception const &) { test_threw = true; } \
+        if( !test_threw ) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_THROWS(" #expr ") did not throw" << std::endl; \
+            ++test_failures(); \
+        } \
+    } while(0)
+
+inline int test_result(char const * name)
+{
+    if( test_failures() )
+        std::cerr << name << ": " << test_failures().load() << " check(s) failed" << std::endl;
+    else
+        std::cout << name << ": passed" << std::endl;
+    return test_failures() ? 1 : 0;
+}
+
+/**
+ * @brief The ThreadPoolWrapper struct
+ *
+ * Lets the executors which take a thread pool run on a gnl::thread_pool,
+ * see the README.
+ */
+struct ThreadPoolWrapper
+{
+    ThreadPoolWrapper( gnl::thread_pool & T) : m_threadpool(&T)
+    {
+    }
+    void operator()( std::function<void(void)> & exec)
+    {
+        m_threadpool->post( [&exec]() { exec(); } );
+    }
+    void operator()( std::function<void(void)> ** exec, size_t count)
+    {
+        m_threadpool->post_batch( count, [exec](size_t i) { auto e = exec[i]; return [e]() { (*e)(); }; } );
+    }
+    void operator()( std::function<void(void)> && task)
+    {
+        m_threadpool->post( std::move(task) );
+    }
+    bool try_run_one()
+    {
+        return m_threadpool->try_run_one();
+    }
+    size_t size()
+    {
+        return m_threadpool->num_workers();
+    }
+    gnl::thread_pool *m_threadpool;
+};
+
+#endif
@@ -0,0 +1,282 @@
+/**
+ * distributed_executor: a graph split over three partitions, connected by a
+ * local_network or by sockets, computes every frame like the whole graph
+ * would, and values which can not be used are reported by wait().
+ */
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+
+#include "graph-e/distributed_executor.h"
+
+#include "test_common.h"
+
+using buffer = std::vector<float>;
+
+GRAPHE_REGISTER_VALUE(int);
+GRAPHE_REGISTER_VALUE(float);
+GRAPHE_REGISTER_VALUE(buffer);
+
+class source
+{
+public:
+    graphe::out_resource<int> out;
+    int const * frame;
+
+    source( graphe::ResourceRegistry & G, int const * f) : frame(f)
+    {
+        out = G.register_output_resource<int>("t");
+    }
+    void operator()()
+    {
+        out.set(*frame);
+    }
+};
+
+class stage
+{
+public:
+    graphe::in_resource<int>     t;
+    graphe::in_resource<buffer>  in;
+    graphe::out_resource<buffer> out;
+    bool first;
+
+    stage( graphe::ResourceRegistry & G, int c, int k) : first(k == 0)
+    {
+        if( first )
+            t  = G.register_input_resource<int>("t");
+        else
+            in = G.register_input_resource<buffer>( "c" + std::to_string(c) + "_" + std::to_string(k-1) );
+        out = G.register_output_resource<buffer>( "c" + std::to_string(c) + "_" + std::to_string(k) );
+    }
+    void operator()()
+    {
+        buffer b = first ? buffer( 256, static_cast<float>(*t) ) : *in;
+        b[0] += 1;
+        out.set( std::move(b) );
+    }
+};
+
+class sum
+{
+public:
+    std::vector< graphe::in_resource<buffer> > in;
+    float * result;
+
+    sum( graphe::ResourceRegistry & G, int chains, int length, float * r) : result(r)
+    {
+        for(int c=0; c < chains; ++c)
+            in.push_back( G.register_input_resource<buffer>( "c" + std::to_string(c) + "_" + std::to_string(length-1) ) );
+    }
+    void operator()()
+    {
+        float s = 0;
+        for(auto & i : in)
+            s += (*i)[0] + (*i)[255];
+        *result = s;
+    }
+};
+
+static const int chains     = 6;
+static const int length     = 20;
+static const int num_frames = 60;
+static const uint32_t parts = 3;
+
+static void build(graphe::node_graph & G, int * frame, float * result)
+{
+    G.add_node<source>(frame);
+    for(int c=0; c < chains; ++c)
+        for(int k=0; k < length; ++k)
+            G.add_node<stage>(c, k);
+    G.add_node<sum>(chains, length, result);
+}
+
+static double weight(graphe::resource_node & R)
+{
+    return R.get_type() == typeid(buffer) ? 1024.0 : 4.0;
+}
+
+/**
+ * Runs every partition on a thread of its own, one of them compiles its
+ * graph before the executor is created.
+ */
+static void run(std::vector<graphe::transport*> const & transports)
+{
+    std::vector<uint32_t> part;
+    {
+        graphe::node_graph G;
+        int frame = 0;
+        float result = 0;
+        build(G, &frame, &result);
+        part = graphe::graph_partitioner::partition(G, parts, weight);
+    }
+
+    std::atomic<int> wrong{0};
+    std::atomic<int> sums{0};
+    std::atomic<uint64_t> sent{0}, received{0};
+    std::vector<std::thread> threads;
+    for(uint32_t r=0; r < parts; ++r)
+        threads.emplace_back( [&, r]()
+        {
+            graphe::node_graph G;
+            int frame = 0;
+            float result = -1;
+            build(G, &frame, &result);
+            if( r == 1 )
+                G.compile();
+            graphe::distributed_executor X(G, *transports[r], part, 2);
+            G.compile();
+
+            bool has_sum = false; // the partition keeps only its own nodes
+            for(auto N : G.get_exec_nodes())
+                if( std::string( N->get_name() ).find("sum") != std::string::npos )
+                    has_sum = true;
+            for(frame=0; frame < num_frames; ++frame)
+            {
+                G.reset();
+                X.execute();
+                X.wait();
+                if( has_sum && result != static_cast<float>( chains * (2 * frame + length) ) )
+                    ++wrong;
+            }
+            if( has_sum )
+                ++sums;
+            sent     += X.get_bytes_sent();
+            received += X.get_bytes_received();
+        });
+    for(auto & t : threads)
+        t.join();
+
+    CHECK( wrong == 0 );
+    CHECK( sums == 1 );
+    CHECK( sent > 0 );
+    CHECK( sent == received );
+}
+
+static void test_local_network()
+{
+    graphe::local_network net(parts);
+    std::vector<graphe::transport*> transports;
+    for(uint32_t r=0; r < parts; ++r)
+        transports.push_back( &net.get_endpoint(r) );
+    run(transports);
+}
+
+static void test_sockets()
+{
+    std::vector< std::vector<int> > sockets( parts, std::vector<int>(parts, -1) );
+    for(uint32_t a=0; a < parts; ++a)
+        for(uint32_t b=a+1; b < parts; ++b)
+        {
+            int sv[2];
+            CHECK( ::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0 );
+            sockets[a][b] = sv[0];
+            sockets[b][a] = sv[1];
+        }
+
+    std::vector< std::unique_ptr<graphe::socket_transport> > owned;
+    std::vector<graphe::transport*> transports;
+    for(uint32_t r=0; r < parts; ++r)
+    {
+        owned.emplace_back( new graphe::socket_transport(r, sockets[r]) );
+        transports.push_back( owned.back().get() );
+    }
+    run(transports);
+}
+
+static int g_received = -1;
+
+class produce
+{
+public:
+    graphe::out_resource<int> out;
+
+    produce( graphe::ResourceRegistry & G)
+    {
+        out = G.register_output_resource<int>("v");
+    }
+    void operator()()
+    {
+        out.set(7);
+    }
+};
+
+class consume
+{
+public:
+    graphe::in_resource<int> in;
+
+    consume( graphe::ResourceRegistry & G)
+    {
+        in = G.register_input_resource<int>("v");
+    }
+    void operator()()
+    {
+        g_received = *in;
+    }
+};
+
+static graphe::resource_message int_message(graphe::resource_id id, uint64_t frame, int v)
+{
+    graphe::resource_message m;
+    m.resource = id;
+    m.frame    = frame;
+    m.data.assign( reinterpret_cast<uint8_t const*>(&v), reinterpret_cast<uint8_t const*>(&v) + sizeof(v) );
+    return m;
+}
+
+/**
+ * Partition 1 executes on its own, the messages of partition 0 are sent by
+ * hand.
+ */
+static void test_errors()
+{
+    graphe::local_network net(2);
+    graphe::node_graph G;
+    G.add_node<produce>();
+    G.add_node<consume>();
+    std::vector<uint32_t> part = { 0, 1 };
+    graphe::distributed_executor X(G, net.get_endpoint(1), part, 2);
+    G.compile();
+    auto id    = G.get_resource_id("v");
+    auto & peer = net.get_endpoint(0);
+
+    // a resource partition 1 does not import: the value of the frame is still used
+    peer.send( 1, int_message(id, 0, 5) );
+    graphe::resource_message unknown;
+    unknown.resource = 999;
+    peer.send( 1, unknown );
+    G.reset();
+    X.execute();
+    CHECK_THROWS( X.wait() );
+    CHECK( g_received == 5 );
+
+    // a value of the wrong size is replaced by int()
+    G.reset();
+    X.execute();
+    auto bad = int_message(id, 1, 1234);
+    bad.data.resize(3);
+    peer.send( 1, bad );
+    CHECK_THROWS( X.wait() );
+    CHECK( g_received == 0 );
+
+    // the value of frame 2 is lost, the one of frame 3 is kept for the next frame
+    peer.send( 1, int_message(id, 3, 9) );
+    G.reset();
+    X.execute();
+    CHECK_THROWS( X.wait() );
+
+    G.reset();
+    X.execute();
+    X.wait();
+    CHECK( g_received == 9 );
+}
+
+int main()
+{
+    test_local_network();
+    test_sockets();
+    test_errors();
+    return test_result("test_distributed_executor");
+}
@@ -0,0 +1,217 @@
+/**
+ * Adding and removing nodes between frames of a compiled graph, and
+ * reclaiming the storage and resources of the removed nodes.
+ */
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "graph-e/node_graph.h"
+#include "graph-e/serial_executor.h"
+#include "graph-e/threaded_executor.h"
+
+#include "test_common.h"
+
+static std::atomic<int> g_runs{0};
+
+class clock_node
+{
+public:
+    graphe::out_resource<int> out;
+    int const * frame;
+
+    clock_node( graphe::ResourceRegistry & G, int const * f) : frame(f)
+    {
+        out = G.register_output_resource<int>("t");
+    }
+    void operator()()
+    {
+        out.set(*frame);
+    }
+};
+
+class move_node
+{
+public:
+    graphe::in_resource<int>  in;
+    graphe::out_resource<int> out;
+    int id;
+
+    move_node( graphe::ResourceRegistry & G, int i) : id(i)
+    {
+        in  = G.register_input_resource<int>("t");
+        out = G.register_output_resource<int>("pos" + std::to_string(i));
+    }
+    void operator()()
+    {
+        ++g_runs;
+        out.set( *in * 1000 + id );
+    }
+};
+
+class draw_node
+{
+public:
+    graphe::in_resource<int> in;
+    int * sink;
+
+    draw_node( graphe::ResourceRegistry & G, int i, int * s) : sink(s)
+    {
+        in = G.register_input_resource<int>("pos" + std::to_string(i));
+    }
+    void operator()()
+    {
+        ++g_runs;
+        *sink = *in;
+    }
+};
+
+class once_node
+{
+public:
+    graphe::out_resource<int> out;
+
+    once_node( graphe::ResourceRegistry & G, int i)
+    {
+        out = G.register_output_resource<int, graphe::resource_flags::permanent>("once" + std::to_string(i));
+    }
+    void operator()()
+    {
+        ++g_runs;
+        out.set(1);
+    }
+};
+
+/**
+ * Entities spawn and despawn every frame, each one a pair of nodes.
+ */
+static void test_churn(bool fusion, bool release)
+{
+    graphe::node_graph G;
+    int frame = 0;
+    G.add_node<clock_node>(&frame);
+    G.set_fusion(fusion);
+    G.set_release_transients(release);
+    G.compile();
+
+    gnl::thread_pool T(4);
+    ThreadPoolWrapper TW(T);
+    graphe::threaded_executor<ThreadPoolWrapper> E(G);
+    E.set_thread_pool(&TW);
+
+    struct entity
+    {
+        graphe::exec_node * move = nullptr;
+        graphe::exec_node * draw = nullptr;
+        int                 sink = -1;
+    };
+    std::map<int, std::unique_ptr<entity> > entities;
+    std::mt19937 rng(7);
+    int next = 0;
+    for(frame=0; frame < 300; ++frame)
+    {
+        G.reset();
+        auto despawn = rng() % 5;
+        for(size_t k=0; k < despawn && !entities.empty(); ++k)
+        {
+            auto it = entities.begin();
+            std::advance(it, rng() % entities.size());
+            G.remove_node(*it->second->move);
+            G.remove_node(*it->second->draw);
+            entities.erase(it);
+        }
+        auto spawn = rng() % 6;
+        for(size_t k=0; k < spawn; ++k)
+        {
+            auto e = std::make_unique<entity>();
+            auto id = next++;
+            e->move = &G.add_node<move_node>(id);
+            e->draw = &G.add_node<draw_node>(id, &e->sink);
+            entities[id] = std::move(e);
+        }
+        if( frame % 97 == 0 )
+            G.compute_ranks();
+
+        g_runs = 0;
+        E.execute();
+        E.wait();
+        CHECK( G.is_compiled() );
+        CHECK( g_runs == static_cast<int>(entities.size() * 2) );
+        for(auto & e : entities)
+            CHECK( e.second->sink == frame * 1000 + e.first );
+    }
+    CHECK( G.get_exec_nodes().size() == entities.size() * 2 + 1 );
+}
+
+static void test_reclaim()
+{
+    graphe::node_graph G;
+    int frame = 0;
+    int sink  = -1;
+    G.add_node<clock_node>(&frame);
+    G.compile();
+    graphe::serial_executor E(G);
+
+    auto id = graphe::invalid_resource_id;
+    for(frame=0; frame < 100; ++frame)
+    {
+        G.reset();
+        auto & M = G.add_node<move_node>(3);
+        auto & D = G.add_node<draw_node>(3, &sink);
+        E.execute();
+        CHECK( sink == frame * 1000 + 3 );
+
+        // the name keeps its id, the resource is created again
+        if( frame == 0 )
+            id = G.get_resource_id("pos3");
+        CHECK( G.get_resource_id("pos3") == id );
+
+        G.remove_node(M);
+        CHECK( G.get_resources(id) != nullptr ); // still read by D
+        G.remove_node(D);
+        CHECK( G.get_resources(id) == nullptr ); // nobody uses it any more
+    }
+    CHECK( G.get_exec_nodes().size() == 1 );
+    CHECK( G.get_resources("t") != nullptr );   // still produced by the clock
+}
+
+static void test_oneshot_removed_by_reset()
+{
+    graphe::node_graph G;
+    int frame = 0;
+    G.add_node<clock_node>(&frame);
+    G.compile();
+    graphe::serial_executor E(G);
+
+    int total = 0;
+    for(frame=0; frame < 50; ++frame)
+    {
+        G.reset();
+        g_runs = 0;
+        G.add_oneshot_node<once_node>(frame);
+        E.execute();
+        total += g_runs;
+    }
+    CHECK( total == 50 );
+    CHECK( G.get_exec_nodes().size() <= 2 );
+}
+
+static void test_remove_checks()
+{
+    graphe::node_graph G, H;
+    int frame = 0;
+    auto & N = H.add_node<clock_node>(&frame);
+    CHECK_THROWS( G.remove_node(N) ); // belongs to another graph
+}
+
+int main()
+{
+    test_churn(false, false);
+    test_churn(true, false);
+    test_churn(false, true);
+    test_reclaim();
+    test_oneshot_removed_by_reset();
+    test_remove_checks();
+    return test_result("test_dynamic_graph");
+}
@@ -0,0 +1,160 @@
+/**
+ * Nodes tagged with an execution domain run on the thread of their domain,
+ * with threaded_executor and work_stealing_executor.
+ */
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "graph-e/node_graph.h"
+#include "graph-e/threaded_executor.h"
+#include "graph-e/work_stealing_executor.h"
+
+#include "test_common.h"
+
+static std::thread::id            g_main;
+static std::mutex                 g_lock;
+static std::set<std::thread::id>  g_gpu_threads;
+static std::atomic<int>           g_wrong_thread{0};
+static std::atomic<int>           g_runs{0};
+
+class start_node
+{
+public:
+    graphe::out_resource<int> out;
+
+    start_node( graphe::ResourceRegistry & G)
+    {
+        out = G.register_output_resource<int>("a");
+    }
+    void operator()()
+    {
+        ++g_runs;
+        out.set(1);
+    }
+};
+
+class window_node
+{
+public:
+    graphe::in_resource<int>  in;
+    graphe::out_resource<int> out;
+
+    window_node( graphe::ResourceRegistry & G)
+    {
+        in  = G.register_input_resource<int>("a");
+        out = G.register_output_resource<int>("m");
+    }
+    void operator()()
+    {
+        ++g_runs;
+        if( std::this_thread::get_id() != g_main )
+            ++g_wrong_thread;
+        out.set( *in + 1 );
+    }
+};
+
+class upload_node
+{
+public:
+    graphe::in_resource<int>  in;
+    graphe::out_resource<int> out;
+
+    upload_node( graphe::ResourceRegistry & G)
+    {
+        in  = G.register_input_resource<int>("m");
+        out = G.register_output_resource<int>("g");
+    }
+    void operator()()
+    {
+        ++g_runs;
+        {
+            std::lock_guard<std::mutex> lk(g_lock);
+            g_gpu_threads.insert( std::this_thread::get_id() );
+        }
+        if( std::this_thread::get_id() == g_main )
+            ++g_wrong_thread;
+        out.set( *in + 1 );
+    }
+};
+
+class end_node
+{
+public:
+    graphe::in_resource<int> in;
+    int * result;
+
+    end_node( graphe::ResourceRegistry & G, int * r) : result(r)
+    {
+        in = G.register_input_resource<int>("g");
+    }
+    void operator()()
+    {
+        ++g_runs;
+        *result = *in;
+    }
+};
+
+template<typename Executor>
+static void run_domains(graphe::node_graph & G, Executor & E, int & result)
+{
+    g_runs = 0;
+    g_wrong_thread = 0;
+    g_gpu_threads.clear();
+    for(int f=0; f < 100; ++f)
+    {
+        result = 0;
+        E.execute();
+        E.wait();
+        CHECK( result == 3 );
+        G.reset();
+    }
+    CHECK( g_runs == 400 );
+    CHECK( g_wrong_thread == 0 );
+    CHECK( g_gpu_threads.size() == 1 ); // the named domain always runs on the same thread
+}
+
+static void build(graphe::node_graph & G, int * result)
+{
+    auto gpu = G.get_domain("gpu");
+    CHECK( gpu == graphe::exec_domain::first_named );
+    CHECK( G.get_domain("gpu") == gpu );
+    CHECK( G.get_domain_name(gpu) == "gpu" );
+
+    G.add_node<start_node>();
+    G.add_node<window_node>().set_domain(graphe::exec_domain::main);
+    G.add_node<upload_node>().set_domain(gpu);
+    G.add_node<end_node>(result);
+    G.compile();
+}
+
+static void test_threaded()
+{
+    graphe::node_graph G;
+    int result = 0;
+    build(G, &result);
+
+    gnl::thread_pool T(4);
+    ThreadPoolWrapper TW(T);
+    graphe::threaded_executor<ThreadPoolWrapper> E(G);
+    E.set_thread_pool(&TW);
+    run_domains(G, E, result);
+}
+
+static void test_work_stealing()
+{
+    graphe::node_graph G;
+    int result = 0;
+    build(G, &result);
+
+    graphe::work_stealing_executor E(G, 4);
+    run_domains(G, E, result);
+}
+
+int main()
+{
+    g_main = std::this_thread::get_id();
+    test_threaded();
+    test_work_stealing();
+    return test_result("test_execution_domains");
+}
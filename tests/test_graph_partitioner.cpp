@@ -0,0 +1,156 @@
+/**
+ * graph_partitioner: every node gets a partition, the partitions are
+ * balanced by cost, the cut is smaller than a round-robin split, and the
+ * result only depends on the graph.
+ */
+#include <string>
+
+#include "graph-e/graph_partitioner.h"
+
+#include "test_common.h"
+
+using buffer = std::vector<float>;
+
+class source
+{
+public:
+    source( graphe::ResourceRegistry & G)
+    {
+        G.register_output_resource<int>("t");
+    }
+    void operator()()
+    {
+    }
+};
+
+class stage
+{
+public:
+    stage( graphe::ResourceRegistry & G, int c, int k)
+    {
+        if( k == 0 )
+            G.register_input_resource<int>("t");
+        else
+            G.register_input_resource<buffer>( "c" + std::to_string(c) + "_" + std::to_string(k-1) );
+        G.register_output_resource<buffer>( "c" + std::to_string(c) + "_" + std::to_string(k) );
+    }
+    void operator()()
+    {
+    }
+};
+
+class sum
+{
+public:
+    sum( graphe::ResourceRegistry & G, int chains, int length)
+    {
+        for(int c=0; c < chains; ++c)
+            G.register_input_resource<buffer>( "c" + std::to_string(c) + "_" + std::to_string(length-1) );
+        G.register_output_resource<float>("sum");
+    }
+    void operator()()
+    {
+    }
+};
+
+static const int chains = 8;
+static const int length = 24;
+
+static void build(graphe::node_graph & G)
+{
+    G.add_node<source>();
+    for(int c=0; c < chains; ++c)
+        for(int k=0; k < length; ++k)
+            G.add_node<stage>(c, k);
+    G.add_node<sum>(chains, length);
+}
+
+static double weight(graphe::resource_node & R)
+{
+    return R.get_type() == typeid(buffer) ? 1024.0 : 4.0;
+}
+
+static void check_balance(graphe::node_graph & G, std::vector<uint32_t> const & part, uint32_t parts, double imbalance)
+{
+    std::vector<double> load(parts, 0.0);
+    double total   = 0.0;
+    double largest = 0.0;
+    for(auto N : G.get_exec_nodes())
+    {
+        CHECK( part[N->get_id()] < parts );
+        if( part[N->get_id()] >= parts )
+            continue;
+        double c = N->get_cost_hint() > 0.0 ? N->get_cost_hint() : 1.0;
+        load[ part[N->get_id()] ] += c;
+        total  += c;
+        largest = std::max(largest, c);
+    }
+    for(auto l : load)
+    {
+        CHECK( l > 0.0 );
+        CHECK( l <= std::max( total / parts * (1.0 + imbalance), largest ) + 1e-9 );
+    }
+}
+
+static void test_chains()
+{
+    for(uint32_t parts : { 2u, 3u, 4u })
+    {
+        graphe::node_graph G;
+        build(G);
+        auto part = graphe::graph_partitioner::partition(G, parts, weight);
+        CHECK( part.size() == G.get_num_node_ids() );
+        check_balance(G, part, parts, 0.1);
+
+        std::vector<uint32_t> round_robin( part.size() );
+        for(size_t i=0; i < round_robin.size(); ++i)
+            round_robin[i] = static_cast<uint32_t>(i % parts);
+        auto cut   = graphe::graph_partitioner::cut_bytes(G, part, weight);
+        auto naive = graphe::graph_partitioner::cut_bytes(G, round_robin, weight);
+        CHECK( cut > 0.0 );
+        CHECK( cut * 4 < naive );
+
+        // every process computes the same partition from its own copy of the graph
+        graphe::node_graph H;
+        build(H);
+        CHECK( graphe::graph_partitioner::partition(H, parts, weight) == part );
+    }
+}
+
+static void test_cost_hints()
+{
+    graphe::node_graph G;
+    build(G);
+    // the first chain costs as much as all the others together
+    int hinted = 0;
+    for(auto N : G.get_exec_nodes())
+        if( std::string( N->get_name() ).find("stage") != std::string::npos && N->get_id() <= length )
+        {
+            N->set_cost_hint( chains - 1 );
+            ++hinted;
+        }
+    CHECK( hinted == length );
+    auto part = graphe::graph_partitioner::partition(G, 2, weight, 0.2);
+    check_balance(G, part, 2, 0.2);
+}
+
+static void test_single_partition()
+{
+    graphe::node_graph G;
+    build(G);
+    auto part = graphe::graph_partitioner::partition(G, 1, weight);
+    for(auto p : part)
+        CHECK( p == 0 );
+    CHECK( graphe::graph_partitioner::cut_bytes(G, part, weight) == 0.0 );
+
+    graphe::node_graph empty;
+    CHECK( graphe::graph_partitioner::partition(empty, 4).empty() );
+}
+
+int main()
+{
+    test_chains();
+    test_cost_hints();
+    test_single_partition();
+    return test_result("test_graph_partitioner");
+}
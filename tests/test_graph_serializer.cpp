@@ -0,0 +1,340 @@
+/**
+ * graph_serializer: a saved graph loads with the same nodes, resources,
+ * domains and affinities and executes to the same result; files which do not
+ * match the registry or are corrupt are rejected.
+ */
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include "graph-e/graph_serializer.h"
+#include "graph-e/graph_template.h"
+#include "graph-e/serial_executor.h"
+#include "graph-e/threaded_executor.h"
+
+#include "test_common.h"
+
+namespace app {
+
+class config
+{
+public:
+    graphe::out_resource<int> out;
+
+    config( graphe::ResourceRegistry & G)
+    {
+        out = G.register_output_resource<int, graphe::resource_flags::permanent>("cfg");
+    }
+    void operator()()
+    {
+        out.set(10);
+    }
+};
+
+class decode
+{
+public:
+    graphe::in_resource<int>  cfg;
+    graphe::out_resource<int> out;
+
+    decode( graphe::ResourceRegistry & G)
+    {
+        cfg = G.register_input_resource<int, graphe::resource_flags::permanent>("/cfg");
+        out = G.register_output_resource<int>("frame");
+    }
+    void operator()()
+    {
+        out.set( *cfg + 1 );
+    }
+};
+
+class scale
+{
+public:
+    graphe::in_resource<int>  in;
+    graphe::out_resource<int> out;
+
+    scale( graphe::ResourceRegistry & G)
+    {
+        in  = G.register_input_resource<int>("frame");
+        out = G.register_output_resource<int>("scaled");
+    }
+    void operator()()
+    {
+        out.set( *in * 2 );
+    }
+};
+
+static long g_total = 0;
+
+class accumulate
+{
+public:
+    graphe::in_resource<int> in;
+
+    accumulate( graphe::ResourceRegistry & G)
+    {
+        in = G.register_input_resource<int>("scaled");
+    }
+    void operator()()
+    {
+        g_total += *in;
+    }
+};
+
+static std::vector<int> g_order;
+
+template<int k>
+class branch
+{
+public:
+    graphe::in_resource<int> in;
+
+    branch( graphe::ResourceRegistry & G)
+    {
+        in = G.register_input_resource<int>("frame");
+    }
+    void operator()()
+    {
+        g_order.push_back(k);
+    }
+};
+
+class emit
+{
+public:
+    graphe::out_resource<int> out;
+
+    emit( graphe::ResourceRegistry & G)
+    {
+        out = G.register_output_resource<int>("frame");
+    }
+    void operator()()
+    {
+        out.set(1);
+    }
+};
+
+} // namespace app
+
+GRAPHE_REGISTER_NODE(app::config,     "app.config");
+GRAPHE_REGISTER_NODE(app::decode,     "app.decode");
+GRAPHE_REGISTER_NODE(app::scale,      "app.scale");
+GRAPHE_REGISTER_NODE(app::accumulate, "app.accumulate");
+GRAPHE_REGISTER_NODE(app::emit,       "app.emit");
+GRAPHE_REGISTER_NODE(app::branch<1>,  "app.branch1");
+GRAPHE_REGISTER_NODE(app::branch<2>,  "app.branch2");
+GRAPHE_REGISTER_NODE(app::branch<3>,  "app.branch3");
+GRAPHE_REGISTER_NODE(app::branch<4>,  "app.branch4");
+
+class not_registered
+{
+public:
+    not_registered( graphe::ResourceRegistry & G)
+    {
+        G.register_input_resource<int>("frame");
+    }
+    void operator()()
+    {
+    }
+};
+
+static const int num_streams = 200;
+
+static void build(graphe::node_graph & G)
+{
+    auto gpu = G.get_domain("gpu");
+    G.add_oneshot_node<app::config>();
+    graphe::graph_template T;
+    T.add_node<app::decode>()
+     .add_node<app::scale>()
+     .add_node<app::accumulate>();
+    for(int i=0; i < num_streams; ++i)
+        T.instantiate(G, "s" + std::to_string(i) + "/");
+    G.get_exec_nodes()[1]->set_domain(gpu);
+    G.get_exec_nodes()[2]->set_domain(graphe::exec_domain::main);
+    G.get_exec_nodes()[5]->set_affinity(3);
+    G.compile();
+}
+
+/**
+ * Loading needs the data to be aligned like the records, as it is in a
+ * mapped file.
+ */
+static std::vector<uint64_t> save_to_buffer(graphe::node_graph const & G, size_t & size)
+{
+    std::stringstream ss;
+    graphe::graph_serializer::save(G, ss);
+    auto s = ss.str();
+    std::vector<uint64_t> buf( (s.size() + 7) / 8 );
+    std::memcpy( buf.data(), s.data(), s.size() );
+    size = s.size();
+    return buf;
+}
+
+static void test_roundtrip()
+{
+    graphe::node_graph G;
+    build(G);
+
+    size_t size = 0;
+    auto buf = save_to_buffer(G, size);
+
+    graphe::node_graph H;
+    auto gpu = H.get_domain("gpu");
+    graphe::graph_serializer::load( H, reinterpret_cast<char const*>(buf.data()), size );
+
+    CHECK( H.get_exec_nodes().size() == G.get_exec_nodes().size() );
+    for(size_t i=0; i < H.get_exec_nodes().size(); ++i)
+    {
+        CHECK( H.get_exec_nodes()[i]->get_name()     == G.get_exec_nodes()[i]->get_name() );
+        CHECK( H.get_exec_nodes()[i]->get_affinity() == G.get_exec_nodes()[i]->get_affinity() );
+    }
+    CHECK( H.get_exec_nodes()[1]->get_domain() == gpu );
+    CHECK( H.get_exec_nodes()[2]->get_domain() == graphe::exec_domain::main );
+    CHECK( H.get_exec_nodes()[5]->get_affinity() == 3 );
+    CHECK( H.get_resource_id("s7/scaled") == G.get_resource_id("s7/scaled") );
+
+    graphe::serial_executor E(H);
+    for(int f=0; f < 3; ++f)
+    {
+        app::g_total = 0;
+        H.reset();
+        E.execute();
+        CHECK( app::g_total == num_streams * 22 );
+    }
+}
+
+/**
+ * Runs every task as soon as it is submitted, so nodes which become ready
+ * together execute in the order of the successor list.
+ */
+struct inline_pool
+{
+    void operator()( std::function<void(void)> & exec)
+    {
+        exec();
+    }
+};
+
+static std::vector<int> execution_order(graphe::node_graph & G)
+{
+    graphe::threaded_executor<inline_pool> E(G);
+    inline_pool pool;
+    E.set_thread_pool(&pool);
+    app::g_order.clear();
+    G.reset();
+    E.execute();
+    E.wait();
+    return app::g_order;
+}
+
+/**
+ * The ranks computed before saving order the dependents of "frame" in the
+ * loaded graph, not ranks recomputed from nodes which never executed. The
+ * cost hints which ranked them are cleared before the graph is saved.
+ */
+static void test_saved_ranks()
+{
+    graphe::node_graph G;
+    G.add_node<app::emit>();
+    G.add_node< app::branch<1> >();
+    G.add_node< app::branch<2> >();
+    G.add_node< app::branch<3> >();
+    G.add_node< app::branch<4> >();
+    G.compile();
+    CHECK( execution_order(G) == std::vector<int>({ 1, 2, 3, 4 }) ); // equal ranks keep the order of addition
+
+    for(int k=1; k <= 4; ++k)
+        G.get_exec_nodes()[k]->set_cost_hint(100.0 * k);
+    G.compute_ranks();
+    for(int k=1; k <= 4; ++k)
+        G.get_exec_nodes()[k]->set_cost_hint(0.0);
+    CHECK( G.get_exec_nodes()[4]->get_rank() > G.get_exec_nodes()[1]->get_rank() );
+    auto saved_order = execution_order(G);
+    CHECK( saved_order == std::vector<int>({ 4, 3, 2, 1 }) );
+
+    size_t size = 0;
+    auto buf = save_to_buffer(G, size);
+    graphe::node_graph H;
+    graphe::graph_serializer::load( H, reinterpret_cast<char const*>(buf.data()), size );
+    for(size_t i=0; i < H.get_exec_nodes().size(); ++i)
+        CHECK( H.get_exec_nodes()[i]->get_rank() == G.get_exec_nodes()[i]->get_rank() );
+    CHECK( execution_order(H) == saved_order );
+}
+
+static void test_file()
+{
+    graphe::node_graph G;
+    build(G);
+    std::string path = "test_graph_serializer.bin";
+    graphe::graph_serializer::save(G, path);
+
+    graphe::node_graph H;
+    graphe::graph_serializer::load(H, path);
+    CHECK( H.get_exec_nodes().size() == G.get_exec_nodes().size() );
+
+    graphe::serial_executor E(H);
+    app::g_total = 0;
+    E.execute();
+    CHECK( app::g_total == num_streams * 22 );
+
+    // a registry whose factories register other resources than the saved ones
+    graphe::node_type_registry R;
+    R.add<app::config>("app.config");
+    R.add<app::accumulate>("app.decode");
+    R.add<app::scale>("app.scale");
+    R.add<app::accumulate>("app.accumulate");
+    graphe::node_graph K;
+    CHECK_THROWS( graphe::graph_serializer::load(K, path, R) );
+
+    // a registry without the types
+    graphe::node_type_registry empty;
+    graphe::node_graph L;
+    CHECK_THROWS( graphe::graph_serializer::load(L, path, empty) );
+
+    std::remove( path.c_str() );
+    graphe::node_graph M;
+    CHECK_THROWS( graphe::graph_serializer::load(M, path) );
+}
+
+static void test_errors()
+{
+    {
+        graphe::node_graph G;
+        G.add_node<app::decode>();
+        G.add_node<not_registered>();
+        std::stringstream ss;
+        CHECK_THROWS( graphe::graph_serializer::save(G, ss) );
+    }
+
+    std::vector<uint64_t> junk(16, 0x7878787878787878ull);
+    {
+        graphe::node_graph G;
+        CHECK_THROWS( graphe::graph_serializer::load( G, reinterpret_cast<char const*>(junk.data()), junk.size() * 8 ) );
+    }
+
+    // a truncated file
+    graphe::node_graph G;
+    build(G);
+    size_t size = 0;
+    auto buf = save_to_buffer(G, size);
+    {
+        graphe::node_graph H;
+        CHECK_THROWS( graphe::graph_serializer::load( H, reinterpret_cast<char const*>(buf.data()), size / 2 ) );
+    }
+
+    // the target must be empty
+    graphe::node_graph H;
+    H.add_node<app::scale>();
+    CHECK_THROWS( graphe::graph_serializer::load( H, reinterpret_cast<char const*>(buf.data()), size ) );
+}
+
+int main()
+{
+    test_roundtrip();
+    test_saved_ranks();
+    test_file();
+    test_errors();
+    return test_result("test_graph_serializer");
+}
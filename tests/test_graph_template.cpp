@@ -0,0 +1,229 @@
+/**
+ * graph_template: instances get their own prefixed resources and share the
+ * '/' ones, before and after the graph is compiled, and an instance which
+ * throws is rolled back.
+ */
+#include <string>
+
+#include "graph-e/graph_template.h"
+#include "graph-e/serial_executor.h"
+
+#include "test_common.h"
+
+class settings
+{
+public:
+    graphe::out_resource<int> out;
+
+    settings( graphe::ResourceRegistry & G)
+    {
+        out = G.register_output_resource<int>("settings");
+    }
+    void operator()()
+    {
+        out.set(10);
+    }
+};
+
+class decode
+{
+public:
+    graphe::in_resource<int>  settings;
+    graphe::out_resource<int> frame;
+    int offset;
+
+    decode( graphe::ResourceRegistry & G, int k) : offset(k)
+    {
+        settings = G.register_input_resource<int>("/settings");
+        frame    = G.register_output_resource<int>("frame");
+    }
+    void operator()()
+    {
+        frame.set( *settings + offset );
+    }
+};
+
+class detect
+{
+public:
+    graphe::in_resource<int>  frame;
+    graphe::out_resource<int> boxes;
+
+    detect( graphe::ResourceRegistry & G)
+    {
+        frame = G.register_input_resource<int>("frame");
+        boxes = G.register_output_resource<int>("boxes");
+    }
+    void operator()()
+    {
+        boxes.set( *frame * 2 );
+    }
+};
+
+static long g_total = 0;
+
+class report
+{
+public:
+    graphe::in_resource<int> boxes;
+    graphe::in_resource<int> frame;
+
+    report( graphe::ResourceRegistry & G)
+    {
+        boxes = G.register_input_resource<int>("boxes");
+        frame = G.register_input_resource<int>("frame");
+    }
+    void operator()()
+    {
+        g_total += *boxes + *frame;
+    }
+};
+
+static bool g_fail = false;
+
+class fragile
+{
+public:
+    graphe::in_resource<int> boxes;
+
+    fragile( graphe::ResourceRegistry & G)
+    {
+        boxes = G.register_input_resource<int>("boxes");
+        if( g_fail )
+            throw std::runtime_error("fragile");
+    }
+    void operator()()
+    {
+    }
+};
+
+static void test_instances(bool compile_first)
+{
+    const int count = 500;
+
+    graphe::node_graph G;
+    G.add_node<settings>();
+    if( compile_first )
+        G.compile();
+
+    graphe::graph_template T;
+    T.add_node<decode>(1)
+     .add_node<detect>()
+     .add_node<report>();
+    CHECK( T.size() == 3 );
+
+    for(int i=0; i < count; ++i)
+    {
+        auto prefix = "cam" + std::to_string(i) + "/";
+        auto nodes  = T.instantiate(G, prefix);
+        CHECK( nodes.size() == 3 );
+        CHECK( G.get_resource_id(prefix + "frame") != graphe::invalid_resource_id );
+    }
+    CHECK( G.get_exec_nodes().size() == 1 + 3 * count );
+    if( !compile_first )
+        G.compile();
+
+    graphe::serial_executor E(G);
+    for(int f=0; f < 3; ++f)
+    {
+        g_total = 0;
+        G.reset();
+        E.execute();
+        CHECK( g_total == count * (22 + 11) );
+    }
+
+    auto id = G.get_resource_id("cam123/boxes");
+    CHECK( id != graphe::invalid_resource_id );
+    CHECK( G.get_resources(id)->Get<int>() == 22 );
+    CHECK( G.get_resource_id("settings") != graphe::invalid_resource_id );
+    CHECK( G.get_resource_id("cam0/settings") == graphe::invalid_resource_id );
+    CHECK( G.get_resources(id)->get_consumers().size() == 1 ); // only cam123's report
+    CHECK( G.get_resources("settings")->get_consumers().size() == count );
+}
+
+static void test_rollback(bool compile_first)
+{
+    graphe::node_graph G;
+    G.add_node<settings>();
+    if( compile_first )
+        G.compile();
+
+    graphe::graph_template T;
+    T.add_node<decode>(2)
+     .add_node<detect>()
+     .add_node<fragile>();
+
+    // the instance which records the template
+    g_fail = true;
+    CHECK_THROWS( T.instantiate(G, "a/") );
+    CHECK( G.get_exec_nodes().size() == 1 );
+
+    g_fail = false;
+    T.instantiate(G, "b/");
+    CHECK( G.get_exec_nodes().size() == 4 );
+
+    // an instance which replays the record
+    g_fail = true;
+    CHECK_THROWS( T.instantiate(G, "c/") );
+    CHECK( G.get_exec_nodes().size() == 4 );
+    auto c = G.get_resource_id("c/frame");
+    CHECK( c == graphe::invalid_resource_id || G.get_resources(c) == nullptr );
+
+    g_fail = false;
+    auto nodes = T.instantiate(G, "d/");
+    CHECK( G.get_exec_nodes().size() == 7 );
+    if( !compile_first )
+        G.compile();
+
+    graphe::serial_executor E(G);
+    G.reset();
+    E.execute();
+    CHECK( G.get_resources("b/boxes")->Get<int>() == 24 );
+    CHECK( G.get_resources("d/boxes")->Get<int>() == 24 );
+
+    for(auto N : nodes)
+        G.remove_node(*N);
+    G.reset();
+    E.execute();
+    CHECK( G.get_exec_nodes().size() == 4 );
+    CHECK( G.get_resources("b/boxes")->Get<int>() == 24 );
+}
+
+static int g_registrations = 0;
+
+class changes_registrations
+{
+public:
+    changes_registrations( graphe::ResourceRegistry & G)
+    {
+        if( g_registrations++ == 0 )
+            G.register_input_resource<int>("/settings");
+        else
+            G.register_input_resource<int>("other");
+    }
+    void operator()()
+    {
+    }
+};
+
+static void test_record_mismatch()
+{
+    graphe::node_graph G;
+    G.add_node<settings>();
+
+    graphe::graph_template T;
+    T.add_node<changes_registrations>();
+    T.instantiate(G, "x/");
+    CHECK_THROWS( T.instantiate(G, "y/") );
+    CHECK( G.get_exec_nodes().size() == 2 );
+}
+
+int main()
+{
+    test_instances(false);
+    test_instances(true);
+    test_rollback(false);
+    test_rollback(true);
+    test_record_mismatch();
+    return test_result("test_graph_template");
+}
@@ -0,0 +1,174 @@
+/**
+ * graph_metrics: every execution and frame is counted, per node and per
+ * worker, while snapshots are taken from another thread.
+ */
+#include <string>
+#include <thread>
+
+#include "graph-e/metrics.h"
+#include "graph-e/node_graph.h"
+#include "graph-e/threaded_executor.h"
+#include "graph-e/work_stealing_executor.h"
+
+#include "test_common.h"
+
+class source
+{
+public:
+    graphe::out_resource<int> out;
+
+    source( graphe::ResourceRegistry & G, std::string const & name)
+    {
+        out = G.register_output_resource<int>(name);
+    }
+    void operator()()
+    {
+        out.set(1);
+    }
+};
+
+class work
+{
+public:
+    graphe::in_resource<int>  in;
+    graphe::out_resource<int> out;
+
+    work( graphe::ResourceRegistry & G, std::string const & input, std::string const & output)
+    {
+        in  = G.register_input_resource<int>(input);
+        out = G.register_output_resource<int>(output);
+    }
+    void operator()()
+    {
+        volatile int x = 0;
+        for(int k=0; k < 2000; ++k)
+            x = x + k;
+        out.set( *in + 1 );
+    }
+};
+
+static const int chains = 16;
+
+static void build(graphe::node_graph & G)
+{
+    for(int k=0; k < chains; ++k)
+    {
+        auto s = std::to_string(k);
+        G.add_node<source>("a" + s).set_name("src" + s);
+        G.add_node<work>("a" + s, "b" + s).set_name("work" + s);
+    }
+    G.compile();
+}
+
+template<typename Executor>
+static void run_frames(graphe::node_graph & G, Executor & E, int frames)
+{
+    for(int f=0; f < frames; ++f)
+    {
+        G.reset();
+        E.execute();
+        E.wait();
+    }
+}
+
+static void check_counts(graphe::metrics_snapshot const & S, uint64_t frames)
+{
+    CHECK( S.frames == frames );
+    CHECK( S.nodes.size() == 2 * chains );
+
+    uint64_t executed = 0;
+    for(auto & n : S.nodes)
+    {
+        CHECK( n.count == frames );
+        CHECK( n.name.compare(0, 3, "src") == 0 || n.name.compare(0, 4, "work") == 0 );
+        CHECK( n.mean_us >= 0.0 && n.max_us >= n.mean_us );
+        CHECK( n.p99_us >= n.p50_us );
+        uint64_t in_histogram = 0;
+        for(auto b : n.histogram)
+            in_histogram += b;
+        CHECK( in_histogram == n.count );
+    }
+    for(auto & w : S.workers)
+        executed += w.nodes;
+    CHECK( executed == 2 * chains * frames );
+    CHECK( S.makespan_max_us >= S.makespan_p50_us );
+}
+
+static void test_executors()
+{
+#if GRAPHE_METRICS
+    graphe::node_graph G;
+    build(G);
+    graphe::graph_metrics M;
+    G.set_metrics(&M);
+
+    std::atomic<bool> stop{false};
+    std::thread reader( [&]()
+    {
+        while( !stop )
+        {
+            auto S = M.snapshot();
+            CHECK( S.nodes.size() <= 2 * chains );
+            std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+        }
+    });
+
+    {
+        graphe::work_stealing_executor E(G, 4);
+        run_frames(G, E, 200);
+    }
+    auto S = M.snapshot();
+    check_counts(S, 200);
+    CHECK( S.workers.size() >= 1 && S.workers.size() <= 4 );
+
+    {
+        gnl::thread_pool T(3);
+        ThreadPoolWrapper TW(T);
+        graphe::threaded_executor<ThreadPoolWrapper> E(G);
+        E.set_thread_pool(&TW);
+        run_frames(G, E, 100);
+    }
+    stop = true;
+    reader.join();
+    check_counts( M.snapshot(), 300 );
+
+    // detached, nothing more is counted
+    G.set_metrics(nullptr);
+    {
+        graphe::work_stealing_executor E(G, 2);
+        run_frames(G, E, 10);
+    }
+    CHECK( M.snapshot().frames == 300 );
+#endif
+}
+
+/**
+ * One thread recording into two metrics objects in turn must be one worker
+ * of each, not a new worker every time it switches.
+ */
+static void test_alternating()
+{
+    graphe::graph_metrics a, b;
+    for(int i=0; i < 100; ++i)
+    {
+        a.record_steal();
+        b.record_steal();
+    }
+    auto sa = a.snapshot();
+    auto sb = b.snapshot();
+    CHECK( sa.workers.size() == 1 );
+    CHECK( sb.workers.size() == 1 );
+    CHECK( sa.workers[0].steals == 100 );
+
+    std::thread other( [&]() { a.record_steal(); } );
+    other.join();
+    CHECK( a.snapshot().workers.size() == 2 );
+    CHECK( b.snapshot().workers.size() == 1 );
+}
+
+int main()
+{
+    test_executors();
+    test_alternating();
+    return test_result("test_metrics");
+}
@@ -0,0 +1,381 @@
+/**
+ * Compiling and validating the graph, critical-path ranks, moveable,
+ * incremental and transient resources, the frame arena and the node pool.
+ */
+#include <string>
+#include <vector>
+
+#include "graph-e/node_graph.h"
+#include "graph-e/serial_executor.h"
+#include "graph-e/threaded_executor.h"
+
+#include "test_common.h"
+
+static std::vector<std::string> g_order;
+
+class source
+{
+public:
+    graphe::out_resource<int> out;
+    int                       value;
+
+    source( graphe::ResourceRegistry & G, std::string const & output, int v = 1) : value(v)
+    {
+        out = G.register_output_resource<int>(output);
+    }
+    void operator()()
+    {
+        out.set(value);
+    }
+};
+
+class add_one
+{
+public:
+    graphe::in_resource<int>  in;
+    graphe::out_resource<int> out;
+    std::string               name;
+
+    add_one( graphe::ResourceRegistry & G, std::string const & input, std::string const & output) : name(output)
+    {
+        in  = G.register_input_resource<int>(input);
+        out = G.register_output_resource<int>(output);
+    }
+    void operator()()
+    {
+        g_order.push_back(name);
+        out.set( *in + 1 );
+    }
+};
+
+static void test_validation()
+{
+    graphe::node_graph G;
+    G.add_node<source>("a").set_name("src");
+    G.add_node<source>("a").set_name("src2");          // two producers
+    G.add_node<add_one>("missing", "m1").set_name("m"); // no producer
+    G.add_node<add_one>("m1", "m2").set_name("down");   // waits on m
+    G.add_node<add_one>("c2", "c1").set_name("c_a");    // cycle
+    G.add_node<add_one>("c1", "c2").set_name("c_b");
+
+    auto issues = G.validate();
+    auto has = [&issues](graphe::graph_issue::kind k)
+    {
+        for(auto & i : issues)
+            if( i.type == k )
+                return true;
+        return false;
+    };
+    CHECK( has(graphe::graph_issue::kind::missing_producer) );
+    CHECK( has(graphe::graph_issue::kind::multiple_producers) );
+    CHECK( has(graphe::graph_issue::kind::cycle) );
+    CHECK( has(graphe::graph_issue::kind::unreachable) );
+    CHECK_THROWS( G.compile() );
+
+    G.set_validation(false);
+    G.compile();
+    CHECK( G.is_compiled() );
+}
+
+class forgetful
+{
+public:
+    graphe::out_resource<int> out;
+    bool const *               forget;
+
+    forgetful( graphe::ResourceRegistry & G, bool const * f) : forget(f)
+    {
+        out = G.register_output_resource<int>("f");
+    }
+    void operator()()
+    {
+        if( !*forget )
+            out.set(1);
+    }
+};
+
+/**
+ * A node which does not make its output available fails the frame from
+ * wait() instead of terminating the worker or leaving the graph busy.
+ */
+static void test_missing_output()
+{
+#if GRAPHE_RUNTIME_CHECKS
+    graphe::node_graph G;
+    bool forget = true;
+    G.add_node<forgetful>(&forget);
+    G.add_node<add_one>("f", "g");
+    G.compile();
+
+    {
+        graphe::serial_executor E(G);
+        CHECK_THROWS( E.execute() );
+        CHECK( !G.busy() );
+        forget = false;
+        G.reset();
+        E.execute(); // the error was cleared
+        CHECK( G.get_resources("g")->Get<int>() == 2 );
+    }
+
+    gnl::thread_pool T(2);
+    ThreadPoolWrapper TW(T);
+    graphe::threaded_executor<ThreadPoolWrapper> E(G);
+    E.set_thread_pool(&TW);
+    for(int f=0; f < 4; ++f)
+    {
+        forget = (f % 2) == 0;
+        G.reset();
+        E.execute();
+        if( forget )
+            CHECK_THROWS( E.wait() );
+        else
+            E.wait();
+        CHECK( !G.busy() );
+    }
+#endif
+}
+
+static void test_ranks()
+{
+    // a short branch and a long chain hang off the same source
+    graphe::node_graph G;
+    G.add_node<source>("s").set_name("S");
+    G.add_node<add_one>("s", "x").set_name("X");
+    G.add_node<add_one>("s", "l1").set_name("L1");
+    G.add_node<add_one>("l1", "l2").set_name("L2");
+    G.add_node<add_one>("l2", "l3").set_name("L3");
+    G.compile();
+
+    auto & nodes = G.get_exec_nodes();
+    CHECK( nodes[2]->get_rank() > nodes[3]->get_rank() );
+    CHECK( nodes[3]->get_rank() > nodes[4]->get_rank() );
+    CHECK( nodes[2]->get_rank() > nodes[1]->get_rank() );
+
+    graphe::serial_executor E(G);
+    for(int f=0; f < 3; ++f)
+    {
+        g_order.clear();
+        G.reset();
+        E.execute();
+        CHECK( g_order.size() == 4 && g_order[0] == "l1" ); // the long chain goes first
+        CHECK( G.get_resources("l3")->Get<int>() == 4 );
+    }
+}
+
+using buffer = std::vector<float>;
+
+class move_producer
+{
+public:
+    graphe::out_resource<buffer> out;
+
+    move_producer( graphe::ResourceRegistry & G)
+    {
+        out = G.register_output_resource<buffer, graphe::resource_flags::moveable>("buf");
+    }
+    void operator()()
+    {
+        out.set( buffer(1024, 1.0f) );
+    }
+};
+
+class move_consumer
+{
+public:
+    graphe::in_resource<buffer, graphe::resource_flags::moveable> in;
+    float * result;
+
+    move_consumer( graphe::ResourceRegistry & G, float * r) : result(r)
+    {
+        in = G.register_input_resource<buffer, graphe::resource_flags::moveable>("buf");
+    }
+    void operator()()
+    {
+        auto b = in.take();
+        *result = b.size() == 1024 ? b[0] : -1.0f;
+    }
+};
+
+static void test_moveable()
+{
+    graphe::node_graph G;
+    float result = 0.0f;
+    G.add_node<move_producer>();
+    G.add_node<move_consumer>(&result);
+    G.compile();
+
+    graphe::serial_executor E(G);
+    for(int f=0; f < 3; ++f)
+    {
+        G.reset();
+        result = 0.0f;
+        E.execute();
+        CHECK( result == 1.0f );
+        CHECK( !G.get_resources("buf")->has_value() ); // destroyed once the consumer ran
+    }
+    CHECK_THROWS( G.add_node<move_consumer>(&result) ); // only one consumer
+}
+
+static int g_source_runs = 0;
+
+class changing_source
+{
+public:
+    graphe::out_resource<int> out;
+    int * value;
+
+    changing_source( graphe::ResourceRegistry & G, int * v) : value(v)
+    {
+        out = G.register_output_resource<int>("v");
+    }
+    void operator()()
+    {
+        ++g_source_runs;
+        out.set_if_changed(*value);
+    }
+};
+
+static void test_incremental()
+{
+    graphe::node_graph G;
+    int value = 1;
+    G.add_node<changing_source>(&value);
+    auto & N = G.add_node<add_one>("v", "w");
+    G.set_incremental();
+    G.compile();
+
+    graphe::serial_executor E(G);
+    G.reset();
+    E.execute();
+    CHECK( !N.was_skipped() );
+
+    G.reset();
+    E.execute();
+    CHECK( N.was_skipped() );
+    CHECK( G.get_resources("w")->Get<int>() == 2 ); // the previous value is kept
+
+    value = 5;
+    G.reset();
+    E.execute();
+    CHECK( !N.was_skipped() );
+    CHECK( G.get_resources("w")->Get<int>() == 6 );
+    CHECK( g_source_runs == 3 ); // nodes without inputs always run
+}
+
+static void test_release_transients()
+{
+    graphe::node_graph G;
+    G.add_node<source>("t0");
+    for(int k=1; k < 5; ++k)
+        G.add_node<add_one>( "t" + std::to_string(k-1), "t" + std::to_string(k) );
+    G.set_release_transients(true);
+    G.compile();
+
+    graphe::serial_executor E(G);
+    for(int f=0; f < 3; ++f)
+    {
+        G.reset();
+        E.execute();
+        CHECK( !G.get_resources("t0")->has_value() ); // all its readers finished
+        CHECK( !G.get_resources("t3")->has_value() );
+        CHECK( G.get_resources("t4")->has_value() );  // no readers, kept until reset()
+        CHECK( G.get_resources("t4")->Get<int>() == 5 );
+    }
+}
+
+class arena_producer
+{
+public:
+    graphe::out_resource< std::pmr::vector<float> > a;
+    graphe::out_resource< std::vector<float> >      b;
+
+    arena_producer( graphe::ResourceRegistry & G)
+    {
+        a = G.register_output_resource< std::pmr::vector<float> >("a");
+        b = G.register_output_resource< std::vector<float> >("b");
+    }
+    void operator()()
+    {
+        a.emplace( 1024, 1.0f, a.memory_resource() );
+        a.make_available();
+        b.set( std::vector<float>(1024, 2.0f) );
+    }
+};
+
+class arena_consumer
+{
+public:
+    graphe::in_resource< std::pmr::vector<float> > a;
+    graphe::in_resource< std::vector<float> >      b;
+    graphe::out_resource<float>                    out;
+
+    arena_consumer( graphe::ResourceRegistry & G)
+    {
+        a   = G.register_input_resource< std::pmr::vector<float> >("a");
+        b   = G.register_input_resource< std::vector<float> >("b");
+        out = G.register_output_resource<float>("sum");
+    }
+    void operator()()
+    {
+        out.set( a.get()[0] + b.get()[0] );
+    }
+};
+
+static void test_frame_arena()
+{
+    graphe::node_graph G;
+    G.add_node<arena_producer>();
+    G.add_node<arena_consumer>();
+    G.enable_frame_arena();
+    G.compile();
+    CHECK( G.get_frame_arena() != nullptr );
+
+    graphe::serial_executor E(G);
+    for(int f=0; f < 3; ++f)
+    {
+        G.reset();
+        E.execute();
+        CHECK( G.get_resources("sum")->Get<float>() == 3.0f );
+    }
+    G.reset();
+    CHECK( !G.get_resources("a")->has_value() ); // placed in the arena, destroyed before it is rewound
+    CHECK( G.get_resources("b")->has_value() );  // kept and reused
+    CHECK_THROWS( G.set_incremental() );
+}
+
+struct throws_if
+{
+    explicit throws_if(bool t)
+    {
+        if( t )
+            throw std::runtime_error("throws_if");
+    }
+};
+
+/**
+ * A constructor which throws gives its slot back, the next create() reuses it.
+ */
+static void test_node_pool()
+{
+    graphe::object_pool<throws_if> P(1);
+    auto a = P.create(false);
+    P.destroy(a);
+    CHECK_THROWS( P.create(true) );
+    CHECK_THROWS( P.create(true) );
+    auto b = P.create(false);
+    CHECK( b == a );
+    P.destroy(b);
+}
+
+int main()
+{
+    test_validation();
+    test_missing_output();
+    test_ranks();
+    test_moveable();
+    test_incremental();
+    test_release_transients();
+    test_frame_arena();
+    test_node_pool();
+    return test_result("test_node_graph");
+}
@@ -0,0 +1,130 @@
+/**
+ * pipelined_executor: frames overlap, but a node never runs two frames at
+ * once, and every frame runs every node.
+ */
+#include <string>
+#include <thread>
+
+#include "graph-e/pipelined_executor.h"
+
+#include "test_common.h"
+
+static const int num_links = 8;
+
+static std::atomic<int> g_total{0};
+static std::atomic<int> g_self_overlap{0};
+static std::atomic<int> g_running[num_links + 1];
+static std::atomic<int> g_config_runs{0};
+
+class source
+{
+public:
+    graphe::out_resource<int> out;
+
+    source( graphe::ResourceRegistry & G)
+    {
+        out = G.register_output_resource<int>("r0");
+    }
+    void operator()()
+    {
+        if( ++g_running[0] > 1 )
+            ++g_self_overlap;
+        std::this_thread::sleep_for( std::chrono::microseconds(100) );
+        --g_running[0];
+        ++g_total;
+        out.set(0);
+    }
+};
+
+class stage
+{
+public:
+    graphe::in_resource<int>  in;
+    graphe::out_resource<int> out;
+    int k;
+
+    stage( graphe::ResourceRegistry & G, int k_) : k(k_)
+    {
+        in  = G.register_input_resource<int>( "r" + std::to_string(k-1) );
+        out = G.register_output_resource<int>( "r" + std::to_string(k) );
+    }
+    void operator()()
+    {
+        if( ++g_running[k] > 1 )
+            ++g_self_overlap;
+        std::this_thread::sleep_for( std::chrono::microseconds(100) );
+        --g_running[k];
+        ++g_total;
+        out.set( *in + 1 );
+    }
+};
+
+class config
+{
+public:
+    graphe::out_resource<int> out;
+
+    config( graphe::ResourceRegistry & G)
+    {
+        out = G.register_output_resource<int, graphe::resource_flags::permanent>("config");
+    }
+    void operator()()
+    {
+        ++g_config_runs;
+        out.set(1);
+    }
+};
+
+class use_config
+{
+public:
+    graphe::in_resource<int> config;
+    graphe::in_resource<int> last;
+
+    use_config( graphe::ResourceRegistry & G)
+    {
+        config = G.register_input_resource<int, graphe::resource_flags::permanent>("config");
+        last   = G.register_input_resource<int>( "r" + std::to_string(num_links) );
+    }
+    void operator()()
+    {
+        if( *config == 1 && *last == num_links )
+            ++g_total;
+    }
+};
+
+static void test_frames_in_flight(size_t K)
+{
+    gnl::thread_pool T(4);
+    ThreadPoolWrapper TW(T);
+
+    g_total        = 0;
+    g_self_overlap = 0;
+    g_config_runs  = 0;
+    {
+        graphe::pipelined_executor<ThreadPoolWrapper> E(K, [](graphe::node_graph & G)
+        {
+            G.add_node<source>();
+            for(int k=1; k <= num_links; ++k)
+                G.add_node<stage>(k);
+            G.add_oneshot_node<config>();
+            G.add_node<use_config>();
+        });
+        E.set_thread_pool(&TW);
+
+        for(int f=0; f < 40; ++f)
+            E.submit();
+        E.wait();
+    }
+    CHECK( g_total == 40 * (num_links + 2) );
+    CHECK( g_self_overlap == 0 );
+    CHECK( g_config_runs == static_cast<int>(K) ); // once in every copy of the graph
+}
+
+int main()
+{
+    test_frames_in_flight(1);
+    test_frames_in_flight(2);
+    test_frames_in_flight(3);
+    return test_result("test_pipelined_executor");
+}
@@ -0,0 +1,197 @@
+/**
+ * node_profiler: one event per node and frame with consistent times, a
+ * Chrome trace naming every node, and one worker per recording thread.
+ */
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "graph-e/profiler.h"
+#include "graph-e/node_graph.h"
+#include "graph-e/serial_executor.h"
+#include "graph-e/work_stealing_executor.h"
+
+#include "test_common.h"
+
+class source
+{
+public:
+    graphe::out_resource<int> out;
+
+    source( graphe::ResourceRegistry & G, std::string const & name)
+    {
+        out = G.register_output_resource<int>(name);
+    }
+    void operator()()
+    {
+        out.set(1);
+    }
+};
+
+class work
+{
+public:
+    graphe::in_resource<int>  in;
+    graphe::out_resource<int> out;
+
+    work( graphe::ResourceRegistry & G, std::string const & input, std::string const & output)
+    {
+        in  = G.register_input_resource<int>(input);
+        out = G.register_output_resource<int>(output);
+    }
+    void operator()()
+    {
+        out.set( *in + 1 );
+    }
+};
+
+static const int chains = 8;
+static const int frames = 20;
+
+static void build(graphe::node_graph & G)
+{
+    for(int k=0; k < chains; ++k)
+    {
+        auto s = std::to_string(k);
+        G.add_node<source>("a" + s).set_name("src" + s);
+        G.add_node<work>("a" + s, "b" + s).set_name("work" + s);
+    }
+    G.compile();
+}
+
+static void check_events(graphe::node_profiler const & P, size_t num_nodes, uint32_t first_frame)
+{
+    auto events = P.collect();
+    auto names  = P.get_node_names();
+    CHECK( events.size() == num_nodes * frames );
+    CHECK( names.size() == num_nodes );
+
+    std::vector< std::vector<int> > seen( names.size(), std::vector<int>(frames, 0) );
+    int64_t last_start = 0;
+    for(auto & e : events)
+    {
+        CHECK( e.node < names.size() );
+        CHECK( e.worker < P.num_workers() );
+        CHECK( e.frame >= first_frame && e.frame < first_frame + frames );
+        CHECK( e.scheduled_ns <= e.start_ns && e.start_ns <= e.end_ns );
+        CHECK( e.start_ns >= last_start ); // collect() sorts by start time
+        last_start = e.start_ns;
+        if( e.node < names.size() && e.frame >= first_frame && e.frame < first_frame + frames )
+            ++seen[e.node][e.frame - first_frame];
+    }
+    for(auto & n : seen)
+        for(auto c : n)
+            CHECK( c == 1 );
+}
+
+template<typename Executor>
+static void run_frames(graphe::node_graph & G, Executor & E)
+{
+    for(int f=0; f < frames; ++f)
+    {
+        G.reset();
+        E.execute();
+        E.wait();
+    }
+}
+
+static void test_serial()
+{
+    graphe::node_graph G;
+    build(G);
+    graphe::node_profiler P;
+    G.set_profiler(&P);
+
+    graphe::serial_executor E(G);
+    auto first = P.get_frame() + 1;
+    for(int f=0; f < frames; ++f)
+    {
+        G.reset();
+        E.execute();
+    }
+    check_events(P, 2 * chains, first);
+    CHECK( P.num_workers() == 1 );
+
+    std::stringstream trace;
+    P.write_chrome_trace(trace);
+    auto json = trace.str();
+    CHECK( json.find("traceEvents") != std::string::npos );
+    for(int k=0; k < chains; ++k)
+    {
+        CHECK( json.find( "\"src"  + std::to_string(k) + "\"" ) != std::string::npos );
+        CHECK( json.find( "\"work" + std::to_string(k) + "\"" ) != std::string::npos );
+    }
+
+    P.clear();
+    CHECK( P.collect().empty() );
+}
+
+static void test_work_stealing()
+{
+    graphe::node_graph G;
+    build(G);
+    graphe::node_profiler P;
+    G.set_profiler(&P);
+
+    auto first = P.get_frame() + 1;
+    {
+        graphe::work_stealing_executor E(G, 4);
+        run_frames(G, E);
+    }
+    check_events(P, 2 * chains, first);
+    CHECK( P.num_workers() >= 1 && P.num_workers() <= 4 );
+}
+
+static void test_ring_overwrite()
+{
+    graphe::node_graph G;
+    build(G);
+    graphe::node_profiler P(10);
+    G.set_profiler(&P);
+
+    graphe::serial_executor E(G);
+    for(int f=0; f < 5; ++f)
+    {
+        G.reset();
+        E.execute();
+    }
+    auto events = P.collect();
+    CHECK( events.size() == 10 ); // only the newest events are kept
+    for(auto & e : events)
+        CHECK( e.frame == P.get_frame() );
+}
+
+/**
+ * One thread recording into two profilers in turn must be one worker of
+ * each, not a new worker every time it switches.
+ */
+static void test_alternating()
+{
+    graphe::node_profiler a(16), b(16);
+    auto t  = graphe::node_profiler::clock::now();
+    auto ia = graphe::node_profiler::invalid_id;
+    auto ib = graphe::node_profiler::invalid_id;
+    for(int i=0; i < 100; ++i)
+    {
+        a.record(ia, "x", t, t, t);
+        b.record(ib, "y", t, t, t);
+    }
+    CHECK( a.num_workers() == 1 );
+    CHECK( b.num_workers() == 1 );
+    CHECK( a.collect().size() == 16 );
+
+    std::thread other( [&]() { a.record(ia, "x", t, t, t); } );
+    other.join();
+    CHECK( a.num_workers() == 2 );
+    CHECK( b.num_workers() == 1 );
+    CHECK( a.get_node_names().size() == 1 );
+}
+
+int main()
+{
+    test_serial();
+    test_work_stealing();
+    test_ring_overwrite();
+    test_alternating();
+    return test_result("test_profiler");
+}
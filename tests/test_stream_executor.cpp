@@ -0,0 +1,216 @@
+/**
+ * stream_executor: items flow through a pipeline of bounded streams until
+ * the source closes, each node runs on one thread at a time, and frame
+ * executors skip the stream nodes.
+ */
+#include "graph-e/stream_executor.h"
+#include "graph-e/serial_executor.h"
+
+#include "test_common.h"
+
+static const int num_items = 20000;
+
+class reader
+{
+public:
+    graphe::out_stream<int> out;
+    int next = 0;
+
+    reader( graphe::ResourceRegistry & G)
+    {
+        out = G.register_output_stream<int>("raw", 64);
+    }
+    void operator()()
+    {
+        if( next == num_items )
+            out.close();
+        else
+            out.push( next++ );
+    }
+};
+
+static std::atomic<int> g_concurrent{0};
+static std::atomic<int> g_overlap{0};
+
+class doubler
+{
+public:
+    graphe::in_stream<int>   in;
+    graphe::out_stream<long> out;
+
+    doubler( graphe::ResourceRegistry & G)
+    {
+        in  = G.register_input_stream<int>("raw");
+        out = G.register_output_stream<long>("doubled", 16);
+    }
+    void operator()()
+    {
+        if( ++g_concurrent > 1 )
+            ++g_overlap;
+        int v;
+        if( in.try_pop(v) )
+            out.push( static_cast<long>(v) * 2 );
+        --g_concurrent;
+    }
+};
+
+class sink
+{
+public:
+    graphe::in_stream<long> in;
+    long * sum;
+    long * items;
+    bool * flushed;
+
+    sink( graphe::ResourceRegistry & G, long * s, long * i, bool * f) : sum(s), items(i), flushed(f)
+    {
+        in = G.register_input_stream<long>("doubled");
+    }
+    void operator()()
+    {
+        long v;
+        while( in.try_pop(v) )
+        {
+            *sum += v;
+            ++*items;
+        }
+        if( in.eof() )
+            *flushed = true;
+    }
+};
+
+static int g_frame_runs = 0;
+
+class frame_node
+{
+public:
+    graphe::out_resource<int> out;
+
+    frame_node( graphe::ResourceRegistry & G)
+    {
+        out = G.register_output_resource<int>("f");
+    }
+    void operator()()
+    {
+        ++g_frame_runs;
+        out.set(1);
+    }
+};
+
+static void test_pipeline()
+{
+    graphe::node_graph G;
+    long sum = 0, items = 0;
+    bool flushed = false;
+    G.add_node<reader>();
+    G.add_node<doubler>();
+    G.add_node<sink>(&sum, &items, &flushed);
+    G.add_node<frame_node>();
+    G.compile();
+
+    {
+        graphe::serial_executor S(G);
+        S.execute();
+        CHECK( g_frame_runs == 1 ); // only the frame node
+        CHECK( items == 0 );
+        G.reset();
+    }
+
+    gnl::thread_pool T(4);
+    ThreadPoolWrapper TW(T);
+    graphe::stream_executor<ThreadPoolWrapper> E(G, 32);
+    E.set_thread_pool(&TW);
+    E.execute(); // runs until every stream is closed and drained
+
+    CHECK( items == num_items );
+    CHECK( sum == static_cast<long>(num_items) * (num_items - 1) );
+    CHECK( flushed );
+    CHECK( g_overlap == 0 );
+    CHECK( G.get_stream("raw")->capacity() == 64 );
+}
+
+class late_sink
+{
+public:
+    graphe::in_stream<long> in;
+    bool * ran;
+
+    late_sink( graphe::ResourceRegistry & G, bool * r) : ran(r)
+    {
+        in = G.register_input_stream<long>("doubled");
+    }
+    void operator()()
+    {
+        *ran = true;
+    }
+};
+
+/**
+ * Nodes added once the executor exists get ids it has not seen: frame
+ * nodes are ignored as usual, and so is a stream node hooked to an existing
+ * stream, which the stream still wakes.
+ */
+static void test_nodes_added_later()
+{
+    graphe::node_graph G;
+    long sum = 0, items = 0;
+    bool flushed = false, late_ran = false;
+    G.add_node<reader>();
+    G.add_node<doubler>();
+    G.add_node<sink>(&sum, &items, &flushed);
+    G.compile();
+
+    gnl::thread_pool T(4);
+    ThreadPoolWrapper TW(T);
+    graphe::stream_executor<ThreadPoolWrapper> E(G, 32);
+    E.set_thread_pool(&TW);
+    for(int k=0; k < 64; ++k)
+        G.add_node<frame_node>().set_name("f" + std::to_string(k));
+    G.remove_node( *G.get_exec_nodes().back() );
+    G.add_node<late_sink>(&late_ran);
+    CHECK( G.get_exec_nodes().back()->get_id() >= 4 );
+    E.execute();
+
+    CHECK( items == num_items );
+    CHECK( flushed );
+    CHECK( !late_ran );
+}
+
+class int_consumer
+{
+public:
+    int_consumer( graphe::ResourceRegistry & G)
+    {
+        G.register_input_stream<int>("x");
+    }
+    void operator()()
+    {
+    }
+};
+
+class float_producer
+{
+public:
+    float_producer( graphe::ResourceRegistry & G)
+    {
+        G.register_output_stream<float>("x");
+    }
+    void operator()()
+    {
+    }
+};
+
+static void test_type_mismatch()
+{
+    graphe::node_graph G;
+    G.add_node<int_consumer>();
+    CHECK_THROWS( G.add_node<float_producer>() );
+}
+
+int main()
+{
+    test_pipeline();
+    test_nodes_added_later();
+    test_type_mismatch();
+    return test_result("test_stream_executor");
+}
@@ -0,0 +1,147 @@
+/**
+ * local_network and socket_transport: messages reach the right peer with
+ * their resource, frame and data, in the order one peer sent them, and
+ * messages which arrive before the receiver is set are not lost.
+ */
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <sys/socket.h>
+
+#include "graph-e/transport.h"
+
+#include "test_common.h"
+
+/**
+ * Collects the messages one rank receives.
+ */
+class inbox
+{
+public:
+    void attach(graphe::transport & T)
+    {
+        T.set_receiver( [this](graphe::resource_message && m)
+        {
+            std::lock_guard<std::mutex> lk(m_lock);
+            m_messages.push_back( std::move(m) );
+            m_changed.notify_all();
+        });
+    }
+
+    std::vector<graphe::resource_message> wait_for(size_t count)
+    {
+        std::unique_lock<std::mutex> lk(m_lock);
+        m_changed.wait_for( lk, std::chrono::seconds(30), [&]() { return m_messages.size() >= count; } );
+        return m_messages;
+    }
+
+protected:
+    std::mutex                            m_lock;
+    std::condition_variable               m_changed;
+    std::vector<graphe::resource_message> m_messages;
+};
+
+static graphe::resource_message make_message(uint32_t from, uint64_t frame)
+{
+    graphe::resource_message m;
+    m.resource = from;
+    m.frame    = frame;
+    m.data.assign( static_cast<size_t>(frame % 7) * 100, static_cast<uint8_t>(frame) );
+    return m;
+}
+
+/**
+ * Every rank sends num_frames messages to every other rank, from a thread of
+ * its own, and checks that each peer's messages arrive complete and in order.
+ */
+static void exchange(std::vector<graphe::transport*> const & ranks, uint64_t num_frames, size_t attach_later)
+{
+    auto n = static_cast<uint32_t>( ranks.size() );
+    std::vector<inbox> inboxes(n);
+    for(uint32_t r=0; r < n; ++r)
+    {
+        CHECK( ranks[r]->rank() == r );
+        CHECK( ranks[r]->size() == n );
+        if( r != attach_later )
+            inboxes[r].attach( *ranks[r] );
+    }
+
+    std::vector<std::thread> senders;
+    for(uint32_t r=0; r < n; ++r)
+        senders.emplace_back( [&, r]()
+        {
+            for(uint64_t f=0; f < num_frames; ++f)
+                for(uint32_t p=0; p < n; ++p)
+                    if( p != r )
+                        ranks[r]->send( p, make_message(r, f) );
+        });
+    for(auto & t : senders)
+        t.join();
+
+    if( attach_later < n )
+        inboxes[attach_later].attach( *ranks[attach_later] );
+
+    for(uint32_t r=0; r < n; ++r)
+    {
+        auto messages = inboxes[r].wait_for( (n - 1) * num_frames );
+        CHECK( messages.size() == (n - 1) * num_frames );
+
+        std::vector<uint64_t> next(n, 0);
+        for(auto & m : messages)
+        {
+            CHECK( m.resource < n && m.resource != r );
+            if( m.resource >= n )
+                continue;
+            CHECK( m.frame == next[m.resource] );
+            auto expected = make_message( static_cast<uint32_t>(m.resource), m.frame );
+            CHECK( m.data == expected.data );
+            next[m.resource] = m.frame + 1;
+        }
+    }
+}
+
+static void test_local_network()
+{
+    graphe::local_network net(3);
+    std::vector<graphe::transport*> ranks;
+    for(uint32_t r=0; r < 3; ++r)
+        ranks.push_back( &net.get_endpoint(r) );
+    exchange(ranks, 200, ~size_t(0));
+
+    graphe::local_network late(3);
+    std::vector<graphe::transport*> late_ranks;
+    for(uint32_t r=0; r < 3; ++r)
+        late_ranks.push_back( &late.get_endpoint(r) );
+    exchange(late_ranks, 50, 2);
+}
+
+static void test_socket_transport()
+{
+    const uint32_t n = 3;
+    std::vector< std::vector<int> > sockets( n, std::vector<int>(n, -1) );
+    for(uint32_t a=0; a < n; ++a)
+        for(uint32_t b=a+1; b < n; ++b)
+        {
+            int sv[2];
+            CHECK( ::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0 );
+            sockets[a][b] = sv[0];
+            sockets[b][a] = sv[1];
+        }
+
+    std::vector< std::unique_ptr<graphe::socket_transport> > transports;
+    std::vector<graphe::transport*> ranks;
+    for(uint32_t r=0; r < n; ++r)
+    {
+        transports.emplace_back( new graphe::socket_transport(r, sockets[r]) );
+        ranks.push_back( transports.back().get() );
+    }
+    exchange(ranks, 500, ~size_t(0));
+}
+
+int main()
+{
+    test_local_network();
+    test_socket_transport();
+    return test_result("test_transport");
+}
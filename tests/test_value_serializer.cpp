@@ -0,0 +1,170 @@
+/**
+ * value_codec and value_serializer_registry: trivially copyable values,
+ * flat containers and specialised codecs survive a roundtrip, and the
+ * registry converts the values held by resources.
+ */
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "graph-e/value_serializer.h"
+#include "graph-e/serial_executor.h"
+
+#include "test_common.h"
+
+struct point
+{
+    float x, y, z;
+};
+
+struct mesh
+{
+    std::string        name;
+    std::vector<point> vertices;
+};
+
+namespace graphe {
+
+template<>
+struct value_codec<mesh>
+{
+    static void save(mesh const & m, std::vector<uint8_t> & out)
+    {
+        uint32_t n = static_cast<uint32_t>( m.name.size() );
+        value_codec<uint32_t>::save(n, out);
+        value_codec<std::string>::save(m.name, out);
+        value_codec< std::vector<point> >::save(m.vertices, out);
+    }
+    static mesh load(uint8_t const * data, size_t size)
+    {
+        if( size < sizeof(uint32_t) )
+            throw std::runtime_error("value_codec<mesh>: wrong number of bytes");
+        auto n = value_codec<uint32_t>::load(data, sizeof(uint32_t));
+        if( size < sizeof(uint32_t) + n )
+            throw std::runtime_error("value_codec<mesh>: wrong number of bytes");
+        mesh m;
+        m.name     = value_codec<std::string>::load(data + sizeof(uint32_t), n);
+        m.vertices = value_codec< std::vector<point> >::load(data + sizeof(uint32_t) + n, size - sizeof(uint32_t) - n);
+        return m;
+    }
+};
+
+} // namespace graphe
+
+GRAPHE_REGISTER_VALUE(mesh);
+
+template<typename T>
+static T roundtrip(T const & x)
+{
+    std::vector<uint8_t> bytes;
+    graphe::value_codec<T>::save(x, bytes);
+    return graphe::value_codec<T>::load(bytes.data(), bytes.size());
+}
+
+static void test_codecs()
+{
+    CHECK( roundtrip(42) == 42 );
+    CHECK( roundtrip(-1.5) == -1.5 );
+
+    auto p = roundtrip( point{1, 2, 3} );
+    CHECK( p.x == 1 && p.y == 2 && p.z == 3 );
+
+    std::vector<int> v{ 1, 2, 3, 4, 5 };
+    CHECK( roundtrip(v) == v );
+    CHECK( roundtrip( std::vector<int>() ).empty() );
+    CHECK( roundtrip( std::string("resource") ) == "resource" );
+
+    std::vector<uint8_t> bytes;
+    graphe::value_codec<std::vector<int>>::save(v, bytes);
+    CHECK( bytes.size() == v.size() * sizeof(int) );
+    CHECK_THROWS( graphe::value_codec<int>::load(bytes.data(), 3) );
+    CHECK_THROWS( graphe::value_codec<std::vector<int>>::load(bytes.data(), bytes.size() - 1) );
+
+    mesh m{ "cube", { {0,0,0}, {1,0,0}, {1,1,0} } };
+    auto m2 = roundtrip(m);
+    CHECK( m2.name == "cube" );
+    CHECK( m2.vertices.size() == 3 && m2.vertices[2].y == 1 );
+    CHECK_THROWS( graphe::value_codec<mesh>::load(bytes.data(), 2) );
+}
+
+class make_values
+{
+public:
+    graphe::out_resource< std::vector<float> > samples;
+    graphe::out_resource<mesh>                 model;
+
+    make_values( graphe::ResourceRegistry & G)
+    {
+        samples = G.register_output_resource< std::vector<float> >("samples");
+        model   = G.register_output_resource<mesh>("model");
+    }
+    void operator()()
+    {
+        samples.set( std::vector<float>(100, 0.5f) );
+        model.set( mesh{ "tri", { {0,0,0}, {1,0,0}, {0,1,0} } } );
+    }
+};
+
+class use_values
+{
+public:
+    use_values( graphe::ResourceRegistry & G)
+    {
+        G.register_input_resource< std::vector<float> >("samples");
+        G.register_input_resource<mesh>("model");
+    }
+    void operator()()
+    {
+    }
+};
+
+static void test_registry()
+{
+    graphe::value_serializer_registry R;
+    R.add< std::vector<float> >(400);
+    CHECK( R.find( typeid(std::vector<float>) ) != nullptr );
+    CHECK( R.find( typeid(int) ) == nullptr );
+
+    auto & global = graphe::value_serializer_registry::global();
+    CHECK( global.find( typeid(mesh) ) != nullptr );
+
+    graphe::node_graph G;
+    G.add_node<make_values>();
+    G.compile();
+
+    auto & samples = *G.get_resources("samples");
+    auto & model   = *G.get_resources("model");
+    CHECK( R.size_of(samples) == 400.0 );   // the hint, before there is a value
+    CHECK( R.size_of(model)   == 0.0 );     // not registered in R
+    CHECK( global.size_of(model) == sizeof(mesh) );
+
+    graphe::serial_executor E(G);
+    E.execute();
+    CHECK( R.size_of(samples) == 100 * sizeof(float) );
+
+    // move the values into the resources of another graph
+    graphe::node_graph H;
+    H.add_node<use_values>();
+    auto e = R.find( typeid(std::vector<float>) );
+    std::vector<uint8_t> bytes;
+    e->save(samples, bytes);
+    e->load(*H.get_resources("samples"), bytes.data(), bytes.size());
+    CHECK( H.get_resources("samples")->Get< std::vector<float> >().size() == 100 );
+    CHECK( H.get_resources("samples")->Get< std::vector<float> >()[99] == 0.5f );
+
+    auto m = global.find( typeid(mesh) );
+    bytes.clear();
+    m->save(model, bytes);
+    m->load(*H.get_resources("model"), bytes.data(), bytes.size());
+    CHECK( H.get_resources("model")->Get<mesh>().name == "tri" );
+
+    m->clear(*H.get_resources("model"));
+    CHECK( H.get_resources("model")->Get<mesh>().vertices.empty() );
+}
+
+int main()
+{
+    test_codecs();
+    test_registry();
+    return test_result("test_value_serializer");
+}
@@ -0,0 +1,216 @@
+/**
+ * work_stealing_executor: wide and deep graphs over many frames, with
+ * deferred notification and fusion, pinned nodes, and one-shot nodes with
+ * permanent resources.
+ */
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "graph-e/node_graph.h"
+#include "graph-e/work_stealing_executor.h"
+
+#include "test_common.h"
+
+class source
+{
+public:
+    graphe::out_resource<int> out;
+    int const * frame;
+
+    source( graphe::ResourceRegistry & G, int const * f) : frame(f)
+    {
+        out = G.register_output_resource<int>("src");
+    }
+    void operator()()
+    {
+        out.set(*frame);
+    }
+};
+
+class chain_link
+{
+public:
+    graphe::in_resource<int>  in;
+    graphe::out_resource<int> out;
+
+    chain_link( graphe::ResourceRegistry & G, std::string const & input, std::string const & output)
+    {
+        in  = G.register_input_resource<int>(input);
+        out = G.register_output_resource<int>(output);
+    }
+    void operator()()
+    {
+        out.set( *in + 1 );
+    }
+};
+
+class gather
+{
+public:
+    std::vector< graphe::in_resource<int> > in;
+    long * result;
+
+    gather( graphe::ResourceRegistry & G, std::vector<std::string> const & inputs, long * r) : result(r)
+    {
+        for(auto & i : inputs)
+            in.push_back( G.register_input_resource<int>(i) );
+    }
+    void operator()()
+    {
+        long s = 0;
+        for(auto & i : in)
+            s += *i;
+        *result = s;
+    }
+};
+
+/**
+ * 64 chains of 16 links each hang off one source and are gathered at the end.
+ */
+static void test_fan_out(bool deferred, bool fusion)
+{
+    const int chains = 64;
+    const int length = 16;
+
+    graphe::node_graph G;
+    int  frame  = 0;
+    long result = 0;
+    G.add_node<source>(&frame);
+    std::vector<std::string> ends;
+    for(int c=0; c < chains; ++c)
+    {
+        std::string prev = "src";
+        for(int k=0; k < length; ++k)
+        {
+            auto name = "c" + std::to_string(c) + "_" + std::to_string(k);
+            G.add_node<chain_link>(prev, name);
+            prev = name;
+        }
+        ends.push_back(prev);
+    }
+    G.add_node<gather>(ends, &result);
+    G.set_deferred_notify(deferred);
+    G.set_fusion(fusion);
+    G.compile();
+
+    graphe::work_stealing_executor E(G, 4);
+    for(frame=0; frame < 100; ++frame)
+    {
+        E.execute();
+        E.wait();
+        CHECK( result == static_cast<long>(chains) * (frame + length) );
+        CHECK( !G.busy() );
+        G.reset();
+    }
+}
+
+static std::mutex                g_lock;
+static std::set<std::thread::id> g_pinned_threads;
+
+class pinned
+{
+public:
+    graphe::in_resource<int>  in;
+    graphe::out_resource<int> out;
+
+    pinned( graphe::ResourceRegistry & G)
+    {
+        in  = G.register_input_resource<int>("src");
+        out = G.register_output_resource<int>("pinned");
+    }
+    void operator()()
+    {
+        {
+            std::lock_guard<std::mutex> lk(g_lock);
+            g_pinned_threads.insert( std::this_thread::get_id() );
+        }
+        out.set( *in );
+    }
+};
+
+static void test_affinity()
+{
+    graphe::node_graph G;
+    int frame = 0;
+    G.add_node<source>(&frame);
+    G.add_node<pinned>().set_affinity(1);
+    for(int k=0; k < 32; ++k)
+        G.add_node<chain_link>("src", "side" + std::to_string(k));
+    G.compile();
+
+    graphe::work_stealing_executor E(G, 4);
+    for(frame=0; frame < 200; ++frame)
+    {
+        E.execute();
+        E.wait();
+        CHECK( G.get_resources("pinned")->Get<int>() == frame );
+        G.reset();
+    }
+    CHECK( g_pinned_threads.size() == 1 );
+}
+
+static std::atomic<int> g_config_runs{0};
+
+class config
+{
+public:
+    graphe::out_resource<int> out;
+
+    config( graphe::ResourceRegistry & G)
+    {
+        out = G.register_output_resource<int, graphe::resource_flags::permanent>("config");
+    }
+    void operator()()
+    {
+        ++g_config_runs;
+        out.set(10);
+    }
+};
+
+class use_config
+{
+public:
+    graphe::in_resource<int>  in;
+    graphe::out_resource<int> out;
+
+    use_config( graphe::ResourceRegistry & G)
+    {
+        in  = G.register_input_resource<int, graphe::resource_flags::permanent>("config");
+        out = G.register_output_resource<int>("configured");
+    }
+    void operator()()
+    {
+        out.set( *in * 2 );
+    }
+};
+
+static void test_oneshot()
+{
+    graphe::node_graph G;
+    G.add_oneshot_node<config>();
+    G.add_node<use_config>();
+    G.compile();
+
+    graphe::work_stealing_executor E(G, 2);
+    for(int f=0; f < 50; ++f)
+    {
+        E.execute();
+        E.wait();
+        CHECK( G.get_resources("configured")->Get<int>() == 20 );
+        G.reset();
+    }
+    CHECK( g_config_runs == 1 );
+}
+
+int main()
+{
+    test_fan_out(false, false);
+    test_fan_out(true, false);
+    test_fan_out(false, true);
+    test_fan_out(true, true);
+    test_affinity();
+    test_oneshot();
+    return test_result("test_work_stealing_executor");
+}